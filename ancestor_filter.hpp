@@ -0,0 +1,156 @@
+#ifndef NVPARSE_ANCESTORFILTER_HPP_INCLUDED
+#define NVPARSE_ANCESTORFILTER_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "hash.hpp"
+#include "node.hpp"
+#include "string.hpp"
+
+namespace nvparsehtml {
+//! Responsible for telling, during a walk in document order, whether the
+//! ancestors of the current \ref Node definitely lack a name, class or id.
+//! The keys of the ancestors are counted in a Bloom filter: each key sets
+//! two of \ref counter_count counters, which go back down when the walk
+//! leaves the ancestor. A key whose counters are not both set is on no
+//! ancestor; a key whose counters are set may be. A counter that reaches
+//! 255 sticks there, which only costs false positives.
+template <class Ch>
+class AncestorFilter {
+   public:
+    //! Kinds of key, hashed apart
+    enum KIND {
+        KIND_TYPE,   //!< element name, case insensitive
+        KIND_CLASS,  //!< class
+        KIND_ID,     //!< id
+    };
+
+    //! Bits of a hash used to pick one counter.
+    static constexpr unsigned key_bits = 12;
+    static constexpr size_t counter_count = size_t(1) << key_bits;
+
+    //! Hashes a key. Code units are hashed by value, so selector text and a
+    //! \ref String of another character type hash alike when ASCII.
+    //! \param kind kind of the key.
+    //! \param text first code unit.
+    //! \param length number of code units.
+    //! \return hash, of which 2 * \ref key_bits bits are used.
+    template <class C>
+    static uint32_t hash(KIND kind, const C *text, size_t length) {
+        uint32_t h = 2166136261u ^ static_cast<uint32_t>(kind);
+        for (size_t i = 0; i < length; ++i) {
+            C c = kind == KIND_TYPE ? internal::lower_char(text[i]) : text[i];
+            h = (h ^ static_cast<uint32_t>(c)) * 16777619u;
+        }
+        return static_cast<uint32_t>(hash_integer(h) >> 32);
+    }
+
+    AncestorFilter() {
+        this->clear();
+    }
+
+    //! Empties the filter and forgets the walk.
+    void clear() {
+        std::memset(m_counters, 0, sizeof(m_counters));
+        m_ancestors.clear();
+        m_last = nullptr;
+    }
+    //! Starts a walk of the descendants of root, with root and the \ref Node s
+    //! above it as the first ancestors.
+    //! \param root the \ref Node the walk starts from.
+    void reset(Node<Ch> *root) {
+        this->clear();
+        for (Node<Ch> *node = root->parent(); node != nullptr; node = node->parent())
+            m_ancestors.push_back(node);
+        std::reverse(m_ancestors.begin(), m_ancestors.end());
+        for (Node<Ch> *node : m_ancestors)
+            this->add(node);
+        m_last = root;
+    }
+    //! Moves the walk to the next \ref Node in document order, so that the
+    //! filter holds its ancestors.
+    //! \param node the next \ref Node after the last one passed or root.
+    void advance(Node<Ch> *node) {
+        Node<Ch> *parent = node->parent();
+        if (m_last == parent) {
+            m_ancestors.push_back(parent);
+            this->add(parent);
+        } else {
+            while (!m_ancestors.empty() && m_ancestors.back() != parent) {
+                this->remove(m_ancestors.back());
+                m_ancestors.pop_back();
+            }
+        }
+        m_last = node;
+    }
+
+    //! May an ancestor have a key?
+    //! \param key_hash hash of the key from \ref hash.
+    //! \return false if no ancestor has the key.
+    bool may_contain(uint32_t key_hash) const {
+        return m_counters[key_hash & key_mask] != 0 &&
+               m_counters[(key_hash >> key_bits) & key_mask] != 0;
+    }
+    //! May ancestors have every key?
+    //! \param key_hashes hashes of the keys from \ref hash.
+    //! \return false if one of the keys is on no ancestor.
+    bool may_contain_all(const std::vector<uint32_t> &key_hashes) const {
+        return this->may_contain_all(key_hashes.data(), key_hashes.size());
+    }
+    //! May ancestors have every key?
+    //! \param key_hashes first hash of the keys from \ref hash.
+    //! \param count number of keys.
+    //! \return false if one of the keys is on no ancestor.
+    bool may_contain_all(const uint32_t *key_hashes, size_t count) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (!this->may_contain(key_hashes[i]))
+                return false;
+        }
+        return true;
+    }
+
+   private:
+    static constexpr uint32_t key_mask = counter_count - 1;
+
+    uint8_t m_counters[counter_count];
+    std::vector<Node<Ch> *> m_ancestors;  // of the last node, the root of the document first
+    Node<Ch> *m_last;
+
+    void add(Node<Ch> *node) {
+        this->for_each_key(node, [this](uint32_t key_hash) {
+            this->increment(key_hash & key_mask);
+            this->increment((key_hash >> key_bits) & key_mask);
+        });
+    }
+    void remove(Node<Ch> *node) {
+        this->for_each_key(node, [this](uint32_t key_hash) {
+            this->decrement(key_hash & key_mask);
+            this->decrement((key_hash >> key_bits) & key_mask);
+        });
+    }
+    void increment(uint32_t i) {
+        if (m_counters[i] != 0xFF)
+            ++m_counters[i];
+    }
+    void decrement(uint32_t i) {
+        if (m_counters[i] != 0xFF)
+            --m_counters[i];
+    }
+    template <class F>
+    static void for_each_key(Node<Ch> *node, F f) {
+        if (node->type() > Node<Ch>::NODE_ELEMENT)
+            return;
+        String<Ch> name = node->name();
+        f(hash(KIND_TYPE, name.data(), name.length()));
+        if (!node->id().empty())
+            f(hash(KIND_ID, node->id().data(), node->id().length()));
+        for (auto it = node->class_begin(); it != node->class_end(); ++it)
+            f(hash(KIND_CLASS, it->data(), it->length()));
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
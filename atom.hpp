@@ -0,0 +1,59 @@
+#ifndef NVPARSE_ATOM_HPP_INCLUDED
+#define NVPARSE_ATOM_HPP_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "hash_map.hpp"
+#include "string.hpp"
+
+namespace nvparsehtml {
+//! Responsible for interning \ref String s as small integer atoms
+template <typename Ch>
+class AtomTable {
+   public:
+    typedef uint32_t atom_type;
+
+    //! Value returned by \ref find when a \ref String has not been interned.
+    static constexpr atom_type npos = 0xFFFFFFFF;
+
+    //! Interns a \ref String.
+    //! \param s \ref String to intern. The characters are not copied.
+    //! \return the atom of the \ref String.
+    atom_type intern(const String<Ch> &s) {
+        auto it = m_atoms.find(s);
+        if (it != m_atoms.end())
+            return it->second;
+        atom_type atom = static_cast<atom_type>(m_strings.size());
+        m_strings.push_back(s);
+        m_atoms[s] = atom;
+        return atom;
+    }
+    //! Finds the atom of a \ref String without interning it.
+    //! \param s \ref String to find.
+    //! \return the atom or \ref npos if not found.
+    atom_type find(const String<Ch> &s) const {
+        auto it = m_atoms.find(s);
+        if (it == m_atoms.end())
+            return npos;
+        return it->second;
+    }
+    //! Gets the \ref String of an atom.
+    //! \param atom the atom.
+    //! \return \ref String of the atom.
+    const String<Ch> &str(atom_type atom) const {
+        return m_strings[atom];
+    }
+    //! Gets number of atoms.
+    //! \return number of atoms.
+    size_t size() const {
+        return m_strings.size();
+    }
+
+   private:
+    HashMap<String<Ch>, atom_type> m_atoms;
+    std::vector<String<Ch>> m_strings;
+};
+}  // namespace nvparsehtml
+
+#endif
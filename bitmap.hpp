@@ -0,0 +1,186 @@
+#ifndef NVPARSE_BITMAP_HPP_INCLUDED
+#define NVPARSE_BITMAP_HPP_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace nvparsehtml {
+namespace internal {
+// dest[i] = dest[i] & src[i]
+inline void and_words(uint64_t *dest, const uint64_t *src, size_t count) {
+    size_t i = 0;
+#if defined(NVPARSE_SIMD_AVX2)
+    for (; i + 4 <= count; i += 4) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dest + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), _mm256_and_si256(d, s));
+    }
+#elif defined(NVPARSE_SIMD_SSE2)
+    for (; i + 2 <= count; i += 2) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_and_si128(d, s));
+    }
+#endif
+    for (; i < count; ++i)
+        dest[i] &= src[i];
+}
+
+// dest[i] = dest[i] | src[i]
+inline void or_words(uint64_t *dest, const uint64_t *src, size_t count) {
+    size_t i = 0;
+#if defined(NVPARSE_SIMD_AVX2)
+    for (; i + 4 <= count; i += 4) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dest + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), _mm256_or_si256(d, s));
+    }
+#elif defined(NVPARSE_SIMD_SSE2)
+    for (; i + 2 <= count; i += 2) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_or_si128(d, s));
+    }
+#endif
+    for (; i < count; ++i)
+        dest[i] |= src[i];
+}
+
+// dest[i] = dest[i] & ~src[i]
+inline void and_not_words(uint64_t *dest, const uint64_t *src, size_t count) {
+    size_t i = 0;
+#if defined(NVPARSE_SIMD_AVX2)
+    for (; i + 4 <= count; i += 4) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dest + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), _mm256_andnot_si256(s, d));
+    }
+#elif defined(NVPARSE_SIMD_SSE2)
+    for (; i + 2 <= count; i += 2) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_andnot_si128(s, d));
+    }
+#endif
+    for (; i < count; ++i)
+        dest[i] &= ~src[i];
+}
+}  // namespace internal
+
+//! Responsible for a set of handles stored as one bit per handle.
+//! Dense sets, like the \ref Node s of a common class or element type,
+//! intersect and merge 64 handles per word, several words per instruction
+//! where SIMD is available.
+class Bitmap {
+   public:
+    typedef uint64_t word_type;
+
+    Bitmap() : m_size(0) {
+    }
+    //! Creates an empty set.
+    //! \param size number of handles the set can hold, 0 to size - 1.
+    explicit Bitmap(size_t size) : m_size(size), m_words((size + 63) / 64, 0) {
+    }
+    //! Creates a set of handles.
+    //! \param size number of handles the set can hold, 0 to size - 1.
+    //! \param handles handles in the set, e.g. a posting list.
+    template <class Handle>
+    Bitmap(size_t size, const std::vector<Handle> &handles) : Bitmap(size) {
+        for (Handle handle : handles)
+            this->set(handle);
+    }
+
+    //! Gets number of handles the set can hold.
+    //! \return number of bits.
+    size_t size() const {
+        return m_size;
+    }
+    //! Gets the words holding the bits, handle i is bit i % 64 of word i / 64.
+    //! \return pointer to the first word.
+    const word_type *data() const {
+        return m_words.data();
+    }
+    //! Adds a handle to the set.
+    //! \param handle the handle, less than \ref size.
+    void set(size_t handle) {
+        assert(handle < m_size);
+        m_words[handle >> 6] |= word_type(1) << (handle & 63);
+    }
+    //! Removes a handle from the set.
+    //! \param handle the handle, less than \ref size.
+    void reset(size_t handle) {
+        assert(handle < m_size);
+        m_words[handle >> 6] &= ~(word_type(1) << (handle & 63));
+    }
+    //! Is a handle in the set?
+    //! \param handle the handle, less than \ref size.
+    //! \return whether the handle is in the set.
+    bool test(size_t handle) const {
+        assert(handle < m_size);
+        return (m_words[handle >> 6] >> (handle & 63)) & 1;
+    }
+    //! Gets number of handles in the set.
+    //! \return number of set bits.
+    size_t count() const {
+        size_t count = 0;
+        for (word_type word : m_words)
+            count += internal::count_bits(word);
+        return count;
+    }
+    //! Is any handle in the set?
+    //! \return whether a bit is set.
+    bool any() const {
+        for (word_type word : m_words) {
+            if (word != 0)
+                return true;
+        }
+        return false;
+    }
+
+    //! Keeps the handles that are also in another set.
+    Bitmap &operator&=(const Bitmap &rhs) {
+        assert(m_size == rhs.m_size);
+        internal::and_words(m_words.data(), rhs.m_words.data(), m_words.size());
+        return *this;
+    }
+    //! Adds the handles of another set.
+    Bitmap &operator|=(const Bitmap &rhs) {
+        assert(m_size == rhs.m_size);
+        internal::or_words(m_words.data(), rhs.m_words.data(), m_words.size());
+        return *this;
+    }
+    //! Removes the handles of another set.
+    Bitmap &and_not(const Bitmap &rhs) {
+        assert(m_size == rhs.m_size);
+        internal::and_not_words(m_words.data(), rhs.m_words.data(), m_words.size());
+        return *this;
+    }
+
+    //! Lists the handles in the set.
+    //! \param handles vector the handles are appended to, ascending.
+    template <class Handle>
+    void handles(std::vector<Handle> &handles) const {
+        for (size_t w = 0; w < m_words.size(); ++w) {
+            for (word_type word = m_words[w]; word != 0; word &= word - 1)
+                handles.push_back(static_cast<Handle>(w * 64 + internal::count_trailing_zeros(word)));
+        }
+    }
+
+   private:
+    size_t m_size;
+    std::vector<word_type> m_words;
+};
+
+inline Bitmap operator&(Bitmap lhs, const Bitmap &rhs) {
+    return lhs &= rhs;
+}
+inline Bitmap operator|(Bitmap lhs, const Bitmap &rhs) {
+    return lhs |= rhs;
+}
+}  // namespace nvparsehtml
+
+#endif
@@ -5,16 +5,41 @@
 #include <forward_list>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "file.hpp"
 #include "node.hpp"
 #include "string.hpp"
 #include "text.hpp"
+#include "traverse.hpp"
 
 namespace nvparsehtml {
+template <class Ch>
+class DocumentIndex;
+
+//! Responsible for receiving each \ref Node as it is parsed, in document
+//! order: the \ref Node before its attributes and children, then its id,
+//! classes and attributes. A \ref DocumentIndex fills itself this way, see
+//! \ref DocumentNode::index_on_parse.
+template <typename Ch>
+class ParseObserver {
+   public:
+    virtual ~ParseObserver() {
+    }
+    //! A \ref Node was created, its parts follow.
+    virtual void parsed_node(Node<Ch> *node) = 0;
+    //! The last \ref Node has an id.
+    virtual void parsed_id(const String<Ch> &id) = 0;
+    //! The last \ref Node has a class.
+    virtual void parsed_class(const String<Ch> &class_name) = 0;
+    //! The last \ref Node has an attribute, a repeated one replaces the earlier value.
+    virtual void parsed_attribute(const String<Ch> &name, const String<Ch> &value) = 0;
+};
+
 //! Responsible for parsing XHTML and storing it as a DOM tree
 template <typename Ch>
 class DocumentNode : public Node<Ch> {
@@ -23,15 +48,37 @@ class DocumentNode : public Node<Ch> {
     bool m_parse_normalize_whitespace;
     bool m_parse_trim_whitespace;
     bool m_parse_no_utf8;
-    std::forward_list<Node<Ch> *> m_nodes;
+    // Creates the index of a parse, nullptr not to index
+    ParseObserver<Ch> *(*m_index_factory)(DocumentNode<Ch> *doc,
+                                          const std::vector<String<Ch>> *value_attributes);
+    bool m_index_all_values;
+    bool m_keep_original_source;
+    std::vector<std::basic_string<Ch>> m_index_value_attributes;  // copies of the names
+    std::list<Node<Ch> *> m_nodes;
+    std::unique_ptr<ParseObserver<Ch>> m_index;
+    NodeObserver<Ch> *m_observer;
+    String<Ch> m_source;
+    std::vector<Ch> m_original_source;
+    std::vector<std::unique_ptr<Ch[]>> m_string_blocks;
+    Ch *m_string_next;
+    size_t m_string_free;
+
+    static constexpr size_t string_block_size = 64 * 1024;
 
    public:
     DocumentNode()
         : m_parse_no_entity_translation(true),
           m_parse_normalize_whitespace(false),
           m_parse_trim_whitespace(false),
-          m_parse_no_utf8(false) {
+          m_parse_no_utf8(false),
+          m_index_factory(nullptr),
+          m_index_all_values(true),
+          m_keep_original_source(false),
+          m_observer(nullptr),
+          m_string_next(nullptr),
+          m_string_free(0) {
         this->type(Node<Ch>::NODE_DOCUMENT);
+        this->m_owner = this;  // so that changes to its children reach the observer
     }
 
     DocumentNode(File<Ch> &file) : DocumentNode() {
@@ -39,12 +86,21 @@ class DocumentNode : public Node<Ch> {
     }
 
     void clear() {
+        if (m_observer != nullptr)
+            m_observer->clearing();
+        m_index.reset();
+        this->clear_children();
         for (auto &p : m_nodes) {
             if (p != nullptr)
                 delete p;
             p = nullptr;
         }
         m_nodes.clear();
+        m_string_blocks.clear();
+        m_original_source.clear();
+        m_source = String<Ch>();
+        m_string_next = nullptr;
+        m_string_free = 0;
     }
 
     void parse(Ch *text) {
@@ -57,14 +113,157 @@ class DocumentNode : public Node<Ch> {
 
     ~DocumentNode() {
         this->clear();
+        if (m_observer != nullptr)
+            m_observer->destroying();
+    }
+
+    //! Gets the buffer the document was parsed from.
+    //! \return \ref String spanning the parsed text, up to its terminating 0,
+    //! empty after \ref clear or a failed parse.
+    const String<Ch> source() const {
+        return m_source;
+    }
+    //! Copies the text before each following parse changes it, e.g. by
+    //! expanding entities in place, see \ref original_source.
+    //! \param enable whether following parses keep a copy.
+    void keep_original_source(bool enable) {
+        m_keep_original_source = enable;
+    }
+    //! Gets the text the document was parsed from, as it was before parsing.
+    //! Offsets into it are the same as into \ref source.
+    //! \return \ref String of the copy, empty unless \ref keep_original_source was enabled.
+    const String<Ch> original_source() const {
+        return String<Ch>(m_original_source.data(), m_original_source.size());
+    }
+
+    //! Fills a \ref DocumentIndex while parsing, in the same pass that
+    //! creates the \ref Node s. Defined in document_index.hpp.
+    //! \param enable whether following parses build an index.
+    void index_on_parse(bool enable);
+    //! Fills a \ref DocumentIndex while parsing, with constant time value
+    //! lookups for some attributes only. Defined in document_index.hpp.
+    //! \param value_attributes names of the attributes whose values are indexed.
+    void index_on_parse(const std::vector<String<Ch>> &value_attributes);
+    //! Gets the index filled by the last parse. It is not updated when the
+    //! tree is changed afterwards. Defined in document_index.hpp.
+    //! \return \ref DocumentIndex pointer, nullptr unless \ref index_on_parse was enabled.
+    const DocumentIndex<Ch> *index() const;
+
+    //! Sets the observer told about every change to the \ref Node s of this
+    //! document that are linked into a tree, including parses.
+    //! \param observer the \ref NodeObserver, or nullptr to stop.
+    void observer(NodeObserver<Ch> *observer) {
+        m_observer = observer;
+    }
+    //! Gets the observer.
+    //! \return \ref NodeObserver pointer, nullptr if none.
+    NodeObserver<Ch> *observer() const {
+        return m_observer;
+    }
+
+    //! Creates a \ref Node owned by this document.
+    //! \param type the \ref Node::NODE_TYPE of the new \ref Node.
+    //! \return pointer to the new, unlinked \ref Node.
+    Node<Ch> *create_node(typename Node<Ch>::NODE_TYPE type) {
+        return this->append_node(new Node<Ch>(type));
+    }
+
+    //! Copies characters into storage owned by this document.
+    //! \param s \ref String to copy.
+    //! \return \ref String over the copy, valid until \ref clear.
+    String<Ch> allocate_string(const String<Ch> &s) {
+        if (s.empty())
+            return String<Ch>();
+        if (s.length() > m_string_free) {
+            size_t size = s.length() > string_block_size ? s.length() : string_block_size;
+            m_string_blocks.push_back(std::unique_ptr<Ch[]>(new Ch[size]));
+            m_string_next = m_string_blocks.back().get();
+            m_string_free = size;
+        }
+        Ch *dest = m_string_next;
+        for (size_t i = 0; i < s.length(); ++i)
+            dest[i] = s[i];
+        m_string_next += s.length();
+        m_string_free -= s.length();
+        return String<Ch>(dest, s.length());
+    }
+
+    //! Moves a subtree, and ownership of its nodes, into this document.
+    //! The subtree is detached from its parent and the nodes keep their
+    //! addresses; the strings of those from elsewhere are copied, as the
+    //! buffers they refer to may go away with their former owner.
+    //! \param node root of the subtree, owned by any or no document.
+    //! \return node, ready to be linked anywhere in this document.
+    Node<Ch> *adopt(Node<Ch> *node) {
+        assert(node->type() != Node<Ch>::NODE_DOCUMENT);
+        node->detach();
+        for (Node<Ch> *n : pre_order(node)) {
+            DocumentNode<Ch> *owner = n->m_owner;
+            if (owner == this)
+                continue;
+            if (owner == nullptr) {
+                this->append_node(n);
+            } else {
+                m_nodes.splice(m_nodes.end(), owner->m_nodes, n->m_owner_it);
+                n->m_owner = this;
+            }
+            this->copy_strings(n);
+        }
+        return node;
+    }
+
+    //! Copies a subtree, including its strings, into this document.
+    //! \param node root of the subtree to copy, from any document.
+    //! \return root of the unlinked copy, owned by this document.
+    Node<Ch> *deep_clone(Node<Ch> *node) {
+        assert(node->type() != Node<Ch>::NODE_DOCUMENT);
+        Node<Ch> *root = nullptr;
+        Node<Ch> *parent = nullptr;
+        for (TreeWalker<Ch> walker(node); !walker.done(); walker.next()) {
+            if (!walker.entering()) {
+                parent = parent->parent();
+                continue;
+            }
+            Node<Ch> *copy = this->append_node(new Node<Ch>(*walker.node()));
+            this->copy_strings(copy);
+            if (root == nullptr)
+                root = copy;
+            else
+                parent->append_child(copy);
+            parent = copy;
+        }
+        return root;
     }
 
    private:
     Node<Ch> *append_node(Node<Ch> *node) {
-        if (node != nullptr)
-            m_nodes.push_front(node);
+        if (node != nullptr) {
+            node->m_owner = this;
+            node->m_owner_it = m_nodes.insert(m_nodes.end(), node);
+        }
         return node;
     }
+
+    // Adds a freshly parsed node to the index, before its attributes and children
+    void index_node(Node<Ch> *node) {
+        if (m_index)
+            m_index->parsed_node(node);
+    }
+
+    // Points every string of node at copies owned by this document
+    void copy_strings(Node<Ch> *node) {
+        node->m_id = this->allocate_string(node->m_id);
+        node->m_name = this->allocate_string(node->m_name);
+        node->m_value = this->allocate_string(node->m_value);
+        std::set<String<Ch>> classes;
+        for (const auto &class_name : node->m_classes)
+            classes.insert(this->allocate_string(class_name));
+        node->m_classes.swap(classes);
+        std::map<String<Ch>, String<Ch>> attributes;
+        for (const auto &att : node->m_attributes)
+            attributes[this->allocate_string(att.first)] = this->allocate_string(att.second);
+        node->m_attributes.swap(attributes);
+    }
     void parse_document(Ch *text) {
         assert(text);
         Text<Ch>::parse_no_entity_translation = m_parse_no_entity_translation;
@@ -74,6 +273,16 @@ class DocumentNode : public Node<Ch> {
 
         // Remove current contents
         this->clear();
+        Ch *source = text;
+        if (m_keep_original_source)
+            m_original_source.assign(text, text + std::char_traits<Ch>::length(text));
+        if (m_index_factory != nullptr) {
+            std::vector<String<Ch>> names;
+            for (const std::basic_string<Ch> &name : m_index_value_attributes)
+                names.push_back(String<Ch>(name.data(), name.size()));
+            m_index.reset(m_index_factory(this, m_index_all_values ? nullptr : &names));
+            m_index->parsed_node(this);
+        }
 
         // Parse BOM, if any
         parse_bom(text);
@@ -94,6 +303,7 @@ class DocumentNode : public Node<Ch> {
                 throw std::runtime_error(std::string("expected '<' but got '") + *text +
                                          "'  text: " + std::string(text, 10));
         }
+        m_source = String<Ch>(source, text - source);
     }
 
     // is this a known void, script or style html element?
@@ -189,6 +399,7 @@ class DocumentNode : public Node<Ch> {
     Node<Ch> *parse_xml_declaration(Ch *&text) {
         // Create declaration
         Node<Ch> *declaration = new Node<Ch>(Node<Ch>::NODE_DECLARATION);
+        this->index_node(declaration);
 
         // Skip whitespace before attributes or ?>
         Text<Ch>::template skip<whitespace_pred<Ch>>(text);
@@ -220,6 +431,7 @@ class DocumentNode : public Node<Ch> {
         // Create comment node
         Node<Ch> *comment = new Node<Ch>(Node<Ch>::NODE_COMMENT);
         comment->value(String<Ch>(value, text - value));
+        this->index_node(comment);
 
         text += 3;  // Skip '-->'
         return comment;
@@ -269,6 +481,7 @@ class DocumentNode : public Node<Ch> {
         // Create a new doctype node
         Node<Ch> *doctype = new Node<Ch>(Node<Ch>::NODE_DOCTYPE);
         doctype->value(String<Ch>(value, text - value));
+        this->index_node(doctype);
 
         text += 1;  // skip '>'
         return doctype;
@@ -304,6 +517,7 @@ class DocumentNode : public Node<Ch> {
         // Set pi value (verbatim, no entity expansion or whitespace
         // normalization)
         pi->value(String<Ch>(value, text - value));
+        this->index_node(pi);
 
         text += 2;  // Skip '?>'
         return pi;
@@ -404,6 +618,7 @@ class DocumentNode : public Node<Ch> {
         // Create new cdata node
         Node<Ch> *cdata = new Node<Ch>(Node<Ch>::NODE_CDATA);
         cdata->value(String<Ch>(value, text - value));
+        this->index_node(cdata);
 
         text += 3;  // Skip ]]>
         return cdata;
@@ -424,6 +639,8 @@ class DocumentNode : public Node<Ch> {
         typename Node<Ch>::NODE_TYPE type = classify_node(elementName);
         Node<Ch> *element = new Node<Ch>(type);
         element->name(elementName);
+        // Indexed before its children, so handles follow document order
+        this->index_node(element);
 
         // Skip whitespace between element name and attributes or >
         // skip<whitespace_pred, Flags>(text);
@@ -617,6 +834,8 @@ class DocumentNode : public Node<Ch> {
                                              "'  text: " + std::string(text, 10));
                 String<Ch> att_value;
                 node->add_attribute(att_name, att_value);
+                if (m_index)
+                    m_index->parsed_attribute(att_name, att_value);
                 continue;
             }
             // RAPIDXML_PARSE_ERROR("expected =", text);
@@ -654,6 +873,8 @@ class DocumentNode : public Node<Ch> {
             } else {
                 node->add_attribute(att_name, att_value);
             }
+            if (m_index && !is_class)
+                m_index->parsed_attribute(att_name, att_value);
 
             // Make sure that end quote is present
             if (*text != quote)
@@ -664,6 +885,8 @@ class DocumentNode : public Node<Ch> {
             // Skip whitespace after attribute value
             Text<Ch>::template skip<whitespace_pred<Ch>>(text);
         }
+        if (m_index && !node->id().empty())
+            m_index->parsed_id(node->id());
     }
 
     void parse_classes(Ch *text, size_t length, Node<Ch> *node) {
@@ -677,6 +900,8 @@ class DocumentNode : public Node<Ch> {
                 text = start + length;
             String<Ch> class_value(class_name, text - class_name);
             node->add_class(class_value);
+            if (m_index)
+                m_index->parsed_class(class_value);
             Text<Ch>::template skip<whitespace_pred<Ch>>(text);
         }
     }
@@ -2,122 +2,720 @@
 #define NVPARSE_DOCUMENTINDEX_HPP_INCLUDED
 
 #include <algorithm>
-#include <map>
-#include <set>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include "bitmap.hpp"
 #include "document.hpp"
+#include "flat_document.hpp"
+#include "hash_map.hpp"
 #include "node.hpp"
+#include "pattern_index.hpp"
 #include "string.hpp"
+#include "traverse.hpp"
 
 namespace nvparsehtml {
+//! Responsible for looking up the \ref Node s of a document by id, class,
+//! attribute and element type.
+//! Every \ref Node gets a handle, its position in document order, and every
+//! posting list holds the handles of its \ref Node s in ascending order, so
+//! results come out in document order and merge without sorting.
 template <class Ch>
-class DocumentIndex {
+class DocumentIndex : public ParseObserver<Ch> {
    public:
-    DocumentIndex(DocumentNode<Ch> *doc) : m_doc(doc) {
+    //! Position of a \ref Node in document order
+    typedef uint32_t handle_type;
+    //! Handles of the \ref Node s sharing a key, ascending
+    typedef std::vector<handle_type> posting_list;
+    typedef HashMap<String<Ch>, handle_type> id_map;
+    typedef HashMap<String<Ch>, posting_list> posting_map;
+
+    //! Handles and values of the \ref Node s having an attribute
+    struct attribute_postings {
+        posting_list nodes;
+        std::vector<String<Ch>> values;  //!< value of the attribute on each of nodes
+        uint32_t atom;                   //!< number of the attribute name in this index
+        bool values_indexed;             //!< whether values are keys of the value index
+    };
+    typedef HashMap<String<Ch>, attribute_postings> attribute_map;
+
+    //! Key of the \ref Node s having one value of one attribute
+    struct value_key {
+        uint32_t atom;  //!< \ref attribute_postings::atom of the attribute
+        HashedString<Ch> value;
+
+        bool operator==(const value_key &rhs) const {
+            return atom == rhs.atom && value == rhs.value;
+        }
+    };
+    struct value_key_hash {
+        size_t operator()(const value_key &key) const {
+            return static_cast<size_t>(key.value.hash() ^ hash_integer(key.atom));
+        }
+    };
+    typedef HashMap<value_key, posting_list, value_key_hash> value_map;
+
+    //! Value returned by \ref find_id when an id is not indexed.
+    static constexpr handle_type npos = 0xFFFFFFFF;
+
+    //! Indexes a document, including the values of every attribute.
+    //! \param doc the document.
+    DocumentIndex(DocumentNode<Ch> *doc) : m_doc(doc), m_all_values(true) {
         this->traverse_nodes(m_doc);
     }
+    //! Indexes a document, including the values of some attributes.
+    //! \param doc the document.
+    //! \param value_attributes names of the attributes whose values get constant
+    //! time lookups, other values are found by scanning.
+    DocumentIndex(DocumentNode<Ch> *doc, const std::vector<String<Ch>> &value_attributes)
+        : m_doc(doc), m_all_values(false) {
+        this->value_attributes(value_attributes);
+        this->traverse_nodes(m_doc);
+    }
+    DocumentIndex(const FlatDocument<Ch> &flat) : m_doc(flat.document()), m_all_values(true) {
+        this->sweep_nodes(flat);
+    }
+    DocumentIndex(const FlatDocument<Ch> &flat, const std::vector<String<Ch>> &value_attributes)
+        : m_doc(flat.document()), m_all_values(false) {
+        this->value_attributes(value_attributes);
+        this->sweep_nodes(flat);
+    }
+    //! Indexes a large document on several threads, including the values of
+    //! every attribute. The result is the same as a single threaded index.
+    //! \param doc the document.
+    //! \param threads number of threads, 0 for one per core.
+    DocumentIndex(DocumentNode<Ch> *doc, unsigned threads) : m_doc(doc), m_all_values(true) {
+        this->build_parallel(threads);
+    }
+    //! Indexes a large document on several threads, including the values of
+    //! some attributes.
+    //! \param doc the document.
+    //! \param value_attributes names of the attributes whose values get constant
+    //! time lookups.
+    //! \param threads number of threads, 0 for one per core.
+    DocumentIndex(DocumentNode<Ch> *doc,
+                  const std::vector<String<Ch>> &value_attributes,
+                  unsigned threads)
+        : m_doc(doc), m_all_values(false) {
+        this->value_attributes(value_attributes);
+        this->build_parallel(threads);
+    }
 
-    typename std::map<String<Ch>, Node<Ch> *>::const_iterator ids_begin() {
+    //! Gets the indexed document.
+    //! \return \ref DocumentNode pointer.
+    DocumentNode<Ch> *document() const {
+        return m_doc;
+    }
+    //! Gets number of indexed \ref Node s, one more than the last handle.
+    //! \return number of \ref Node s.
+    size_t size() const {
+        return m_nodes.size();
+    }
+    //! Gets the \ref Node of a handle.
+    //! \param handle handle of the \ref Node.
+    //! \return \ref Node pointer.
+    Node<Ch> *node(handle_type handle) const {
+        return m_nodes[handle];
+    }
+    //! Gets the \ref Node s of handles.
+    //! \param handles handles, usually a posting list.
+    //! \param results vector the \ref Node s are appended to, in the order of handles.
+    void nodes(const posting_list &handles, std::vector<Node<Ch> *> &results) const {
+        results.reserve(results.size() + handles.size());
+        for (handle_type handle : handles)
+            results.push_back(m_nodes[handle]);
+    }
+
+    //! Converts handles to a \ref Bitmap over all handles of this index.
+    //! Dense sets intersect faster as bitmaps than as posting lists.
+    //! \param handles handles, usually a posting list.
+    //! \return \ref Bitmap of \ref size bits.
+    Bitmap bitmap(const posting_list &handles) const {
+        return Bitmap(m_nodes.size(), handles);
+    }
+
+    typename id_map::const_iterator ids_begin() const {
         return m_id_to_node.begin();
     }
-    typename std::map<String<Ch>, Node<Ch> *>::const_iterator ids_end() {
+    typename id_map::const_iterator ids_end() const {
         return m_id_to_node.end();
     }
-    Node<Ch> *get_by_id(String<Ch> id) {
-        if (m_id_to_node.find(id) == m_id_to_node.end())
-            return nullptr;
-        return m_id_to_node[id];
+    //! Finds the handle of the \ref Node with an id.
+    //! \param id \ref String of the id.
+    //! \return handle or \ref npos if not found.
+    handle_type find_id(const String<Ch> &id) const {
+        auto it = m_id_to_node.find(id);
+        if (it == m_id_to_node.end())
+            return npos;
+        return it->second;
+    }
+    Node<Ch> *get_by_id(const String<Ch> &id) const {
+        handle_type handle = this->find_id(id);
+        return handle == npos ? nullptr : m_nodes[handle];
     }
 
-    typename std::map<String<Ch>, std::set<Node<Ch> *>>::const_iterator classes_begin() {
+    typename posting_map::const_iterator classes_begin() const {
         return m_class_to_nodes.begin();
     }
-    typename std::map<String<Ch>, std::set<Node<Ch> *>>::const_iterator classes_end() {
+    typename posting_map::const_iterator classes_end() const {
         return m_class_to_nodes.end();
     }
-    void get_by_class(String<Ch> class_name, std::set<Node<Ch> *> &results) {
-        if (m_class_to_nodes.find(class_name) == m_class_to_nodes.end())
-            return;
-        results.insert(m_class_to_nodes[class_name].begin(), m_class_to_nodes[class_name].end());
+    //! Gets the handles of the \ref Node s with a class.
+    //! \param class_name \ref String of the class name.
+    //! \return posting list, empty if the class is not indexed.
+    const posting_list &class_postings(const String<Ch> &class_name) const {
+        return find_postings(m_class_to_nodes, class_name);
+    }
+    //! Appends the \ref Node s with a class in document order.
+    void get_by_class(const String<Ch> &class_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->class_postings(class_name), results);
     }
-    Node<Ch> *get_by_class(String<Ch> class_name) {
-        if (m_class_to_nodes.find(class_name) == m_class_to_nodes.end())
-            return nullptr;
-        return *(m_class_to_nodes[class_name].begin());
+    //! Merges the handles of the \ref Node s with a class into sorted results.
+    void get_by_class(const String<Ch> &class_name, posting_list &results) const {
+        merge_postings(this->class_postings(class_name), results);
+    }
+    //! Gets the \ref Node s with a class as a \ref Bitmap, built the first
+    //! time it is asked for and kept for the life of the index.
+    //! \param class_name \ref String of the class name.
+    //! \return \ref Bitmap of \ref size bits, empty if the class is not indexed.
+    const Bitmap &class_bitmap(const String<Ch> &class_name) const {
+        return this->cached_bitmap(m_class_to_nodes, m_class_bitmaps, class_name);
+    }
+    //! Gets the first \ref Node in document order with a class, nullptr if none.
+    Node<Ch> *get_by_class(const String<Ch> &class_name) const {
+        return this->first_node(this->class_postings(class_name));
     }
 
-    typename std::map<String<Ch>, std::set<std::pair<Node<Ch> *, String<Ch>>>>::const_iterator
-    attributes_begin() {
+    typename attribute_map::const_iterator attributes_begin() const {
         return m_att_to_nodes.begin();
     }
-    typename std::map<String<Ch>, std::set<std::pair<Node<Ch> *, String<Ch>>>>::const_iterator
-    attributes_end() {
+    typename attribute_map::const_iterator attributes_end() const {
         return m_att_to_nodes.end();
     }
-    void get_by_attribute(String<Ch> att_name,
-                          String<Ch> att_value,
-                          std::set<Node<Ch> *> &results) {
-        if (m_att_to_nodes.find(att_name) == m_att_to_nodes.end())
+    //! Gets the handles of the \ref Node s with an attribute.
+    //! \param att_name \ref String of the attribute name.
+    //! \return posting list, empty if the attribute is not indexed.
+    const posting_list &attribute_postings_of(const String<Ch> &att_name) const {
+        auto it = m_att_to_nodes.find(att_name);
+        if (it == m_att_to_nodes.end())
+            return empty_postings();
+        return it->second.nodes;
+    }
+    //! Are the values of an attribute in the value index?
+    //! \param att_name \ref String of the attribute name.
+    //! \return whether \ref attribute_value_postings can answer for the attribute.
+    bool values_indexed(const String<Ch> &att_name) const {
+        auto it = m_att_to_nodes.find(att_name);
+        return it != m_att_to_nodes.end() && it->second.values_indexed;
+    }
+    //! Gets the handles of the \ref Node s with an attribute value from the
+    //! value index, in constant time.
+    //! \param att_name \ref String of the attribute name.
+    //! \param att_value \ref String of the exact value.
+    //! \return posting list, empty if not found or the values are not indexed.
+    const posting_list &attribute_value_postings(const String<Ch> &att_name,
+                                                 const String<Ch> &att_value) const {
+        auto it = m_att_to_nodes.find(att_name);
+        if (it == m_att_to_nodes.end() || !it->second.values_indexed)
+            return empty_postings();
+        auto value_it = m_value_to_nodes.find(value_key{it->second.atom, att_value});
+        if (value_it == m_value_to_nodes.end())
+            return empty_postings();
+        return value_it->second;
+    }
+    //! Appends the \ref Node s with an attribute value in document order.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          std::vector<Node<Ch> *> &results) const {
+        posting_list matches;
+        this->get_by_attribute(att_name, att_value, matches);
+        this->nodes(matches, results);
+    }
+    //! Merges the handles of the \ref Node s with an attribute value into sorted results.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          posting_list &results) const {
+        auto it = m_att_to_nodes.find(att_name);
+        if (it == m_att_to_nodes.end())
             return;
-        for (const auto pair : m_att_to_nodes[att_name]) {
-            if (pair.second == att_value) {
-                results.insert(pair.first);
-            }
+        const attribute_postings &postings = it->second;
+        if (postings.values_indexed) {
+            merge_postings(this->attribute_value_postings(att_name, att_value), results);
+            return;
+        }
+        posting_list matches;
+        for (size_t i = 0; i < postings.nodes.size(); ++i) {
+            if (postings.values[i] == att_value)
+                matches.push_back(postings.nodes[i]);
         }
+        merge_postings(matches, results);
     }
-    void get_by_attribute(String<Ch> att_name, std::set<Node<Ch> *> &results) {
-        if (m_att_to_nodes.find(att_name) == m_att_to_nodes.end())
+    //! Builds the prefix, suffix, substring and word indexes of the values of
+    //! an attribute, see \ref PatternIndex. Without them pattern lookups scan
+    //! the values.
+    //! \param att_name \ref String of the attribute name.
+    void index_patterns(const String<Ch> &att_name) {
+        auto it = m_att_to_nodes.find(att_name);
+        if (it == m_att_to_nodes.end())
             return;
-        for (const auto pair : m_att_to_nodes[att_name]) {
-            results.insert(pair.first);
-        }
+        m_patterns[it->second.atom].build(it->second.values);
+    }
+    //! Are the values of an attribute in a \ref PatternIndex?
+    //! \param att_name \ref String of the attribute name.
+    //! \return whether \ref index_patterns was called for the attribute.
+    bool patterns_indexed(const String<Ch> &att_name) const {
+        auto it = m_att_to_nodes.find(att_name);
+        return it != m_att_to_nodes.end() && m_patterns.count(it->second.atom) != 0;
+    }
+    //! Merges the handles of the \ref Node s whose attribute value matches a
+    //! pattern into sorted results.
+    //! \param att_name \ref String of the attribute name.
+    //! \param match how the value must match, one of \ref PatternIndex::MATCH.
+    //! \param pattern \ref String of the pattern.
+    //! \param results sorted handles merged into.
+    void get_by_attribute(const String<Ch> &att_name,
+                          typename PatternIndex<Ch>::MATCH match,
+                          const String<Ch> &pattern,
+                          posting_list &results) const {
+        auto it = m_att_to_nodes.find(att_name);
+        if (it == m_att_to_nodes.end())
+            return;
+        const attribute_postings &postings = it->second;
+        posting_list positions;
+        auto pattern_it = m_patterns.find(postings.atom);
+        if (pattern_it != m_patterns.end())
+            pattern_it->second.find(postings.values, match, pattern, positions);
+        else
+            PatternIndex<Ch>::scan(postings.values, match, pattern, positions);
+        // Positions ascend with the handles they hold
+        for (handle_type &position : positions)
+            position = postings.nodes[position];
+        merge_postings(positions, results);
+    }
+    //! Appends the \ref Node s whose attribute value matches a pattern in document order.
+    void get_by_attribute(const String<Ch> &att_name,
+                          typename PatternIndex<Ch>::MATCH match,
+                          const String<Ch> &pattern,
+                          std::vector<Node<Ch> *> &results) const {
+        posting_list matches;
+        this->get_by_attribute(att_name, match, pattern, matches);
+        this->nodes(matches, results);
+    }
+    //! Appends the \ref Node s with an attribute in document order.
+    void get_by_attribute(const String<Ch> &att_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->attribute_postings_of(att_name), results);
+    }
+    //! Merges the handles of the \ref Node s with an attribute into sorted results.
+    void get_by_attribute(const String<Ch> &att_name, posting_list &results) const {
+        merge_postings(this->attribute_postings_of(att_name), results);
     }
 
-    typename std::map<String<Ch>, std::set<Node<Ch> *>>::const_iterator types_begin() {
+    typename posting_map::const_iterator types_begin() const {
         return m_type_to_nodes.begin();
     }
-    typename std::map<String<Ch>, std::set<Node<Ch> *>>::const_iterator types_end() {
+    typename posting_map::const_iterator types_end() const {
         return m_type_to_nodes.end();
     }
-    void get_by_type(String<Ch> type_name, std::set<Node<Ch> *> &results) {
-        if (m_type_to_nodes.find(type_name) == m_type_to_nodes.end())
-            return;
-        results.insert(m_type_to_nodes[type_name].begin(), m_type_to_nodes[type_name].end());
+    //! Gets the handles of the \ref Node s with a name, aka element type.
+    //! \param type_name \ref String of the name.
+    //! \return posting list, empty if the name is not indexed.
+    const posting_list &type_postings(const String<Ch> &type_name) const {
+        return find_postings(m_type_to_nodes, type_name);
+    }
+    //! Appends the \ref Node s with a name in document order.
+    void get_by_type(const String<Ch> &type_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->type_postings(type_name), results);
+    }
+    //! Merges the handles of the \ref Node s with a name into sorted results.
+    void get_by_type(const String<Ch> &type_name, posting_list &results) const {
+        merge_postings(this->type_postings(type_name), results);
+    }
+    //! Gets the \ref Node s with a name as a \ref Bitmap, built the first
+    //! time it is asked for and kept for the life of the index.
+    //! \param type_name \ref String of the name.
+    //! \return \ref Bitmap of \ref size bits, empty if the name is not indexed.
+    const Bitmap &type_bitmap(const String<Ch> &type_name) const {
+        return this->cached_bitmap(m_type_to_nodes, m_type_bitmaps, type_name);
     }
-    Node<Ch> *get_by_type(String<Ch> type_name) {
-        if (m_type_to_nodes.find(type_name) == m_type_to_nodes.end())
-            return nullptr;
-        return *(m_type_to_nodes[type_name].begin());
+    //! Gets the first \ref Node in document order with a name, nullptr if none.
+    Node<Ch> *get_by_type(const String<Ch> &type_name) const {
+        return this->first_node(this->type_postings(type_name));
+    }
+
+    //! Merges sorted handles into sorted results, dropping duplicates.
+    //! \param postings sorted handles to merge, a \ref posting_list or any
+    //! range with begin, end and empty.
+    //! \param results sorted handles merged into.
+    template <class Range>
+    static void merge_postings(const Range &postings, posting_list &results) {
+        if (postings.empty())
+            return;
+        if (results.empty() || results.back() < *postings.begin()) {
+            results.insert(results.end(), postings.begin(), postings.end());
+            return;
+        }
+        posting_list merged;
+        merged.reserve(results.size() + postings.size());
+        std::set_union(results.begin(), results.end(), postings.begin(), postings.end(),
+                       std::back_inserter(merged));
+        results.swap(merged);
     }
 
    private:
+    friend class DocumentNode<Ch>;
+
+    // Selects the constructor that leaves the index empty
+    struct deferred {};
+
+    // Postings of one range of handles, built by one thread
+    struct partial_attribute {
+        posting_list nodes;
+        std::vector<String<Ch>> values;
+        std::vector<HashedString<Ch>> hashed_values;  // if the values are indexed
+        size_t offset;  // of nodes in the merged postings
+    };
+    struct partial_index {
+        posting_map types;
+        posting_map classes;
+        HashMap<String<Ch>, partial_attribute> attributes;
+        std::vector<std::pair<String<Ch>, handle_type>> ids;
+        std::exception_ptr error;
+    };
+
+    // Fewer nodes than this per thread are not worth a thread
+    static constexpr size_t min_parallel_nodes = 16384;
+
     DocumentNode<Ch> *m_doc;
-    std::map<String<Ch>, Node<Ch> *> m_id_to_node;
-    std::map<String<Ch>, std::set<Node<Ch> *>> m_class_to_nodes;
-    std::map<String<Ch>, std::set<std::pair<Node<Ch> *, String<Ch>>>> m_att_to_nodes;
-    std::map<String<Ch>, std::set<Node<Ch> *>> m_type_to_nodes;
+    std::vector<Node<Ch> *> m_nodes;  // by handle
+    id_map m_id_to_node;
+    posting_map m_class_to_nodes;
+    attribute_map m_att_to_nodes;
+    value_map m_value_to_nodes;
+    HashMap<uint32_t, PatternIndex<Ch>> m_patterns;  // by attribute_postings::atom
+    posting_map m_type_to_nodes;
+    bool m_all_values;                            // index the values of every attribute
+    HashMap<String<Ch>, bool> m_value_attributes;  // or only of these
+    std::deque<std::basic_string<Ch>> m_value_attribute_names;  // their keys, in place
+    // Bitmaps of class and type postings, built on first use by const
+    // queries, possibly from several threads. The deque keeps them in place.
+    mutable std::mutex m_bitmaps_mutex;
+    mutable std::deque<Bitmap> m_bitmaps;
+    mutable HashMap<String<Ch>, const Bitmap *> m_class_bitmaps;
+    mutable HashMap<String<Ch>, const Bitmap *> m_type_bitmaps;
 
-    void traverse_nodes(Node<Ch> *node) {
-        if (node == nullptr)
+    static const posting_list &empty_postings() {
+        static const posting_list empty;
+        return empty;
+    }
+    const Bitmap &cached_bitmap(const posting_map &map,
+                                HashMap<String<Ch>, const Bitmap *> &bitmaps,
+                                const String<Ch> &key) const {
+        std::lock_guard<std::mutex> lock(m_bitmaps_mutex);
+        if (m_bitmaps.empty())
+            m_bitmaps.emplace_back(m_nodes.size());  // the empty one, for missing keys
+        auto it = bitmaps.find(key);
+        if (it != bitmaps.end())
+            return *it->second;
+        auto postings = map.find(key);
+        if (postings == map.end())
+            return m_bitmaps.front();
+        m_bitmaps.push_back(this->bitmap(postings->second));
+        // Keyed by the string of the index, the caller's may not last
+        bitmaps[postings->first] = &m_bitmaps.back();
+        return m_bitmaps.back();
+    }
+    static const posting_list &find_postings(const posting_map &map, const String<Ch> &key) {
+        auto it = map.find(key);
+        if (it == map.end())
+            return empty_postings();
+        return it->second;
+    }
+    Node<Ch> *first_node(const posting_list &postings) const {
+        return postings.empty() ? nullptr : m_nodes[postings.front()];
+    }
+
+    DocumentIndex(DocumentNode<Ch> *doc, deferred, const std::vector<String<Ch>> *value_attributes)
+        : m_doc(doc), m_all_values(value_attributes == nullptr) {
+        if (value_attributes != nullptr)
+            this->value_attributes(*value_attributes);
+    }
+    // Creates the index that a parse fills, see DocumentNode::index_on_parse
+    static ParseObserver<Ch> *parse_index(DocumentNode<Ch> *doc,
+                                          const std::vector<String<Ch>> *value_attributes) {
+        return new DocumentIndex(doc, deferred(), value_attributes);
+    }
+    void parsed_node(Node<Ch> *node) override {
+        this->add_node(node);
+    }
+    void parsed_id(const String<Ch> &id) override {
+        this->add_id(id);
+    }
+    void parsed_class(const String<Ch> &class_name) override {
+        this->add_class(class_name);
+    }
+    void parsed_attribute(const String<Ch> &name, const String<Ch> &value) override {
+        this->add_attribute(name, value);
+    }
+
+    void value_attributes(const std::vector<String<Ch>> &names) {
+        for (const String<Ch> &name : names) {
+            // Keyed by a copy, the caller's string may not last
+            m_value_attribute_names.emplace_back(name.data(), name.length());
+            const std::basic_string<Ch> &copy = m_value_attribute_names.back();
+            m_value_attributes[String<Ch>(copy.data(), copy.size())] = true;
+        }
+    }
+    // Finds or creates the postings of an attribute
+    attribute_postings &attribute_entry(const String<Ch> &att_name) {
+        auto inserted =
+            m_att_to_nodes.insert(typename attribute_map::value_type(att_name, attribute_postings()));
+        attribute_postings &postings = inserted.first->second;
+        if (inserted.second) {
+            postings.atom = static_cast<uint32_t>(m_att_to_nodes.size() - 1);
+            postings.values_indexed = m_all_values || m_value_attributes.count(att_name) != 0;
+        }
+        return postings;
+    }
+
+    // Nodes are added in document order, each followed by its id, classes
+    // and attributes
+    handle_type add_node(Node<Ch> *node) {
+        handle_type handle = static_cast<handle_type>(m_nodes.size());
+        m_nodes.push_back(node);
+        m_type_to_nodes[node->name()].push_back(handle);
+        return handle;
+    }
+    void add_id(const String<Ch> &id) {
+        m_id_to_node[id] = this->last_handle();
+    }
+    void add_class(const String<Ch> &class_name) {
+        posting_list &postings = m_class_to_nodes[class_name];
+        if (postings.empty() || postings.back() != this->last_handle())
+            postings.push_back(this->last_handle());
+    }
+    void add_attribute(const String<Ch> &att_name, const String<Ch> &att_value) {
+        attribute_postings &postings = this->attribute_entry(att_name);
+        if (!postings.nodes.empty() && postings.nodes.back() == this->last_handle()) {
+            // A repeated attribute replaces the earlier value, as on the Node
+            if (postings.values_indexed) {
+                value_key key = {postings.atom, postings.values.back()};
+                posting_list &previous = m_value_to_nodes[key];
+                previous.pop_back();
+                if (previous.empty())
+                    m_value_to_nodes.erase(key);
+            }
+            postings.values.back() = att_value;
+        } else {
+            postings.nodes.push_back(this->last_handle());
+            postings.values.push_back(att_value);
+        }
+        if (postings.values_indexed)
+            m_value_to_nodes[value_key{postings.atom, att_value}].push_back(this->last_handle());
+    }
+    handle_type last_handle() const {
+        return static_cast<handle_type>(m_nodes.size() - 1);
+    }
+
+    void traverse_nodes(Node<Ch> *root) {
+        for (Node<Ch> *node : pre_order(root)) {
+            this->add_node(node);
+            if (!node->id().empty()) {
+                this->add_id(node->id());
+            }
+            for (auto class_it = node->class_begin(); class_it != node->class_end(); ++class_it) {
+                this->add_class(*class_it);
+            }
+            for (auto att_it = node->attribute_begin(); att_it != node->attribute_end();
+                 ++att_it) {
+                this->add_attribute(att_it->first, att_it->second);
+            }
+        }
+    }
+
+    void sweep_nodes(const FlatDocument<Ch> &flat) {
+        // Postings are gathered per atom, so each name is hashed once
+        typedef typename FlatDocument<Ch>::index_type index_type;
+        const AtomTable<Ch> &atoms = flat.atoms();
+        std::vector<posting_list> types(atoms.size()), classes(atoms.size());
+        std::vector<attribute_postings> attributes(atoms.size());
+        typename AtomTable<Ch>::atom_type id = atoms.find(String<Ch>("id", 2));
+        m_nodes.reserve(flat.size());
+        for (index_type i = 0; i < flat.size(); ++i) {
+            m_nodes.push_back(flat.node(i));
+            types[flat.name_atom(i)].push_back(i);
+            for (index_type c = flat.class_begin(i); c != flat.class_end(i); ++c) {
+                classes[flat.class_atom(c)].push_back(i);
+            }
+            for (index_type a = flat.attribute_begin(i); a != flat.attribute_end(i); ++a) {
+                typename AtomTable<Ch>::atom_type att_name = flat.attribute_name_atom(a);
+                String<Ch> att_value = flat.attribute_value(a);
+                if (att_name == id && !att_value.empty()) {
+                    m_id_to_node[att_value] = i;
+                }
+                attributes[att_name].nodes.push_back(i);
+                attributes[att_name].values.push_back(att_value);
+            }
+        }
+        for (size_t atom = 0; atom < atoms.size(); ++atom) {
+            const String<Ch> &name = atoms.str(static_cast<typename AtomTable<Ch>::atom_type>(atom));
+            if (!types[atom].empty())
+                m_type_to_nodes[name].swap(types[atom]);
+            if (!classes[atom].empty())
+                m_class_to_nodes[name].swap(classes[atom]);
+            if (!attributes[atom].nodes.empty()) {
+                attribute_postings &postings = this->attribute_entry(name);
+                postings.nodes.swap(attributes[atom].nodes);
+                postings.values.swap(attributes[atom].values);
+                if (!postings.values_indexed)
+                    continue;
+                for (size_t i = 0; i < postings.nodes.size(); ++i) {
+                    value_key key = {postings.atom, postings.values[i]};
+                    m_value_to_nodes[key].push_back(postings.nodes[i]);
+                }
+            }
+        }
+    }
+
+    // Numbers the nodes, splits the handles into one contiguous range per
+    // thread, i.e. a run of whole subtrees, and concatenates the postings of
+    // the ranges in order. Threads share nothing but the read only tree.
+    void build_parallel(unsigned threads) {
+        for (Node<Ch> *node : pre_order(static_cast<Node<Ch> *>(m_doc)))
+            m_nodes.push_back(node);
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t count = std::min<size_t>(threads, m_nodes.size() / min_parallel_nodes);
+        if (count < 2) {
+            m_nodes.clear();
+            this->traverse_nodes(m_doc);
             return;
-        if (!node->id().empty()) {
-            m_id_to_node[node->id()] = node;
         }
-        m_type_to_nodes[node->name()].insert(node);
-        for (auto class_it = node->class_begin(); class_it != node->class_end(); ++class_it) {
-            m_class_to_nodes[*class_it].insert(node);
+        std::vector<partial_index> partials(count);
+        std::vector<std::thread> workers;
+        workers.reserve(count - 1);
+        for (size_t t = 1; t < count; ++t) {
+            workers.emplace_back([this, &partials, t, count]() {
+                this->build_partial(partials[t], m_nodes.size() * t / count,
+                                    m_nodes.size() * (t + 1) / count);
+            });
         }
-        for (auto att_it = node->attribute_begin(); att_it != node->attribute_end(); ++att_it) {
-            String<Ch> att_name = att_it->first;
-            String<Ch> att_value = att_it->second;
-            m_att_to_nodes[att_name].insert(std::make_pair(node, att_value));
+        this->build_partial(partials[0], 0, m_nodes.size() / count);
+        for (std::thread &worker : workers)
+            worker.join();
+        for (partial_index &partial : partials) {
+            if (partial.error)
+                std::rethrow_exception(partial.error);
         }
-        for (auto child_it = node->child_begin(); child_it != node->child_end(); ++child_it) {
-            this->traverse_nodes(*child_it);
+
+        size_t value_count = 0;
+        for (partial_index &partial : partials) {
+            for (auto &entry : partial.types)
+                append_postings(m_type_to_nodes[entry.first], entry.second);
+            for (auto &entry : partial.classes)
+                append_postings(m_class_to_nodes[entry.first], entry.second);
+            for (auto &entry : partial.attributes) {
+                attribute_postings &postings = this->attribute_entry(entry.first);
+                entry.second.offset = postings.nodes.size();
+                append_postings(postings.nodes, entry.second.nodes);
+                append_postings(postings.values, entry.second.values);
+                value_count += entry.second.hashed_values.size();
+            }
+        }
+        // Ids and values have a key per node, their maps fill side by side
+        std::exception_ptr id_error;
+        std::thread id_worker([this, &partials, &id_error]() {
+            try {
+                for (partial_index &partial : partials) {
+                    for (auto &id : partial.ids)
+                        m_id_to_node[id.first] = id.second;
+                }
+            } catch (...) {
+                id_error = std::current_exception();
+            }
+        });
+        try {
+            m_value_to_nodes.reserve(value_count);
+            for (partial_index &partial : partials) {
+                for (auto &entry : partial.attributes) {
+                    const attribute_postings &postings = m_att_to_nodes.find(entry.first)->second;
+                    const partial_attribute &attribute = entry.second;
+                    for (size_t i = 0; i < attribute.hashed_values.size(); ++i) {
+                        value_key key = {postings.atom, attribute.hashed_values[i]};
+                        m_value_to_nodes[key].push_back(postings.nodes[attribute.offset + i]);
+                    }
+                }
+            }
+        } catch (...) {
+            id_worker.join();
+            throw;
+        }
+        id_worker.join();
+        if (id_error)
+            std::rethrow_exception(id_error);
+    }
+    void build_partial(partial_index &partial, size_t first, size_t last) const {
+        try {
+            for (size_t i = first; i < last; ++i) {
+                Node<Ch> *node = m_nodes[i];
+                handle_type handle = static_cast<handle_type>(i);
+                partial.types[node->name()].push_back(handle);
+                if (!node->id().empty())
+                    partial.ids.push_back(std::make_pair(node->id(), handle));
+                for (auto class_it = node->class_begin(); class_it != node->class_end();
+                     ++class_it) {
+                    partial.classes[*class_it].push_back(handle);
+                }
+                for (auto att_it = node->attribute_begin(); att_it != node->attribute_end();
+                     ++att_it) {
+                    auto inserted = partial.attributes.insert(
+                        std::make_pair(att_it->first, partial_attribute()));
+                    partial_attribute &attribute = inserted.first->second;
+                    attribute.nodes.push_back(handle);
+                    attribute.values.push_back(att_it->second);
+                    // Hashing the values is most of the work of the value index
+                    if (m_all_values || m_value_attributes.count(att_it->first) != 0)
+                        attribute.hashed_values.push_back(att_it->second);
+                }
+            }
+        } catch (...) {
+            partial.error = std::current_exception();
         }
     }
+    template <class T>
+    static void append_postings(std::vector<T> &postings, std::vector<T> &more) {
+        if (postings.empty())
+            postings.swap(more);
+        else
+            postings.insert(postings.end(), more.begin(), more.end());
+    }
 };
+
+// Members of DocumentNode that need the whole DocumentIndex
+template <class Ch>
+void DocumentNode<Ch>::index_on_parse(bool enable) {
+    m_index_factory = enable ? &DocumentIndex<Ch>::parse_index : nullptr;
+    m_index_all_values = true;
+    m_index_value_attributes.clear();
+}
+template <class Ch>
+void DocumentNode<Ch>::index_on_parse(const std::vector<String<Ch>> &value_attributes) {
+    m_index_factory = &DocumentIndex<Ch>::parse_index;
+    m_index_all_values = false;
+    m_index_value_attributes.clear();
+    for (const String<Ch> &name : value_attributes)
+        m_index_value_attributes.emplace_back(name.data(), name.length());
+}
+template <class Ch>
+const DocumentIndex<Ch> *DocumentNode<Ch>::index() const {
+    return static_cast<const DocumentIndex<Ch> *>(m_index.get());
+}
 }  // namespace nvparsehtml
 
 #endif
@@ -0,0 +1,596 @@
+#ifndef NVPARSE_FLATDOCUMENT_HPP_INCLUDED
+#define NVPARSE_FLATDOCUMENT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "atom.hpp"
+#include "document.hpp"
+#include "node.hpp"
+#include "string.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+template <typename Ch>
+class FlatNode;
+
+//! Read-only, struct-of-arrays copy of a parsed DOM tree.
+//! Nodes are stored in pre-order, so a subtree is the contiguous range
+//! [i, \ref subtree_end(i)) and a full scan is a linear sweep over each array.
+//! Node links are 32-bit positions and values are 32-bit \ref Span s into the
+//! \ref DocumentNode::source buffer, so the source must be under 4 GB.
+//! Strings that are not in the source, e.g. from \ref DocumentNode::allocate_string,
+//! are copied, so that only the source buffer must outlive the copy.
+//! The copy keeps a pointer to each \ref Node as well, for \ref node and
+//! \ref DocumentIndex; those need the \ref DocumentNode alive too.
+template <typename Ch>
+class FlatDocument {
+   public:
+    typedef uint32_t index_type;
+    typedef typename AtomTable<Ch>::atom_type atom_type;
+
+    //! Index used for the parent of the root node.
+    static constexpr index_type npos = 0xFFFFFFFF;
+
+    //! Flattens a parsed document.
+    //! \param doc the \ref DocumentNode to flatten.
+    FlatDocument(DocumentNode<Ch> &doc) : m_doc(&doc), m_source(doc.source()) {
+        size_t copied = this->copied_length(&doc);
+        if (m_source.length() >= npos || copied >= npos - m_source.length())
+            throw std::runtime_error("source buffer too large for 32-bit spans");
+        // Atoms point into the copies, which must not move
+        m_text.reserve(copied);
+        this->flatten(&doc);
+    }
+    FlatDocument(const FlatDocument &) = delete;
+    FlatDocument &operator=(const FlatDocument &) = delete;
+
+    //! Gets the number of nodes, including the document node itself.
+    //! \return number of nodes.
+    index_type size() const {
+        return static_cast<index_type>(m_types.size());
+    }
+    //! Gets the \ref DocumentNode that was flattened.
+    //! \return pointer to the \ref DocumentNode.
+    DocumentNode<Ch> *document() const {
+        return m_doc;
+    }
+    //! Gets the \ref Node at a pre-order position.
+    //! \param i pre-order position.
+    //! \return pointer to the \ref Node, valid while the \ref DocumentNode is.
+    Node<Ch> *node(index_type i) const {
+        return m_nodes[i];
+    }
+    //! Gets the type of a node.
+    //! \param i pre-order position.
+    //! \return the \ref Node::NODE_TYPE
+    typename Node<Ch>::NODE_TYPE type(index_type i) const {
+        return static_cast<typename Node<Ch>::NODE_TYPE>(m_types[i]);
+    }
+    //! Gets the atom of a node's name.
+    //! \param i pre-order position.
+    //! \return atom of the name in \ref atoms.
+    atom_type name_atom(index_type i) const {
+        return m_names[i];
+    }
+    //! Gets the name of a node.
+    //! \param i pre-order position.
+    //! \return \ref String of the name.
+    const String<Ch> &name(index_type i) const {
+        return m_atoms.str(m_names[i]);
+    }
+    //! Gets the document node as a \ref FlatNode handle.
+    //! \return \ref FlatNode at position 0.
+    FlatNode<Ch> root() const {
+        return FlatNode<Ch>(this, 0);
+    }
+    //! Gets a node as a \ref FlatNode handle.
+    //! \param i pre-order position.
+    //! \return \ref FlatNode at position i.
+    FlatNode<Ch> at(index_type i) const {
+        return FlatNode<Ch>(this, i);
+    }
+    //! Gets the value of a node.
+    //! \param i pre-order position.
+    //! \return \ref String of the value.
+    String<Ch> value(index_type i) const {
+        return this->resolve(m_values[i]);
+    }
+    //! Gets the value of a node as an offset into the source buffer.
+    //! \param i pre-order position.
+    //! \return \ref Span of the value, past the source if the value was copied.
+    Span value_span(index_type i) const {
+        return m_values[i];
+    }
+    //! Gets the parent of a node.
+    //! \param i pre-order position.
+    //! \return pre-order position of the parent, or \ref npos for the document node.
+    index_type parent(index_type i) const {
+        return m_parents[i];
+    }
+    //! Gets one past the last descendant of a node.
+    //! \param i pre-order position.
+    //! \return pre-order position following the subtree of i.
+    index_type subtree_end(index_type i) const {
+        return m_subtree_ends[i];
+    }
+    //! Gets the first attribute of a node.
+    //! \param i pre-order position.
+    //! \return position of the first attribute in the attribute arrays.
+    index_type attribute_begin(index_type i) const {
+        return m_attribute_ranges[i];
+    }
+    //! Gets one past the last attribute of a node.
+    //! \param i pre-order position.
+    //! \return position one past the last attribute in the attribute arrays.
+    index_type attribute_end(index_type i) const {
+        return m_attribute_ranges[i + 1];
+    }
+    //! Gets the atom of an attribute's name.
+    //! \param a position in the attribute arrays.
+    //! \return atom of the attribute name in \ref atoms.
+    atom_type attribute_name_atom(index_type a) const {
+        return m_attribute_names[a];
+    }
+    //! Gets the name of an attribute.
+    //! \param a position in the attribute arrays.
+    //! \return \ref String of the attribute name.
+    const String<Ch> &attribute_name(index_type a) const {
+        return m_atoms.str(m_attribute_names[a]);
+    }
+    //! Gets the value of an attribute.
+    //! \param a position in the attribute arrays.
+    //! \return \ref String of the attribute value.
+    String<Ch> attribute_value(index_type a) const {
+        return this->resolve(m_attribute_values[a]);
+    }
+    //! Finds an attribute of a node by name.
+    //! \param i pre-order position.
+    //! \param name atom of the attribute name.
+    //! \return position in the attribute arrays, or \ref npos if not found.
+    index_type find_attribute(index_type i, atom_type name) const {
+        for (index_type a = m_attribute_ranges[i]; a < m_attribute_ranges[i + 1]; ++a) {
+            if (m_attribute_names[a] == name)
+                return a;
+        }
+        return npos;
+    }
+    //! Gets the first class of a node.
+    //! \param i pre-order position.
+    //! \return position of the first class in the class array.
+    index_type class_begin(index_type i) const {
+        return m_class_ranges[i];
+    }
+    //! Gets one past the last class of a node.
+    //! \param i pre-order position.
+    //! \return position one past the last class in the class array.
+    index_type class_end(index_type i) const {
+        return m_class_ranges[i + 1];
+    }
+    //! Gets the atom of a class.
+    //! \param c position in the class array.
+    //! \return atom of the class name in \ref atoms.
+    atom_type class_atom(index_type c) const {
+        return m_classes[c];
+    }
+    //! Gets the name of a class.
+    //! \param c position in the class array.
+    //! \return \ref String of the class name.
+    const String<Ch> &class_name(index_type c) const {
+        return m_atoms.str(m_classes[c]);
+    }
+    //! Gets the atoms shared by names, attribute names and classes.
+    //! \return the \ref AtomTable.
+    const AtomTable<Ch> &atoms() const {
+        return m_atoms;
+    }
+    //! Gets the buffer that value spans are relative to. Spans past its end
+    //! are of copied strings.
+    //! \return \ref String of the source buffer.
+    const String<Ch> &source() const {
+        return m_source;
+    }
+    //! Converts a span into a \ref String over the source buffer.
+    //! \param span \ref Span to convert.
+    //! \return \ref String of the span.
+    String<Ch> resolve(Span span) const {
+        if (span.length == 0)
+            return String<Ch>();
+        if (span.offset < m_source.length())
+            return String<Ch>(m_source.data() + span.offset, span.length);
+        return String<Ch>(m_text.data() + (span.offset - m_source.length()), span.length);
+    }
+
+   private:
+    DocumentNode<Ch> *m_doc;
+    String<Ch> m_source;
+    AtomTable<Ch> m_atoms;
+    std::vector<Ch> m_text;  // copies of the strings that are not in the source
+
+    // one entry per node, in pre-order
+    std::vector<Node<Ch> *> m_nodes;
+    std::vector<uint8_t> m_types;
+    std::vector<atom_type> m_names;
+    std::vector<index_type> m_parents;
+    std::vector<index_type> m_subtree_ends;
+    std::vector<Span> m_values;
+    // one entry per node plus a final end marker
+    std::vector<index_type> m_attribute_ranges;
+    std::vector<index_type> m_class_ranges;
+
+    // one entry per attribute or class, grouped by node
+    std::vector<atom_type> m_attribute_names;
+    std::vector<Span> m_attribute_values;
+    std::vector<atom_type> m_classes;
+
+    bool in_source(const String<Ch> &s) const {
+        const Ch *begin = m_source.data();
+        return s.empty() ||
+               (s.data() >= begin && s.data() + s.length() <= begin + m_source.length());
+    }
+    // Upper bound of the code units copied by flatten
+    size_t copied_length(Node<Ch> *root) const {
+        size_t length = 0;
+        auto count = [this, &length](const String<Ch> &s) {
+            if (!this->in_source(s))
+                length += s.length();
+        };
+        for (Node<Ch> *node : pre_order(root)) {
+            count(node->name());
+            count(node->value());
+            for (auto it = node->attribute_begin(); it != node->attribute_end(); ++it) {
+                count(it->first);
+                count(it->second);
+            }
+            for (auto it = node->class_begin(); it != node->class_end(); ++it)
+                count(*it);
+        }
+        return length;
+    }
+    Span to_span(const String<Ch> &s) {
+        Span span = {0, 0};
+        if (s.empty())
+            return span;
+        span.length = static_cast<uint32_t>(s.length());
+        if (this->in_source(s)) {
+            span.offset = static_cast<uint32_t>(s.data() - m_source.data());
+            return span;
+        }
+        span.offset = static_cast<uint32_t>(m_source.length() + m_text.size());
+        m_text.insert(m_text.end(), s.data(), s.data() + s.length());
+        return span;
+    }
+    atom_type intern(const String<Ch> &s) {
+        if (this->in_source(s))
+            return m_atoms.intern(s);
+        atom_type atom = m_atoms.find(s);
+        if (atom != AtomTable<Ch>::npos)
+            return atom;
+        return m_atoms.intern(this->resolve(this->to_span(s)));
+    }
+
+    void flatten(Node<Ch> *root) {
+        // Entering a node appends it under the innermost open node; leaving it
+        // closes its subtree and reopens its parent
+        index_type open = npos;
+        for (TreeWalker<Ch> walker(root); !walker.done(); walker.next()) {
+            if (!walker.entering()) {
+                m_subtree_ends[open] = this->size();
+                open = m_parents[open];
+                continue;
+            }
+            Node<Ch> *node = walker.node();
+            index_type i = this->size();
+            m_nodes.push_back(node);
+            m_types.push_back(static_cast<uint8_t>(node->type()));
+            m_names.push_back(this->intern(node->name()));
+            m_parents.push_back(open);
+            m_subtree_ends.push_back(i + 1);
+            m_values.push_back(this->to_span(node->value()));
+            m_attribute_ranges.push_back(static_cast<index_type>(m_attribute_names.size()));
+            m_class_ranges.push_back(static_cast<index_type>(m_classes.size()));
+            for (auto it = node->attribute_begin(); it != node->attribute_end(); ++it) {
+                m_attribute_names.push_back(this->intern(it->first));
+                m_attribute_values.push_back(this->to_span(it->second));
+            }
+            for (auto it = node->class_begin(); it != node->class_end(); ++it) {
+                m_classes.push_back(this->intern(*it));
+            }
+            open = i;
+        }
+        m_attribute_ranges.push_back(static_cast<index_type>(m_attribute_names.size()));
+        m_class_ranges.push_back(static_cast<index_type>(m_classes.size()));
+    }
+};
+
+//! Lightweight handle to a node of a \ref FlatDocument.
+//! Offers the read-only query surface of \ref Node over the flat arrays.
+template <typename Ch>
+class FlatNode {
+   public:
+    typedef typename FlatDocument<Ch>::index_type index_type;
+
+    //! Iterates the children of a \ref FlatNode by jumping over subtrees.
+    class child_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef FlatNode<Ch> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const FlatNode<Ch> *pointer;
+        typedef FlatNode<Ch> reference;
+
+        child_iterator(const FlatDocument<Ch> *doc, index_type i) : m_doc(doc), m_i(i) {
+        }
+        FlatNode<Ch> operator*() const {
+            return FlatNode<Ch>(m_doc, m_i);
+        }
+        child_iterator &operator++() {
+            m_i = m_doc->subtree_end(m_i);
+            return *this;
+        }
+        child_iterator operator++(int) {
+            child_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const child_iterator &rhs) const {
+            return m_i == rhs.m_i;
+        }
+        bool operator!=(const child_iterator &rhs) const {
+            return m_i != rhs.m_i;
+        }
+
+       private:
+        const FlatDocument<Ch> *m_doc;
+        index_type m_i;
+    };
+
+    //! Iterates the classes of a \ref FlatNode, in the order of \ref Node::class_begin.
+    class class_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef String<Ch> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const String<Ch> *pointer;
+        typedef const String<Ch> &reference;
+
+        class_iterator(const FlatDocument<Ch> *doc, index_type c) : m_doc(doc), m_c(c) {
+        }
+        const String<Ch> &operator*() const {
+            return m_doc->class_name(m_c);
+        }
+        const String<Ch> *operator->() const {
+            return &m_doc->class_name(m_c);
+        }
+        class_iterator &operator++() {
+            ++m_c;
+            return *this;
+        }
+        class_iterator operator++(int) {
+            class_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const class_iterator &rhs) const {
+            return m_c == rhs.m_c;
+        }
+        bool operator!=(const class_iterator &rhs) const {
+            return m_c != rhs.m_c;
+        }
+
+       private:
+        const FlatDocument<Ch> *m_doc;
+        index_type m_c;
+    };
+
+    //! Iterates the attributes of a \ref FlatNode as name and value pairs,
+    //! in the order of \ref Node::attribute_begin.
+    class attribute_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<String<Ch>, String<Ch>> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef value_type reference;
+
+        //! Holds the pair that -> points to
+        struct arrow {
+            value_type pair;
+            const value_type *operator->() const {
+                return &pair;
+            }
+        };
+
+        attribute_iterator(const FlatDocument<Ch> *doc, index_type a) : m_doc(doc), m_a(a) {
+        }
+        value_type operator*() const {
+            return value_type(m_doc->attribute_name(m_a), m_doc->attribute_value(m_a));
+        }
+        arrow operator->() const {
+            return arrow{**this};
+        }
+        attribute_iterator &operator++() {
+            ++m_a;
+            return *this;
+        }
+        attribute_iterator operator++(int) {
+            attribute_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const attribute_iterator &rhs) const {
+            return m_a == rhs.m_a;
+        }
+        bool operator!=(const attribute_iterator &rhs) const {
+            return m_a != rhs.m_a;
+        }
+
+       private:
+        const FlatDocument<Ch> *m_doc;
+        index_type m_a;
+    };
+
+    //! Creates a null handle.
+    FlatNode() : m_doc(nullptr), m_i(FlatDocument<Ch>::npos) {
+    }
+    //! Creates a handle to a node.
+    //! \param doc the \ref FlatDocument.
+    //! \param i pre-order position.
+    FlatNode(const FlatDocument<Ch> *doc, index_type i) : m_doc(doc), m_i(i) {
+    }
+    //! Is this a null handle?
+    //! \return whether the handle refers to no node.
+    bool null() const {
+        return m_i == FlatDocument<Ch>::npos;
+    }
+    //! Gets the pre-order position.
+    //! \return pre-order position within the \ref FlatDocument.
+    index_type ref_id() const {
+        return m_i;
+    }
+    //! Gets the \ref Node this handle was flattened from.
+    //! \return pointer to the \ref Node.
+    Node<Ch> *node() const {
+        return m_doc->node(m_i);
+    }
+    //! Gets the type of the node.
+    //! \return the \ref Node::NODE_TYPE
+    typename Node<Ch>::NODE_TYPE type() const {
+        return m_doc->type(m_i);
+    }
+    //! Gets the name, aka element type.
+    //! \return \ref String of the name.
+    const String<Ch> name() const {
+        return m_doc->name(m_i);
+    }
+    //! Gets the value.
+    //! \return \ref String of the value.
+    const String<Ch> value() const {
+        return m_doc->value(m_i);
+    }
+    //! Gets id.
+    //! \return \ref String of the id.
+    const String<Ch> id() const {
+        return this->find_attribute(String<Ch>("id", 2));
+    }
+    //! Determines whether this node contains a class.
+    //! \param class_name \ref String of the class.
+    bool contains_class(const String<Ch> &class_name) const {
+        auto atom = m_doc->atoms().find(class_name);
+        if (atom == AtomTable<Ch>::npos)
+            return false;
+        for (auto c = m_doc->class_begin(m_i); c != m_doc->class_end(m_i); ++c) {
+            if (m_doc->class_atom(c) == atom)
+                return true;
+        }
+        return false;
+    }
+    //! Gets number of classes.
+    //! \return number of classes.
+    size_t classes_size() const {
+        return m_doc->class_end(m_i) - m_doc->class_begin(m_i);
+    }
+    //! Are there any classes?
+    //! \return whether this node has any classes.
+    bool classes_empty() const {
+        return this->classes_size() == 0;
+    }
+    //! The beginning of the classes
+    //! \return iterator to the first class
+    class_iterator class_begin() const {
+        return class_iterator(m_doc, m_doc->class_begin(m_i));
+    }
+    //! The end of the classes
+    //! \return iterator to one past the last class
+    class_iterator class_end() const {
+        return class_iterator(m_doc, m_doc->class_end(m_i));
+    }
+    //! Gets number of attributes.
+    //! \return number of attributes.
+    size_t attributes_size() const {
+        return m_doc->attribute_end(m_i) - m_doc->attribute_begin(m_i);
+    }
+    //! Are there any attributes?
+    //! \return whether this node has any attributes.
+    bool attributes_empty() const {
+        return this->attributes_size() == 0;
+    }
+    //! The beginning of the attributes
+    //! \return iterator to the first attribute
+    attribute_iterator attribute_begin() const {
+        return attribute_iterator(m_doc, m_doc->attribute_begin(m_i));
+    }
+    //! The end of the attributes
+    //! \return iterator to one past the last attribute
+    attribute_iterator attribute_end() const {
+        return attribute_iterator(m_doc, m_doc->attribute_end(m_i));
+    }
+    //! Determines whether this node has an attribute.
+    //! \param name attribute key.
+    bool contains_attribute(const String<Ch> &name) const {
+        auto atom = m_doc->atoms().find(name);
+        if (atom == AtomTable<Ch>::npos)
+            return false;
+        return m_doc->find_attribute(m_i, atom) != FlatDocument<Ch>::npos;
+    }
+    //! Find an attribute's value.
+    //! \param name attribute key.
+    //! \return \ref String of the value, empty if not found.
+    String<Ch> find_attribute(const String<Ch> &name) const {
+        auto atom = m_doc->atoms().find(name);
+        if (atom == AtomTable<Ch>::npos)
+            return String<Ch>();
+        index_type a = m_doc->find_attribute(m_i, atom);
+        if (a == FlatDocument<Ch>::npos)
+            return String<Ch>();
+        return m_doc->attribute_value(a);
+    }
+    //! Gets the parent.
+    //! \return \ref FlatNode of the parent, null for the document node.
+    FlatNode parent() const {
+        return FlatNode(m_doc, m_doc->parent(m_i));
+    }
+    //! The beginning of the child nodes
+    //! \return iterator to the first child node
+    child_iterator child_begin() const {
+        return child_iterator(m_doc, m_i + 1);
+    }
+    //! The end of the child nodes
+    //! \return iterator to one past the last child node
+    child_iterator child_end() const {
+        return child_iterator(m_doc, m_doc->subtree_end(m_i));
+    }
+    //! Are there any children?
+    //! \return whether this node has any children.
+    bool children_empty() const {
+        return m_doc->subtree_end(m_i) == m_i + 1;
+    }
+    //! Gets number of children.
+    //! \return number of children.
+    size_t children_size() const {
+        size_t count = 0;
+        for (auto it = this->child_begin(); it != this->child_end(); ++it)
+            ++count;
+        return count;
+    }
+
+   private:
+    const FlatDocument<Ch> *m_doc;
+    index_type m_i;
+};
+
+template <typename Ch>
+inline bool operator==(const FlatNode<Ch> &lhs, const FlatNode<Ch> &rhs) {
+    return lhs.ref_id() == rhs.ref_id();
+}
+template <typename Ch>
+inline bool operator!=(const FlatNode<Ch> &lhs, const FlatNode<Ch> &rhs) {
+    return !(lhs == rhs);
+}
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef NVPARSE_HASH_HPP_INCLUDED
+#define NVPARSE_HASH_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace nvparsehtml {
+namespace internal {
+// wyhash constants
+const uint64_t hash_secret0 = 0xa0761d6478bd642fULL;
+const uint64_t hash_secret1 = 0xe7037ed1a0b428dbULL;
+const uint64_t hash_secret2 = 0x8ebc6af09c88c6e3ULL;
+
+// Multiply to 128 bits and fold the halves together
+inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a),
+             lb = static_cast<uint32_t>(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+inline uint64_t hash_read64(const unsigned char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t hash_read32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+}  // namespace internal
+
+//! Hashes a byte range with a wyhash-style function.
+//! \param data pointer to the first byte.
+//! \param length number of bytes.
+//! \param seed value mixed into the hash.
+//! \return 64-bit hash.
+inline uint64_t hash_bytes(const void *data, size_t length, uint64_t seed = 0) {
+    using namespace internal;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    seed ^= hash_mix(seed ^ hash_secret0, hash_secret1);
+    uint64_t a = 0, b = 0;
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t shift = (length >> 3) << 2;
+            a = (hash_read32(p) << 32) | hash_read32(p + shift);
+            b = (hash_read32(p + length - 4) << 32) | hash_read32(p + length - 4 - shift);
+        } else if (length > 0) {
+            a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[length >> 1]) << 8) |
+                p[length - 1];
+        }
+    } else {
+        size_t i = length;
+        if (i > 48) {
+            // Three independent lanes keep the multipliers busy on long strings
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = hash_mix(hash_read64(p) ^ hash_secret1, hash_read64(p + 8) ^ seed);
+                seed1 = hash_mix(hash_read64(p + 16) ^ hash_secret2, hash_read64(p + 24) ^ seed1);
+                seed2 = hash_mix(hash_read64(p + 32) ^ hash_secret0, hash_read64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read64(p) ^ hash_secret1, hash_read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    }
+    return hash_mix(hash_secret1 ^ length, hash_mix(a ^ hash_secret1, b ^ seed));
+}
+
+//! Scrambles an integer so that all of its bits affect the high bits.
+//! \param value integer to scramble, e.g. a pointer or a weak hash.
+//! \return scrambled 64-bit value.
+inline uint64_t hash_integer(uint64_t value) {
+    return internal::hash_mix(value ^ internal::hash_secret0, internal::hash_secret1);
+}
+}  // namespace nvparsehtml
+
+#endif
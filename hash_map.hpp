@@ -0,0 +1,255 @@
+#ifndef NVPARSE_HASHMAP_HPP_INCLUDED
+#define NVPARSE_HASHMAP_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+
+namespace nvparsehtml {
+//! Open-addressing hash map with linear probing.
+//! Slots live in one contiguous array next to a byte of control data per slot
+//! holding 7 bits of the hash, so most probes never touch a key that differs.
+//! Iterators are invalidated by any insertion or erasure.
+template <class Key, class Value, class Hash = std::hash<Key>, class Equal = std::equal_to<Key>>
+class HashMap {
+   public:
+    typedef std::pair<Key, Value> value_type;
+
+    template <class Map, class Pair>
+    class basic_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef HashMap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Pair *pointer;
+        typedef Pair &reference;
+
+        basic_iterator(Map *map, size_t slot) : m_map(map), m_slot(slot) {
+            this->skip_empty();
+        }
+        reference operator*() const {
+            return m_map->m_slots[m_slot];
+        }
+        pointer operator->() const {
+            return &m_map->m_slots[m_slot];
+        }
+        basic_iterator &operator++() {
+            ++m_slot;
+            this->skip_empty();
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const basic_iterator &rhs) const {
+            return m_slot == rhs.m_slot;
+        }
+        bool operator!=(const basic_iterator &rhs) const {
+            return m_slot != rhs.m_slot;
+        }
+
+       private:
+        friend class HashMap;
+        Map *m_map;
+        size_t m_slot;
+
+        void skip_empty() {
+            while (m_slot < m_map->m_control.size() && !is_full(m_map->m_control[m_slot]))
+                ++m_slot;
+        }
+    };
+    typedef basic_iterator<HashMap, value_type> iterator;
+    typedef basic_iterator<const HashMap, const value_type> const_iterator;
+
+    HashMap() : m_size(0), m_used(0), m_shift(64) {
+    }
+
+    //! Gets number of entries.
+    //! \return number of entries.
+    size_t size() const {
+        return m_size;
+    }
+    //! Are there any entries?
+    //! \return whether the map is empty.
+    bool empty() const {
+        return m_size == 0;
+    }
+    //! Removes all entries and releases the slots.
+    void clear() {
+        m_slots.clear();
+        m_control.clear();
+        m_size = 0;
+        m_used = 0;
+        m_shift = 64;
+    }
+    //! Makes room for entries without rehashing.
+    //! \param count number of entries to make room for.
+    void reserve(size_t count) {
+        size_t capacity = 8;
+        while (capacity * 7 / 8 < count)
+            capacity *= 2;
+        if (capacity > m_control.size())
+            this->rehash(capacity);
+    }
+
+    iterator begin() {
+        return iterator(this, 0);
+    }
+    iterator end() {
+        return iterator(this, m_control.size());
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, m_control.size());
+    }
+
+    //! Finds an entry.
+    //! \param key key to find.
+    //! \return iterator to the entry, or \ref end if not found.
+    iterator find(const Key &key) {
+        return iterator(this, this->find_slot(key));
+    }
+    //! Finds an entry.
+    //! \param key key to find.
+    //! \return iterator to the entry, or \ref end if not found.
+    const_iterator find(const Key &key) const {
+        return const_iterator(this, this->find_slot(key));
+    }
+    //! Counts entries with a key.
+    //! \param key key to find.
+    //! \return 1 if found, 0 otherwise.
+    size_t count(const Key &key) const {
+        return this->find_slot(key) == m_control.size() ? 0 : 1;
+    }
+    //! Gets the value of a key, inserting a default value if not found.
+    //! \param key key to find or insert.
+    //! \return reference to the value.
+    Value &operator[](const Key &key) {
+        return this->insert(value_type(key, Value())).first->second;
+    }
+    //! Inserts an entry unless its key is already present.
+    //! \param entry key and value to insert.
+    //! \return iterator to the entry with the key, and whether it was inserted.
+    std::pair<iterator, bool> insert(const value_type &entry) {
+        if ((m_used + 1) * 8 > m_control.size() * 7) {
+            // Grow when live entries fill the table, otherwise just drop erased ones
+            size_t capacity = m_control.empty() ? 8 : m_control.size();
+            if ((m_size + 1) * 2 > capacity)
+                capacity *= 2;
+            this->rehash(capacity);
+        }
+        uint64_t h = this->hash(entry.first);
+        uint8_t tag = control_tag(h);
+        size_t mask = m_control.size() - 1;
+        size_t insert_slot = m_control.size();
+        for (size_t slot = h >> m_shift;; slot = (slot + 1) & mask) {
+            uint8_t control = m_control[slot];
+            if (control == control_empty) {
+                if (insert_slot == m_control.size()) {
+                    insert_slot = slot;
+                    ++m_used;
+                }
+                break;
+            }
+            if (control == control_erased) {
+                if (insert_slot == m_control.size())
+                    insert_slot = slot;
+                continue;
+            }
+            if (control == tag && m_equal(m_slots[slot].first, entry.first))
+                return std::make_pair(iterator(this, slot), false);
+        }
+        m_control[insert_slot] = tag;
+        m_slots[insert_slot] = entry;
+        ++m_size;
+        return std::make_pair(iterator(this, insert_slot), true);
+    }
+    //! Removes an entry.
+    //! \param key key of the entry.
+    //! \return number of entries removed.
+    size_t erase(const Key &key) {
+        size_t slot = this->find_slot(key);
+        if (slot == m_control.size())
+            return 0;
+        m_control[slot] = control_erased;
+        m_slots[slot] = value_type();
+        --m_size;
+        return 1;
+    }
+
+   private:
+    static constexpr uint8_t control_empty = 0;
+    static constexpr uint8_t control_erased = 1;
+
+    std::vector<value_type> m_slots;
+    std::vector<uint8_t> m_control;
+    size_t m_size;   // live entries
+    size_t m_used;   // live and erased entries
+    unsigned m_shift;  // 64 - log2(capacity)
+    Hash m_hasher;
+    Equal m_equal;
+
+    static bool is_full(uint8_t control) {
+        return (control & 0x80) != 0;
+    }
+    static uint8_t control_tag(uint64_t h) {
+        return static_cast<uint8_t>(0x80 | ((h >> 32) & 0x7F));
+    }
+    uint64_t hash(const Key &key) const {
+        // Fibonacci scramble so weak hashes (pointers, integers) spread over the
+        // high bits that pick the slot
+        return static_cast<uint64_t>(m_hasher(key)) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    size_t find_slot(const Key &key) const {
+        if (m_size == 0)
+            return m_control.size();
+        uint64_t h = this->hash(key);
+        uint8_t tag = control_tag(h);
+        size_t mask = m_control.size() - 1;
+        for (size_t slot = h >> m_shift;; slot = (slot + 1) & mask) {
+            uint8_t control = m_control[slot];
+            if (control == control_empty)
+                return m_control.size();
+            if (control == tag && m_equal(m_slots[slot].first, key))
+                return slot;
+        }
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<value_type> slots(capacity);
+        std::vector<uint8_t> control(capacity, control_empty);
+        slots.swap(m_slots);
+        control.swap(m_control);
+        m_shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1)
+            --m_shift;
+        m_size = 0;
+        m_used = 0;
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < control.size(); ++i) {
+            if (!is_full(control[i]))
+                continue;
+            uint64_t h = this->hash(slots[i].first);
+            size_t slot = h >> m_shift;
+            while (m_control[slot] != control_empty)
+                slot = (slot + 1) & mask;
+            m_control[slot] = control_tag(h);
+            m_slots[slot] = std::move(slots[i]);
+            ++m_size;
+            ++m_used;
+        }
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef NVPARSE_LAZYDOCUMENTINDEX_HPP_INCLUDED
+#define NVPARSE_LAZYDOCUMENTINDEX_HPP_INCLUDED
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "hash_map.hpp"
+#include "node.hpp"
+#include "string.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+//! Responsible for looking up \ref Node s like \ref DocumentIndex, but only
+//! building the posting list of a key the first time it is asked for.
+//! Keys can be requested ahead of the queries, so that one scan of the
+//! document builds all of them. The first scan also numbers the \ref Node s,
+//! later scans run over that array instead of the tree.
+//! References to posting lists stay valid for the life of the index.
+template <class Ch>
+class LazyDocumentIndex {
+   public:
+    typedef typename DocumentIndex<Ch>::handle_type handle_type;
+    typedef typename DocumentIndex<Ch>::posting_list posting_list;
+    typedef typename DocumentIndex<Ch>::attribute_postings attribute_postings;
+
+    //! Value returned by \ref find_id when no \ref Node has an id.
+    static constexpr handle_type npos = DocumentIndex<Ch>::npos;
+
+    LazyDocumentIndex(DocumentNode<Ch> *doc) : m_doc(doc) {
+    }
+
+    //! Gets the indexed document.
+    //! \return \ref DocumentNode pointer.
+    DocumentNode<Ch> *document() const {
+        return m_doc;
+    }
+    //! Gets number of \ref Node s, one more than the last handle.
+    //! \return number of \ref Node s.
+    size_t size() {
+        this->resolve();
+        return m_nodes.size();
+    }
+    //! Gets the \ref Node of a handle taken from a posting list.
+    //! \param handle handle of the \ref Node.
+    //! \return \ref Node pointer.
+    Node<Ch> *node(handle_type handle) const {
+        return m_nodes[handle];
+    }
+    //! Gets the \ref Node s of handles.
+    //! \param handles handles, usually a posting list.
+    //! \param results vector the \ref Node s are appended to, in the order of handles.
+    void nodes(const posting_list &handles, std::vector<Node<Ch> *> &results) const {
+        results.reserve(results.size() + handles.size());
+        for (handle_type handle : handles)
+            results.push_back(m_nodes[handle]);
+    }
+
+    //! Queues a class for the next scan.
+    //! \param class_name \ref String of the class name.
+    void request_class(const String<Ch> &class_name) {
+        this->request(m_class_slots, m_pending_classes, class_name);
+    }
+    //! Queues a name, aka element type, for the next scan.
+    //! \param type_name \ref String of the name.
+    void request_type(const String<Ch> &type_name) {
+        this->request(m_type_slots, m_pending_types, type_name);
+    }
+    //! Queues an attribute for the next scan.
+    //! \param att_name \ref String of the attribute name.
+    void request_attribute(const String<Ch> &att_name) {
+        if (m_attribute_slots.count(att_name) != 0)
+            return;
+        String<Ch> key = this->add_key(att_name);
+        m_attribute_slots[key] = m_attribute_postings.size();
+        m_attribute_postings.emplace_back();
+        m_pending_attributes.push_back(std::make_pair(key, &m_attribute_postings.back()));
+    }
+    //! Queues an id for the next scan.
+    //! \param id \ref String of the id.
+    void request_id(const String<Ch> &id) {
+        if (m_ids.count(id) != 0)
+            return;
+        String<Ch> key = this->add_key(id);
+        m_ids[key] = npos;
+        m_pending_ids.push_back(key);
+    }
+    //! Builds the posting lists of every queued key in one scan.
+    void resolve() {
+        if (!m_nodes.empty() && m_pending_classes.empty() && m_pending_types.empty() &&
+            m_pending_attributes.empty() && m_pending_ids.empty())
+            return;
+        if (m_nodes.empty()) {
+            for (Node<Ch> *node : pre_order(static_cast<Node<Ch> *>(m_doc))) {
+                m_nodes.push_back(node);
+                this->scan_node(static_cast<handle_type>(m_nodes.size() - 1), node);
+            }
+        } else {
+            for (size_t handle = 0; handle < m_nodes.size(); ++handle)
+                this->scan_node(static_cast<handle_type>(handle), m_nodes[handle]);
+        }
+        m_pending_classes.clear();
+        m_pending_types.clear();
+        m_pending_attributes.clear();
+        m_pending_ids.clear();
+    }
+
+    //! Finds the handle of the \ref Node with an id.
+    //! \param id \ref String of the id.
+    //! \return handle or \ref npos if not found.
+    handle_type find_id(const String<Ch> &id) {
+        this->request_id(id);
+        this->resolve();
+        return m_ids.find(id)->second;
+    }
+    Node<Ch> *get_by_id(const String<Ch> &id) {
+        handle_type handle = this->find_id(id);
+        return handle == npos ? nullptr : m_nodes[handle];
+    }
+
+    //! Gets the handles of the \ref Node s with a class, building them if needed.
+    //! \param class_name \ref String of the class name.
+    //! \return posting list, empty if no \ref Node has the class.
+    const posting_list &class_postings(const String<Ch> &class_name) {
+        this->request_class(class_name);
+        this->resolve();
+        return m_postings[m_class_slots.find(class_name)->second];
+    }
+    //! Appends the \ref Node s with a class in document order.
+    void get_by_class(const String<Ch> &class_name, std::vector<Node<Ch> *> &results) {
+        this->nodes(this->class_postings(class_name), results);
+    }
+    //! Merges the handles of the \ref Node s with a class into sorted results.
+    void get_by_class(const String<Ch> &class_name, posting_list &results) {
+        DocumentIndex<Ch>::merge_postings(this->class_postings(class_name), results);
+    }
+    //! Gets the first \ref Node in document order with a class, nullptr if none.
+    Node<Ch> *get_by_class(const String<Ch> &class_name) {
+        return this->first_node(this->class_postings(class_name));
+    }
+
+    //! Gets the handles of the \ref Node s with a name, building them if needed.
+    //! \param type_name \ref String of the name.
+    //! \return posting list, empty if no \ref Node has the name.
+    const posting_list &type_postings(const String<Ch> &type_name) {
+        this->request_type(type_name);
+        this->resolve();
+        return m_postings[m_type_slots.find(type_name)->second];
+    }
+    //! Appends the \ref Node s with a name in document order.
+    void get_by_type(const String<Ch> &type_name, std::vector<Node<Ch> *> &results) {
+        this->nodes(this->type_postings(type_name), results);
+    }
+    //! Merges the handles of the \ref Node s with a name into sorted results.
+    void get_by_type(const String<Ch> &type_name, posting_list &results) {
+        DocumentIndex<Ch>::merge_postings(this->type_postings(type_name), results);
+    }
+    //! Gets the first \ref Node in document order with a name, nullptr if none.
+    Node<Ch> *get_by_type(const String<Ch> &type_name) {
+        return this->first_node(this->type_postings(type_name));
+    }
+
+    //! Gets the handles and values of the \ref Node s with an attribute,
+    //! building them if needed.
+    //! \param att_name \ref String of the attribute name.
+    //! \return postings, empty if no \ref Node has the attribute.
+    const attribute_postings &attribute_postings_of(const String<Ch> &att_name) {
+        this->request_attribute(att_name);
+        this->resolve();
+        return m_attribute_postings[m_attribute_slots.find(att_name)->second];
+    }
+    //! Appends the \ref Node s with an attribute value in document order.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          std::vector<Node<Ch> *> &results) {
+        const attribute_postings &postings = this->attribute_postings_of(att_name);
+        for (size_t i = 0; i < postings.nodes.size(); ++i) {
+            if (postings.values[i] == att_value)
+                results.push_back(m_nodes[postings.nodes[i]]);
+        }
+    }
+    //! Merges the handles of the \ref Node s with an attribute value into sorted results.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          posting_list &results) {
+        const attribute_postings &postings = this->attribute_postings_of(att_name);
+        posting_list matches;
+        for (size_t i = 0; i < postings.nodes.size(); ++i) {
+            if (postings.values[i] == att_value)
+                matches.push_back(postings.nodes[i]);
+        }
+        DocumentIndex<Ch>::merge_postings(matches, results);
+    }
+    //! Appends the \ref Node s with an attribute in document order.
+    void get_by_attribute(const String<Ch> &att_name, std::vector<Node<Ch> *> &results) {
+        this->nodes(this->attribute_postings_of(att_name).nodes, results);
+    }
+    //! Merges the handles of the \ref Node s with an attribute into sorted results.
+    void get_by_attribute(const String<Ch> &att_name, posting_list &results) {
+        DocumentIndex<Ch>::merge_postings(this->attribute_postings_of(att_name).nodes, results);
+    }
+
+   private:
+    typedef std::vector<std::pair<String<Ch>, posting_list *>> pending_list;
+
+    DocumentNode<Ch> *m_doc;
+    std::vector<Node<Ch> *> m_nodes;  // by handle, filled by the first scan
+    // Keys, built or pending, and where their postings are
+    HashMap<String<Ch>, size_t> m_class_slots;
+    HashMap<String<Ch>, size_t> m_type_slots;
+    HashMap<String<Ch>, size_t> m_attribute_slots;
+    HashMap<String<Ch>, handle_type> m_ids;
+    // A deque keeps the postings in place as keys are added
+    std::deque<posting_list> m_postings;
+    std::deque<attribute_postings> m_attribute_postings;
+    pending_list m_pending_classes;
+    pending_list m_pending_types;
+    std::vector<std::pair<String<Ch>, attribute_postings *>> m_pending_attributes;
+    std::vector<String<Ch>> m_pending_ids;
+    std::deque<std::basic_string<Ch>> m_keys;  // copies of the requested keys, in place
+
+    void request(HashMap<String<Ch>, size_t> &slots,
+                 pending_list &pending,
+                 const String<Ch> &key) {
+        if (slots.count(key) != 0)
+            return;
+        String<Ch> copy = this->add_key(key);
+        slots[copy] = m_postings.size();
+        m_postings.emplace_back();
+        pending.push_back(std::make_pair(copy, &m_postings.back()));
+    }
+    // Copies a key, the caller's string may not last
+    String<Ch> add_key(const String<Ch> &key) {
+        m_keys.emplace_back(key.data(), key.length());
+        return String<Ch>(m_keys.back().data(), m_keys.back().size());
+    }
+
+    Node<Ch> *first_node(const posting_list &postings) const {
+        return postings.empty() ? nullptr : m_nodes[postings.front()];
+    }
+
+    // Tests one node against every pending key
+    void scan_node(handle_type handle, Node<Ch> *node) {
+        for (auto &pending : m_pending_types) {
+            if (node->name() == pending.first)
+                pending.second->push_back(handle);
+        }
+        if (!node->classes_empty()) {
+            for (auto &pending : m_pending_classes) {
+                if (node->contains_class(pending.first))
+                    pending.second->push_back(handle);
+            }
+        }
+        for (auto &pending : m_pending_attributes) {
+            if (node->contains_attribute(pending.first)) {
+                pending.second->nodes.push_back(handle);
+                pending.second->values.push_back(node->find_attribute(pending.first));
+            }
+        }
+        if (!node->id().empty()) {
+            for (const String<Ch> &id : m_pending_ids) {
+                if (node->id() == id)
+                    m_ids[id] = handle;
+            }
+        }
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef NVPARSE_LIVEDOCUMENTINDEX_HPP_INCLUDED
+#define NVPARSE_LIVEDOCUMENTINDEX_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "document.hpp"
+#include "hash_map.hpp"
+#include "node.hpp"
+#include "string.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+//! Responsible for looking up the \ref Node s of a document by id, class,
+//! attribute and element type while the document changes.
+//! The index observes its document, see \ref NodeObserver, and each change
+//! only touches the posting lists of the \ref Node s involved.
+//! Handles are slots that stay with a \ref Node while it is in the tree, so
+//! document order is kept as a separate label per handle: labels leave gaps,
+//! an inserted subtree takes labels from the gap it lands in, and the rare
+//! insert into a full gap relabels the document.
+template <class Ch>
+class LiveDocumentIndex : public NodeObserver<Ch> {
+   public:
+    //! Slot of a \ref Node, not its position in document order
+    typedef uint32_t handle_type;
+    //! Handles of the \ref Node s sharing a key, in document order
+    typedef std::vector<handle_type> posting_list;
+
+    //! Indexes a document and observes it from now on.
+    //! \param doc the document, its observer is replaced.
+    LiveDocumentIndex(DocumentNode<Ch> *doc) : m_doc(doc) {
+        m_doc->observer(this);
+        this->rebuild();
+    }
+    LiveDocumentIndex(const LiveDocumentIndex &) = delete;
+    LiveDocumentIndex &operator=(const LiveDocumentIndex &) = delete;
+    ~LiveDocumentIndex() {
+        if (m_doc != nullptr && m_doc->observer() == this)
+            m_doc->observer(nullptr);
+    }
+
+    //! Gets the indexed document.
+    //! \return \ref DocumentNode pointer, nullptr once the document is destroyed.
+    DocumentNode<Ch> *document() const {
+        return m_doc;
+    }
+    //! Gets number of indexed \ref Node s.
+    //! \return number of \ref Node s in the document tree.
+    size_t size() const {
+        return m_handles.size();
+    }
+    //! Gets the \ref Node of a handle.
+    //! \param handle handle of the \ref Node.
+    //! \return \ref Node pointer.
+    Node<Ch> *node(handle_type handle) const {
+        return m_nodes[handle];
+    }
+    //! Gets the \ref Node s of handles.
+    //! \param handles handles, usually a posting list.
+    //! \param results vector the \ref Node s are appended to, in the order of handles.
+    void nodes(const posting_list &handles, std::vector<Node<Ch> *> &results) const {
+        results.reserve(results.size() + handles.size());
+        for (handle_type handle : handles)
+            results.push_back(m_nodes[handle]);
+    }
+    //! Does one handle come before another in document order?
+    bool precedes(handle_type lhs, handle_type rhs) const {
+        return m_labels[lhs] < m_labels[rhs];
+    }
+    //! Indexes the document again from scratch.
+    void rebuild() {
+        this->reset();
+        if (m_doc == nullptr)
+            return;
+        for (Node<Ch> *node : pre_order(static_cast<Node<Ch> *>(m_doc))) {
+            handle_type handle = this->allocate(node);
+            m_labels[handle] = static_cast<uint64_t>(m_handles.size()) << label_gap_bits;
+            this->add_postings(handle);
+        }
+    }
+
+    //! Gets the first \ref Node in document order with an id, nullptr if none.
+    Node<Ch> *get_by_id(const String<Ch> &id) const {
+        return this->first_node(find_postings(m_ids, id));
+    }
+
+    //! Gets the handles of the \ref Node s with a class.
+    //! \param class_name \ref String of the class name.
+    //! \return posting list, valid until the next change, empty if none.
+    const posting_list &class_postings(const String<Ch> &class_name) const {
+        return find_postings(m_classes, class_name);
+    }
+    //! Appends the \ref Node s with a class in document order.
+    void get_by_class(const String<Ch> &class_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->class_postings(class_name), results);
+    }
+    //! Gets the first \ref Node in document order with a class, nullptr if none.
+    Node<Ch> *get_by_class(const String<Ch> &class_name) const {
+        return this->first_node(this->class_postings(class_name));
+    }
+
+    //! Gets the handles of the \ref Node s with a name, aka element type.
+    //! \param type_name \ref String of the name.
+    //! \return posting list, valid until the next change, empty if none.
+    const posting_list &type_postings(const String<Ch> &type_name) const {
+        return find_postings(m_types, type_name);
+    }
+    //! Appends the \ref Node s with a name in document order.
+    void get_by_type(const String<Ch> &type_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->type_postings(type_name), results);
+    }
+    //! Gets the first \ref Node in document order with a name, nullptr if none.
+    Node<Ch> *get_by_type(const String<Ch> &type_name) const {
+        return this->first_node(this->type_postings(type_name));
+    }
+
+    //! Gets the handles of the \ref Node s with an attribute.
+    //! \param att_name \ref String of the attribute name.
+    //! \return posting list, valid until the next change, empty if none.
+    const posting_list &attribute_postings_of(const String<Ch> &att_name) const {
+        return find_postings(m_attributes, att_name);
+    }
+    //! Appends the \ref Node s with an attribute in document order.
+    void get_by_attribute(const String<Ch> &att_name, std::vector<Node<Ch> *> &results) const {
+        this->nodes(this->attribute_postings_of(att_name), results);
+    }
+    //! Appends the \ref Node s with an attribute value in document order.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          std::vector<Node<Ch> *> &results) const {
+        for (handle_type handle : this->attribute_postings_of(att_name)) {
+            if (m_nodes[handle]->find_attribute(att_name) == att_value)
+                results.push_back(m_nodes[handle]);
+        }
+    }
+
+    void inserted(Node<Ch> *node) override {
+        // Subtrees linked under nodes outside the document wait until they join it
+        if (!this->indexed(node->parent()))
+            return;
+        uint64_t low = m_labels[this->handle(this->preceding(node))];
+        uint64_t high = this->following_label(node);
+        size_t first = m_subtree.size();
+        for (Node<Ch> *n : pre_order(node))
+            m_subtree.push_back(this->allocate(n));
+        size_t count = m_subtree.size() - first;
+        uint64_t step = (high - low) / (count + 1);
+        if (step == 0) {
+            this->relabel();
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                m_labels[m_subtree[first + i]] = low + step * (i + 1);
+        }
+        for (size_t i = first; i < m_subtree.size(); ++i)
+            this->add_postings(m_subtree[i]);
+        m_subtree.resize(first);
+    }
+    void removing(Node<Ch> *node) override {
+        if (!this->indexed(node))
+            return;
+        for (Node<Ch> *n : pre_order(node)) {
+            handle_type handle = this->handle(n);
+            this->remove_postings(handle);
+            m_handles.erase(n);
+            m_nodes[handle] = nullptr;
+            m_free.push_back(handle);
+        }
+    }
+    void name_setting(Node<Ch> *node, const String<Ch> &name) override {
+        if (!this->indexed(node))
+            return;
+        handle_type handle = this->handle(node);
+        this->erase_posting(m_types, node->name(), handle);
+        this->insert_posting(m_types[name], handle);
+    }
+    void id_setting(Node<Ch> *node, const String<Ch> &id) override {
+        if (!this->indexed(node))
+            return;
+        handle_type handle = this->handle(node);
+        if (!node->id().empty())
+            this->erase_posting(m_ids, node->id(), handle);
+        if (!id.empty())
+            this->insert_posting(m_ids[id], handle);
+        // The id is also stored as an attribute
+        this->attribute_setting(node, String<Ch>("id", 2), id);
+    }
+    void class_adding(Node<Ch> *node, const String<Ch> &class_name) override {
+        if (this->indexed(node) && !node->contains_class(class_name))
+            this->insert_posting(m_classes[class_name], this->handle(node));
+    }
+    void class_removing(Node<Ch> *node, const String<Ch> &class_name) override {
+        if (this->indexed(node) && node->contains_class(class_name))
+            this->erase_posting(m_classes, class_name, this->handle(node));
+    }
+    void attribute_setting(Node<Ch> *node,
+                           const String<Ch> &name,
+                           const String<Ch> & /*value*/) override {
+        if (this->indexed(node) && !node->contains_attribute(name))
+            this->insert_posting(m_attributes[name], this->handle(node));
+    }
+    void attribute_removing(Node<Ch> *node, const String<Ch> &name) override {
+        if (this->indexed(node) && node->contains_attribute(name))
+            this->erase_posting(m_attributes, name, this->handle(node));
+    }
+    void clearing() override {
+        // The document itself stays, so that a following parse is indexed
+        this->reset();
+        handle_type handle = this->allocate(m_doc);
+        m_labels[handle] = uint64_t(1) << label_gap_bits;
+        this->add_postings(handle);
+    }
+    void destroying() override {
+        this->reset();
+        m_doc = nullptr;
+    }
+
+   private:
+    typedef HashMap<String<Ch>, posting_list> posting_map;
+
+    // Labels start this far apart
+    static constexpr unsigned label_gap_bits = 20;
+
+    DocumentNode<Ch> *m_doc;
+    std::vector<Node<Ch> *> m_nodes;  // by handle, nullptr for free handles
+    std::vector<uint64_t> m_labels;   // by handle, ascending in document order
+    std::vector<handle_type> m_free;
+    HashMap<const Node<Ch> *, handle_type> m_handles;
+    posting_map m_ids;
+    posting_map m_classes;
+    posting_map m_types;
+    posting_map m_attributes;
+    std::vector<handle_type> m_subtree;  // scratch for inserted
+
+    void reset() {
+        m_nodes.clear();
+        m_labels.clear();
+        m_free.clear();
+        m_handles.clear();
+        m_ids.clear();
+        m_classes.clear();
+        m_types.clear();
+        m_attributes.clear();
+    }
+
+    static const posting_list &find_postings(const posting_map &map, const String<Ch> &key) {
+        static const posting_list empty;
+        auto it = map.find(key);
+        if (it == map.end())
+            return empty;
+        return it->second;
+    }
+    Node<Ch> *first_node(const posting_list &postings) const {
+        return postings.empty() ? nullptr : m_nodes[postings.front()];
+    }
+    bool indexed(const Node<Ch> *node) const {
+        return node != nullptr && m_handles.count(node) != 0;
+    }
+    handle_type handle(const Node<Ch> *node) const {
+        return m_handles.find(node)->second;
+    }
+    handle_type allocate(Node<Ch> *node) {
+        handle_type handle;
+        if (m_free.empty()) {
+            handle = static_cast<handle_type>(m_nodes.size());
+            m_nodes.push_back(node);
+            m_labels.push_back(0);
+        } else {
+            handle = m_free.back();
+            m_free.pop_back();
+            m_nodes[handle] = node;
+        }
+        m_handles[node] = handle;
+        return handle;
+    }
+
+    // Last node before the subtree of node in document order
+    static Node<Ch> *preceding(Node<Ch> *node) {
+        Node<Ch> *previous = node->previous_sibling();
+        if (previous == nullptr)
+            return node->parent();
+        while (previous->last_child() != nullptr)
+            previous = previous->last_child();
+        return previous;
+    }
+    // Label of the first node after the subtree of node in document order
+    uint64_t following_label(Node<Ch> *node) const {
+        for (Node<Ch> *n = node; n != nullptr; n = n->parent()) {
+            if (n->next_sibling() != nullptr)
+                return m_labels[this->handle(n->next_sibling())];
+        }
+        return UINT64_MAX;
+    }
+    void relabel() {
+        uint64_t label = 0;
+        for (Node<Ch> *node : pre_order(static_cast<Node<Ch> *>(m_doc))) {
+            label += uint64_t(1) << label_gap_bits;
+            m_labels[this->handle(node)] = label;
+        }
+    }
+
+    void add_postings(handle_type handle) {
+        Node<Ch> *node = m_nodes[handle];
+        this->insert_posting(m_types[node->name()], handle);
+        if (!node->id().empty())
+            this->insert_posting(m_ids[node->id()], handle);
+        for (auto it = node->class_begin(); it != node->class_end(); ++it)
+            this->insert_posting(m_classes[*it], handle);
+        for (auto it = node->attribute_begin(); it != node->attribute_end(); ++it)
+            this->insert_posting(m_attributes[it->first], handle);
+    }
+    void remove_postings(handle_type handle) {
+        Node<Ch> *node = m_nodes[handle];
+        this->erase_posting(m_types, node->name(), handle);
+        if (!node->id().empty())
+            this->erase_posting(m_ids, node->id(), handle);
+        for (auto it = node->class_begin(); it != node->class_end(); ++it)
+            this->erase_posting(m_classes, *it, handle);
+        for (auto it = node->attribute_begin(); it != node->attribute_end(); ++it)
+            this->erase_posting(m_attributes, it->first, handle);
+    }
+    void insert_posting(posting_list &postings, handle_type handle) {
+        uint64_t label = m_labels[handle];
+        if (postings.empty() || m_labels[postings.back()] < label) {
+            postings.push_back(handle);
+            return;
+        }
+        auto it = std::lower_bound(
+            postings.begin(), postings.end(), label,
+            [this](handle_type h, uint64_t l) { return m_labels[h] < l; });
+        postings.insert(it, handle);
+    }
+    void erase_posting(posting_map &map, const String<Ch> &key, handle_type handle) {
+        auto map_it = map.find(key);
+        if (map_it == map.end())
+            return;
+        posting_list &postings = map_it->second;
+        uint64_t label = m_labels[handle];
+        auto it = std::lower_bound(
+            postings.begin(), postings.end(), label,
+            [this](handle_type h, uint64_t l) { return m_labels[h] < l; });
+        if (it != postings.end() && *it == handle)
+            postings.erase(it);
+        if (postings.empty())
+            map.erase(key);
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
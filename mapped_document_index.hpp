@@ -0,0 +1,638 @@
+#ifndef NVPARSE_MAPPEDDOCUMENTINDEX_HPP_INCLUDED
+#define NVPARSE_MAPPEDDOCUMENTINDEX_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "hash_map.hpp"
+#include "node.hpp"
+#include "string.hpp"
+
+namespace nvparsehtml {
+//! Responsible for mapping a file read only into memory.
+//! Pages are read when first touched, so opening a large file is cheap.
+class MappedFile {
+   public:
+    //! Maps a file.
+    //! \param filename Filename to map.
+    MappedFile(const char *filename) : m_data(nullptr), m_size(0) {
+#if defined(_WIN32)
+        m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+        m_mapping = nullptr;
+        if (m_file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error(std::string("cannot open file ") + filename);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size)) {
+            CloseHandle(m_file);
+            throw std::runtime_error(std::string("cannot read size of file ") + filename);
+        }
+        m_size = static_cast<size_t>(size.QuadPart);
+        if (m_size == 0)
+            return;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping != nullptr)
+            m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_data == nullptr) {
+            if (m_mapping != nullptr)
+                CloseHandle(m_mapping);
+            CloseHandle(m_file);
+            throw std::runtime_error(std::string("cannot map file ") + filename);
+        }
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::string("cannot open file ") + filename);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error(std::string("cannot read size of file ") + filename);
+        }
+        m_size = static_cast<size_t>(info.st_size);
+        if (m_size != 0) {
+            m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (m_data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error(std::string("cannot map file ") + filename);
+            }
+        }
+        // The mapping keeps the file open
+        ::close(fd);
+#endif
+    }
+    //! Maps a file.
+    //! \param filename Filename to map as std::string.
+    MappedFile(const std::string &filename) : MappedFile(filename.c_str()) {
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        CloseHandle(m_file);
+#else
+        if (m_data != nullptr)
+            ::munmap(m_data, m_size);
+#endif
+    }
+
+    //! Gets file data.
+    //! \return Pointer to the first byte, nullptr for an empty file.
+    const void *data() const {
+        return m_data;
+    }
+    //! Gets file size.
+    //! \return Size of file data, in bytes.
+    size_t size() const {
+        return m_size;
+    }
+
+   private:
+    void *m_data;
+    size_t m_size;
+#if defined(_WIN32)
+    HANDLE m_file;
+    HANDLE m_mapping;
+#endif
+};
+
+//! Responsible for answering \ref DocumentIndex queries straight from a
+//! serialized index, e.g. a \ref MappedFile, without building anything.
+//! \ref write stores the index with the source the document was parsed
+//! from, when it kept it, see \ref DocumentNode::keep_original_source; keys
+//! are kept in sorted tables and found by binary search, and posting lists
+//! are arrays of the same handles as the \ref DocumentIndex. Parsing that
+//! source again numbers the \ref Node s the same way, as long as the
+//! document was not changed before it was indexed.
+//! The data must outlive this object and be aligned to 8 bytes. It is
+//! checked when opened, so that no lookup reads outside of it.
+template <class Ch>
+class MappedDocumentIndex {
+   public:
+    typedef typename DocumentIndex<Ch>::handle_type handle_type;
+    typedef typename DocumentIndex<Ch>::posting_list posting_list;
+
+    //! Handles of the \ref Node s sharing a key, ascending, within the data
+    class posting_range {
+       public:
+        posting_range() : m_begin(nullptr), m_end(nullptr) {
+        }
+        posting_range(const handle_type *begin, const handle_type *end)
+            : m_begin(begin), m_end(end) {
+        }
+        const handle_type *begin() const {
+            return m_begin;
+        }
+        const handle_type *end() const {
+            return m_end;
+        }
+        size_t size() const {
+            return static_cast<size_t>(m_end - m_begin);
+        }
+        bool empty() const {
+            return m_begin == m_end;
+        }
+        handle_type operator[](size_t i) const {
+            return m_begin[i];
+        }
+
+       private:
+        const handle_type *m_begin;
+        const handle_type *m_end;
+    };
+
+    //! Value returned by \ref find_id when no \ref Node has an id.
+    static constexpr handle_type npos = DocumentIndex<Ch>::npos;
+    //! Format version, written to and checked against the header
+    static constexpr uint32_t version = 1;
+
+    //! Opens a serialized index.
+    //! \param data the bytes written by \ref write.
+    //! \param size number of bytes.
+    MappedDocumentIndex(const void *data, size_t size)
+        : m_data(static_cast<const unsigned char *>(data)), m_size(size) {
+        if (m_size < sizeof(header))
+            throw std::runtime_error("index is truncated");
+        if (reinterpret_cast<uintptr_t>(data) % alignof(header) != 0)
+            throw std::runtime_error("index is not aligned");
+        m_header = reinterpret_cast<const header *>(m_data);
+        if (std::memcmp(m_header->magic, "NVIX", 4) != 0)
+            throw std::runtime_error("not an index");
+        if (m_header->byte_order != 0x01020304)
+            throw std::runtime_error("index was written with another byte order");
+        if (m_header->version != version)
+            throw std::runtime_error("index has an unsupported version");
+        if (m_header->char_size != sizeof(Ch))
+            throw std::runtime_error("index has another character type");
+        m_locations = this->section<Span>(SECTION_LOCATIONS);
+        m_ids = this->section<id_entry>(SECTION_IDS);
+        m_classes = this->section<key_entry>(SECTION_CLASSES);
+        m_types = this->section<key_entry>(SECTION_TYPES);
+        m_attributes = this->section<attribute_entry>(SECTION_ATTRIBUTES);
+        m_values = this->section<Span>(SECTION_VALUES);
+        m_value_keys = this->section<key_entry>(SECTION_VALUE_KEYS);
+        m_postings = this->section<handle_type>(SECTION_POSTINGS);
+        m_text = this->section<Ch>(SECTION_TEXT);
+        if (m_header->sections[SECTION_LOCATIONS].count != m_header->node_count ||
+            m_header->sections[SECTION_TEXT].count < m_header->source_length)
+            throw std::runtime_error("index is corrupt");
+        this->check();
+    }
+    //! Opens a serialized index.
+    //! \param file the mapped file written by \ref write.
+    MappedDocumentIndex(const MappedFile &file) : MappedDocumentIndex(file.data(), file.size()) {
+    }
+
+    //! Serializes an index with the original source of its document, if kept.
+    //! \param index the index.
+    //! \param out binary stream to write to.
+    static void write(const DocumentIndex<Ch> &index, std::ostream &out) {
+        writer(index).write(out);
+    }
+    //! Serializes an index with the original source of its document, if kept.
+    //! \param index the index.
+    //! \param filename Filename to write to.
+    static void write(const DocumentIndex<Ch> &index, const char *filename) {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out)
+            throw std::runtime_error(std::string("cannot open file ") + filename);
+        write(index, out);
+        out.close();
+        if (!out)
+            throw std::runtime_error(std::string("cannot write file ") + filename);
+    }
+
+    //! Gets number of indexed \ref Node s, one more than the last handle.
+    //! \return number of \ref Node s.
+    size_t size() const {
+        return m_header->node_count;
+    }
+    //! Gets the text the document was parsed from, as it was before parsing.
+    //! \return \ref String of the source, empty if the document did not keep it.
+    String<Ch> source() const {
+        return this->text(Span{0, m_header->source_length});
+    }
+    //! Gets where a \ref Node is in the source: the span of its name, or of
+    //! its value if it has no name.
+    //! \param handle handle of the \ref Node.
+    //! \return \ref Span relative to the text the document was parsed from,
+    //! empty if the \ref Node is not in it.
+    Span location(handle_type handle) const {
+        return m_locations[handle];
+    }
+
+    //! Finds the handle of the \ref Node with an id.
+    //! \param id \ref String of the id.
+    //! \return handle or \ref npos if not found.
+    handle_type find_id(const String<Ch> &id) const {
+        const id_entry *entry = this->find_key(m_ids, m_header->sections[SECTION_IDS].count, id);
+        return entry == nullptr ? npos : entry->handle;
+    }
+
+    //! Gets the handles of the \ref Node s with a class.
+    //! \param class_name \ref String of the class name.
+    //! \return posting range, empty if no \ref Node has the class.
+    posting_range class_postings(const String<Ch> &class_name) const {
+        return this->key_postings(m_classes, m_header->sections[SECTION_CLASSES].count,
+                                  class_name);
+    }
+    //! Merges the handles of the \ref Node s with a class into sorted results.
+    void get_by_class(const String<Ch> &class_name, posting_list &results) const {
+        DocumentIndex<Ch>::merge_postings(this->class_postings(class_name), results);
+    }
+
+    //! Gets the handles of the \ref Node s with a name, aka element type.
+    //! \param type_name \ref String of the name.
+    //! \return posting range, empty if no \ref Node has the name.
+    posting_range type_postings(const String<Ch> &type_name) const {
+        return this->key_postings(m_types, m_header->sections[SECTION_TYPES].count, type_name);
+    }
+    //! Merges the handles of the \ref Node s with a name into sorted results.
+    void get_by_type(const String<Ch> &type_name, posting_list &results) const {
+        DocumentIndex<Ch>::merge_postings(this->type_postings(type_name), results);
+    }
+
+    //! Gets the handles of the \ref Node s with an attribute.
+    //! \param att_name \ref String of the attribute name.
+    //! \return posting range, empty if no \ref Node has the attribute.
+    posting_range attribute_postings_of(const String<Ch> &att_name) const {
+        const attribute_entry *entry = this->find_attribute(att_name);
+        if (entry == nullptr)
+            return posting_range();
+        return this->postings(entry->first, entry->count);
+    }
+    //! Merges the handles of the \ref Node s with an attribute into sorted results.
+    void get_by_attribute(const String<Ch> &att_name, posting_list &results) const {
+        DocumentIndex<Ch>::merge_postings(this->attribute_postings_of(att_name), results);
+    }
+    //! Merges the handles of the \ref Node s with an attribute value into sorted results.
+    //! Values of attributes the \ref DocumentIndex did not index are scanned.
+    void get_by_attribute(const String<Ch> &att_name,
+                          const String<Ch> &att_value,
+                          posting_list &results) const {
+        const attribute_entry *entry = this->find_attribute(att_name);
+        if (entry == nullptr)
+            return;
+        if (entry->values_indexed) {
+            posting_range postings = this->key_postings(
+                m_value_keys + entry->value_key_first, entry->value_key_count, att_value);
+            DocumentIndex<Ch>::merge_postings(postings, results);
+            return;
+        }
+        posting_list matches;
+        for (uint32_t i = 0; i < entry->count; ++i) {
+            if (this->text(m_values[entry->value_first + i]) == att_value)
+                matches.push_back(m_postings[entry->first + i]);
+        }
+        DocumentIndex<Ch>::merge_postings(matches, results);
+    }
+
+   private:
+    enum SECTION {
+        SECTION_LOCATIONS,   // Span per node
+        SECTION_IDS,         // id_entry per id, sorted
+        SECTION_CLASSES,     // key_entry per class, sorted
+        SECTION_TYPES,       // key_entry per name, sorted
+        SECTION_ATTRIBUTES,  // attribute_entry per attribute name, sorted
+        SECTION_VALUES,      // Span per attribute posting
+        SECTION_VALUE_KEYS,  // key_entry per value, sorted within each attribute
+        SECTION_POSTINGS,    // handles
+        SECTION_TEXT,        // the source, then strings that are not in it
+        SECTION_COUNT
+    };
+    struct section_entry {
+        uint64_t offset;  // in bytes from the start of the data
+        uint64_t count;   // of elements
+    };
+    struct header {
+        char magic[4];
+        uint32_t byte_order;
+        uint32_t version;
+        uint32_t char_size;
+        uint32_t node_count;
+        uint32_t source_length;
+        section_entry sections[SECTION_COUNT];
+    };
+    struct id_entry {
+        Span key;
+        handle_type handle;
+    };
+    struct key_entry {
+        Span key;
+        uint32_t first;  // in SECTION_POSTINGS
+        uint32_t count;
+    };
+    struct attribute_entry {
+        Span key;
+        uint32_t first;  // in SECTION_POSTINGS
+        uint32_t count;
+        uint32_t value_first;  // in SECTION_VALUES
+        uint32_t value_key_first;  // in SECTION_VALUE_KEYS
+        uint32_t value_key_count;
+        uint32_t values_indexed;
+    };
+
+    const unsigned char *m_data;
+    size_t m_size;
+    const header *m_header;
+    const Span *m_locations;
+    const id_entry *m_ids;
+    const key_entry *m_classes;
+    const key_entry *m_types;
+    const attribute_entry *m_attributes;
+    const Span *m_values;
+    const key_entry *m_value_keys;
+    const handle_type *m_postings;
+    const Ch *m_text;
+
+    // Throws unless every offset read by a lookup lies within its section
+    void check() const {
+        const section_entry *sections = m_header->sections;
+        if (m_header->source_length != 0) {
+            for (uint64_t i = 0; i < sections[SECTION_LOCATIONS].count; ++i)
+                this->check_text(m_locations[i]);
+        }
+        for (uint64_t i = 0; i < sections[SECTION_IDS].count; ++i) {
+            this->check_text(m_ids[i].key);
+            if (m_ids[i].handle >= m_header->node_count)
+                throw std::runtime_error("index is corrupt");
+        }
+        this->check_keys(m_classes, sections[SECTION_CLASSES].count);
+        this->check_keys(m_types, sections[SECTION_TYPES].count);
+        this->check_keys(m_value_keys, sections[SECTION_VALUE_KEYS].count);
+        for (uint64_t i = 0; i < sections[SECTION_ATTRIBUTES].count; ++i) {
+            const attribute_entry &entry = m_attributes[i];
+            this->check_text(entry.key);
+            this->check_range(SECTION_POSTINGS, entry.first, entry.count);
+            this->check_range(SECTION_VALUES, entry.value_first, entry.count);
+            this->check_range(SECTION_VALUE_KEYS, entry.value_key_first, entry.value_key_count);
+        }
+        for (uint64_t i = 0; i < sections[SECTION_VALUES].count; ++i)
+            this->check_text(m_values[i]);
+    }
+    void check_keys(const key_entry *entries, uint64_t count) const {
+        for (uint64_t i = 0; i < count; ++i) {
+            this->check_text(entries[i].key);
+            this->check_range(SECTION_POSTINGS, entries[i].first, entries[i].count);
+        }
+    }
+    void check_text(Span span) const {
+        this->check_range(SECTION_TEXT, span.offset, span.length);
+    }
+    void check_range(SECTION id, uint64_t first, uint64_t count) const {
+        uint64_t size = m_header->sections[id].count;
+        if (first > size || count > size - first)
+            throw std::runtime_error("index is corrupt");
+    }
+    template <class T>
+    const T *section(SECTION id) const {
+        const section_entry &entry = m_header->sections[id];
+        if (entry.offset % alignof(T) != 0 || entry.offset > m_size ||
+            entry.count > (m_size - entry.offset) / sizeof(T))
+            throw std::runtime_error("index is corrupt");
+        return reinterpret_cast<const T *>(m_data + entry.offset);
+    }
+    String<Ch> text(Span span) const {
+        return String<Ch>(m_text + span.offset, span.length);
+    }
+    posting_range postings(uint32_t first, uint32_t count) const {
+        return posting_range(m_postings + first, m_postings + first + count);
+    }
+    template <class Entry>
+    const Entry *find_key(const Entry *entries, size_t count, const String<Ch> &key) const {
+        const Entry *it = std::lower_bound(entries, entries + count, key,
+                                           [this](const Entry &entry, const String<Ch> &key) {
+                                               return this->text(entry.key) < key;
+                                           });
+        if (it == entries + count || !(this->text(it->key) == key))
+            return nullptr;
+        return it;
+    }
+    posting_range key_postings(const key_entry *entries,
+                               size_t count,
+                               const String<Ch> &key) const {
+        const key_entry *entry = this->find_key(entries, count, key);
+        if (entry == nullptr)
+            return posting_range();
+        return this->postings(entry->first, entry->count);
+    }
+    const attribute_entry *find_attribute(const String<Ch> &att_name) const {
+        return this->find_key(m_attributes, m_header->sections[SECTION_ATTRIBUTES].count,
+                              att_name);
+    }
+
+    // Lays out the sections of an index in memory, then writes them
+    class writer {
+       public:
+        writer(const DocumentIndex<Ch> &index) : m_index(index) {
+            m_source = index.document()->source();
+            m_original = index.document()->original_source();
+            if (m_source.length() > 0xFFFFFFFF || index.size() > 0xFFFFFFFF)
+                throw std::runtime_error("document is too large to serialize");
+            // Parsing changed the source in place; only its original is worth storing
+            if (m_original.length() != m_source.length())
+                m_original = String<Ch>();
+            m_text.assign(m_original.data(), m_original.data() + m_original.length());
+            this->build();
+        }
+
+        void write(std::ostream &out) const {
+            header head;
+            std::memset(&head, 0, sizeof(head));
+            std::memcpy(head.magic, "NVIX", 4);
+            head.byte_order = 0x01020304;
+            head.version = version;
+            head.char_size = sizeof(Ch);
+            head.node_count = static_cast<uint32_t>(m_locations.size());
+            head.source_length = static_cast<uint32_t>(m_original.length());
+            uint64_t offset = sizeof(header);
+            place(head, SECTION_LOCATIONS, m_locations, offset);
+            place(head, SECTION_IDS, m_ids, offset);
+            place(head, SECTION_CLASSES, m_classes, offset);
+            place(head, SECTION_TYPES, m_types, offset);
+            place(head, SECTION_ATTRIBUTES, m_attributes, offset);
+            place(head, SECTION_VALUES, m_values, offset);
+            place(head, SECTION_VALUE_KEYS, m_value_keys, offset);
+            place(head, SECTION_POSTINGS, m_postings, offset);
+            place(head, SECTION_TEXT, m_text, offset);
+            out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+            uint64_t written = sizeof(header);
+            emit(out, head, SECTION_LOCATIONS, m_locations, written);
+            emit(out, head, SECTION_IDS, m_ids, written);
+            emit(out, head, SECTION_CLASSES, m_classes, written);
+            emit(out, head, SECTION_TYPES, m_types, written);
+            emit(out, head, SECTION_ATTRIBUTES, m_attributes, written);
+            emit(out, head, SECTION_VALUES, m_values, written);
+            emit(out, head, SECTION_VALUE_KEYS, m_value_keys, written);
+            emit(out, head, SECTION_POSTINGS, m_postings, written);
+            emit(out, head, SECTION_TEXT, m_text, written);
+            if (!out)
+                throw std::runtime_error("error writing index");
+        }
+
+       private:
+        const DocumentIndex<Ch> &m_index;
+        String<Ch> m_source;    // as parsed, which strings point into
+        String<Ch> m_original;  // as it was before parsing, empty if not kept
+        HashMap<String<Ch>, Span> m_pooled;  // strings copied after the source
+        std::vector<Span> m_locations;
+        std::vector<id_entry> m_ids;
+        std::vector<key_entry> m_classes;
+        std::vector<key_entry> m_types;
+        std::vector<attribute_entry> m_attributes;
+        std::vector<Span> m_values;
+        std::vector<key_entry> m_value_keys;
+        std::vector<handle_type> m_postings;
+        std::vector<Ch> m_text;
+
+        void build() {
+            m_locations.reserve(m_index.size());
+            for (size_t handle = 0; handle < m_index.size(); ++handle) {
+                Node<Ch> *node = m_index.node(static_cast<handle_type>(handle));
+                Span location = this->in_source(node->name());
+                if (location.length == 0)
+                    location = this->in_source(node->value());
+                m_locations.push_back(location);
+            }
+            for (auto it = m_index.ids_begin(); it != m_index.ids_end(); ++it)
+                m_ids.push_back(id_entry{this->span(it->first), it->second});
+            this->sort_keys(m_ids);
+            for (auto it = m_index.classes_begin(); it != m_index.classes_end(); ++it)
+                m_classes.push_back(this->add_postings(it->first, it->second));
+            this->sort_keys(m_classes);
+            for (auto it = m_index.types_begin(); it != m_index.types_end(); ++it)
+                m_types.push_back(this->add_postings(it->first, it->second));
+            this->sort_keys(m_types);
+            for (auto it = m_index.attributes_begin(); it != m_index.attributes_end(); ++it)
+                this->add_attribute(it->first, it->second);
+            this->sort_keys(m_attributes);
+        }
+
+        // Span of a string within the source, empty if it is elsewhere
+        Span in_source(const String<Ch> &s) const {
+            Span span = {0, 0};
+            const Ch *begin = m_source.data();
+            if (!s.empty() && s.data() >= begin &&
+                s.data() + s.length() <= begin + m_source.length()) {
+                span.offset = static_cast<uint32_t>(s.data() - begin);
+                span.length = static_cast<uint32_t>(s.length());
+            }
+            return span;
+        }
+        // Span of a string within the text, copying it there if needed
+        Span span(const String<Ch> &s) {
+            Span span = this->in_source(s);
+            if (s.empty())
+                return span;
+            // Strings changed by parsing, e.g. by expanding entities, are copied
+            if (span.length != 0 && size_t(span.offset) + span.length <= m_original.length() &&
+                std::equal(s.data(), s.data() + s.length(), m_original.data() + span.offset))
+                return span;
+            auto it = m_pooled.find(s);
+            if (it != m_pooled.end())
+                return it->second;
+            if (m_text.size() + s.length() > 0xFFFFFFFF)
+                throw std::runtime_error("document is too large to serialize");
+            span.offset = static_cast<uint32_t>(m_text.size());
+            span.length = static_cast<uint32_t>(s.length());
+            m_text.insert(m_text.end(), s.data(), s.data() + s.length());
+            // Keyed by the caller's string, m_text moves as it grows
+            m_pooled[s] = span;
+            return span;
+        }
+
+        key_entry add_postings(const String<Ch> &key, const posting_list &postings) {
+            key_entry entry = {this->span(key), static_cast<uint32_t>(m_postings.size()),
+                               static_cast<uint32_t>(postings.size())};
+            m_postings.insert(m_postings.end(), postings.begin(), postings.end());
+            return entry;
+        }
+        void add_attribute(const String<Ch> &att_name,
+                           const typename DocumentIndex<Ch>::attribute_postings &postings) {
+            attribute_entry entry;
+            entry.key = this->span(att_name);
+            entry.first = static_cast<uint32_t>(m_postings.size());
+            entry.count = static_cast<uint32_t>(postings.nodes.size());
+            entry.value_first = static_cast<uint32_t>(m_values.size());
+            entry.value_key_first = static_cast<uint32_t>(m_value_keys.size());
+            entry.value_key_count = 0;
+            entry.values_indexed = postings.values_indexed ? 1 : 0;
+            m_postings.insert(m_postings.end(), postings.nodes.begin(), postings.nodes.end());
+            for (const String<Ch> &value : postings.values)
+                m_values.push_back(this->span(value));
+            if (postings.values_indexed) {
+                // Positions grouped by value, each group in document order
+                std::vector<uint32_t> order(postings.values.size());
+                for (size_t i = 0; i < order.size(); ++i)
+                    order[i] = static_cast<uint32_t>(i);
+                std::stable_sort(order.begin(), order.end(),
+                                 [&postings](uint32_t lhs, uint32_t rhs) {
+                                     return postings.values[lhs] < postings.values[rhs];
+                                 });
+                for (size_t i = 0; i < order.size(); ++i) {
+                    const String<Ch> &value = postings.values[order[i]];
+                    if (i == 0 || !(postings.values[order[i - 1]] == value)) {
+                        m_value_keys.push_back(key_entry{m_values[entry.value_first + order[i]],
+                                                         static_cast<uint32_t>(m_postings.size()),
+                                                         0});
+                        ++entry.value_key_count;
+                    }
+                    m_postings.push_back(postings.nodes[order[i]]);
+                    ++m_value_keys.back().count;
+                }
+            }
+            m_attributes.push_back(entry);
+        }
+        template <class Entry>
+        void sort_keys(std::vector<Entry> &entries) const {
+            std::sort(entries.begin(), entries.end(), [this](const Entry &lhs, const Entry &rhs) {
+                return this->text(lhs.key) < this->text(rhs.key);
+            });
+        }
+        String<Ch> text(Span span) const {
+            return String<Ch>(m_text.data() + span.offset, span.length);
+        }
+
+        template <class T>
+        static void place(header &head, SECTION id, const std::vector<T> &items, uint64_t &offset) {
+            offset = (offset + alignof(T) - 1) / alignof(T) * alignof(T);
+            head.sections[id].offset = offset;
+            head.sections[id].count = items.size();
+            offset += items.size() * sizeof(T);
+        }
+        template <class T>
+        static void emit(std::ostream &out,
+                         const header &head,
+                         SECTION id,
+                         const std::vector<T> &items,
+                         uint64_t &written) {
+            static const char padding[8] = {};
+            out.write(padding, static_cast<std::streamsize>(head.sections[id].offset - written));
+            out.write(reinterpret_cast<const char *>(items.data()),
+                      static_cast<std::streamsize>(items.size() * sizeof(T)));
+            written = head.sections[id].offset + items.size() * sizeof(T);
+        }
+    };
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -2,7 +2,9 @@
 #define NVPARSE_NODE_HPP_INCLUDED
 
 #include <cassert>
+#include <cstddef>
 #include <forward_list>
+#include <iterator>
 #include <list>
 #include <map>
 #include <set>
@@ -15,6 +17,53 @@
 namespace nvparsehtml {
 template <typename Ch>
 class DocumentNode;
+template <typename Ch>
+class Node;
+
+//! Responsible for receiving the changes made to the \ref Node s of a
+//! document, see \ref DocumentNode::observer.
+//! Changes to a \ref Node are announced before they are made, so that its
+//! previous state can still be read. A subtree is announced after it is
+//! linked under a parent and before it is unlinked.
+template <typename Ch>
+class NodeObserver {
+   public:
+    virtual ~NodeObserver() {
+    }
+    //! A subtree was linked under a parent.
+    virtual void inserted(Node<Ch> * /*node*/) {
+    }
+    //! A subtree is about to be unlinked from its parent.
+    virtual void removing(Node<Ch> * /*node*/) {
+    }
+    //! A \ref Node is about to get a new name.
+    virtual void name_setting(Node<Ch> * /*node*/, const String<Ch> & /*name*/) {
+    }
+    //! A \ref Node is about to get a new id.
+    virtual void id_setting(Node<Ch> * /*node*/, const String<Ch> & /*id*/) {
+    }
+    //! A class is about to be added to a \ref Node, it may already be there.
+    virtual void class_adding(Node<Ch> * /*node*/, const String<Ch> & /*class_name*/) {
+    }
+    //! A class is about to be removed from a \ref Node, it may be missing.
+    virtual void class_removing(Node<Ch> * /*node*/, const String<Ch> & /*class_name*/) {
+    }
+    //! An attribute of a \ref Node is about to be added or replaced.
+    virtual void attribute_setting(Node<Ch> * /*node*/,
+                                   const String<Ch> & /*name*/,
+                                   const String<Ch> & /*value*/) {
+    }
+    //! An attribute is about to be removed from a \ref Node, it may be missing.
+    virtual void attribute_removing(Node<Ch> * /*node*/, const String<Ch> & /*name*/) {
+    }
+    //! The document is about to delete all of its \ref Node s.
+    virtual void clearing() {
+    }
+    //! The document is being destroyed, after \ref clearing.
+    virtual void destroying() {
+    }
+};
+
 //! Responsible for storing and retreiving an XHTML node's attributes and contents
 template <typename Ch>
 class Node {
@@ -40,9 +89,56 @@ class Node {
     };
     // clang-format on
 
-   private:
-    typedef typename std::list<Node *>::iterator list_iterator;
+    //! Iterates the child nodes of a \ref Node through their sibling links
+    class child_iterator {
+       public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Node *value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Node *const *pointer;
+        typedef Node *const &reference;
+
+        child_iterator() : m_parent(nullptr), m_node(nullptr) {
+        }
+        child_iterator(const Node *parent, Node *node) : m_parent(parent), m_node(node) {
+        }
+        reference operator*() const {
+            return m_node;
+        }
+        pointer operator->() const {
+            return &m_node;
+        }
+        child_iterator &operator++() {
+            m_node = m_node->m_next_sibling;
+            return *this;
+        }
+        child_iterator operator++(int) {
+            child_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        child_iterator &operator--() {
+            m_node = m_node == nullptr ? m_parent->m_last_child : m_node->m_prev_sibling;
+            return *this;
+        }
+        child_iterator operator--(int) {
+            child_iterator it = *this;
+            --(*this);
+            return it;
+        }
+        bool operator==(const child_iterator &rhs) const {
+            return m_node == rhs.m_node;
+        }
+        bool operator!=(const child_iterator &rhs) const {
+            return m_node != rhs.m_node;
+        }
 
+       private:
+        const Node *m_parent;
+        Node *m_node;
+    };
+
+   private:
     static size_t node_counter;
     size_t m_ref_id;
     NODE_TYPE m_type;  // Type of node; always valid
@@ -51,8 +147,14 @@ class Node {
     String<Ch> m_name;
     String<Ch> m_value;
     Node *m_parent;
-    std::list<Node *> m_child_nodes;
+    Node *m_first_child;
+    Node *m_last_child;
+    Node *m_prev_sibling;
+    Node *m_next_sibling;
+    size_t m_children_size;
     std::map<String<Ch>, String<Ch>> m_attributes;
+    DocumentNode<Ch> *m_owner;  // Document that deletes this node, if any; itself for a DocumentNode
+    typename std::list<Node *>::iterator m_owner_it;
 
    protected:
     void type(NODE_TYPE node_type) {
@@ -65,24 +167,34 @@ class Node {
     Node() : Node(NODE_ELEMENT) {
     }
     //! Creates a new \ref Node where the type can be specified.
-    Node(NODE_TYPE type) : m_parent(nullptr), m_type(type) {
+    Node(NODE_TYPE type)
+        : m_type(type),
+          m_parent(nullptr),
+          m_first_child(nullptr),
+          m_last_child(nullptr),
+          m_prev_sibling(nullptr),
+          m_next_sibling(nullptr),
+          m_children_size(0),
+          m_owner(nullptr) {
         m_ref_id = Node<Ch>::node_counter++;
     }
-    Node(const Node &node) {
-        m_ref_id = Node<Ch>::node_counter++;
+    //! Copies the contents of a \ref Node. The copy is not linked into any tree
+    //! and has no children.
+    Node(const Node &node) : Node(node.m_type) {
+        m_id = node.m_id;
+        m_classes = node.m_classes;
         m_name = node.m_name;
         m_value = node.m_value;
-        m_parent = nullptr;
-        m_child_nodes = node.m_child_nodes;
         m_attributes = node.m_attributes;
     }
-    Node operator=(const Node &rhs) {  // assignment operator
-        m_ref_id = Node<Ch>::node_counter++;
+    Node &operator=(const Node &rhs) {  // assignment operator, keeps tree links
+        m_type = rhs.m_type;
+        m_id = rhs.m_id;
+        m_classes = rhs.m_classes;
         m_name = rhs.m_name;
         m_value = rhs.m_value;
-        m_parent = nullptr;
-        m_child_nodes = rhs.m_child_nodes;
         m_attributes = rhs.m_attributes;
+        return *this;
     }
     //! Gets id.
     //! \return \ref String of the id.
@@ -92,6 +204,9 @@ class Node {
     //! Sets id.
     //! \param element_id \ref String of the id.
     void id(const String<Ch> &element_id) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->id_setting(this, element_id);
         m_id = element_id;
         m_attributes[String<Ch>("id", 2)] = element_id;
     }
@@ -103,12 +218,18 @@ class Node {
     //! Adds a class to this \ref Node.
     //! \param class_name \ref String of the class.
     void add_class(const String<Ch> &class_name) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->class_adding(this, class_name);
         m_classes.insert(class_name);
     }
     //! Removes a class from this \ref Node.
     //! \param class_name \ref String of the class.
     void remove_class(const String<Ch> &class_name) {
-        m_classes.remove(class_name);
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->class_removing(this, class_name);
+        m_classes.erase(class_name);
     }
     //! Gets number of classes.
     //! \return number of classes.
@@ -143,6 +264,9 @@ class Node {
     //! Sets name. The name, aka element type.
     //! \param name \ref String of the name.
     void name(String<Ch> name) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->name_setting(this, name);
         m_name = name;
     }
     //! Gets the \ref Node value. The value is the text associated with.
@@ -168,62 +292,89 @@ class Node {
     size_t ref_id() {
         return m_ref_id;
     }
+    //! Gets the first child node.
+    //! \return \ref Node pointer to the first child, or nullptr.
+    Node *first_child() const {
+        return m_first_child;
+    }
+    //! Gets the last child node.
+    //! \return \ref Node pointer to the last child, or nullptr.
+    Node *last_child() const {
+        return m_last_child;
+    }
+    //! Gets the next sibling.
+    //! \return \ref Node pointer to the next sibling, or nullptr.
+    Node *next_sibling() const {
+        return m_next_sibling;
+    }
+    //! Gets the previous sibling.
+    //! \return \ref Node pointer to the previous sibling, or nullptr.
+    Node *previous_sibling() const {
+        return m_prev_sibling;
+    }
     //! The beginning of the child nodes
     //! \return iterator to the first child node
-    list_iterator child_begin() {
-        return m_child_nodes.begin();
+    child_iterator child_begin() const {
+        return child_iterator(this, m_first_child);
     }
     //! The end of the child nodes
-    //! \return iterator to the first child node
-    list_iterator child_end() {
-        return m_child_nodes.end();
+    //! \return iterator to one past the last child node
+    child_iterator child_end() const {
+        return child_iterator(this, nullptr);
     }
     //! Are there any children?
     //! \return whether this \ref Node has any children.
     bool children_empty() const {
-        return m_child_nodes.empty();
+        return m_first_child == nullptr;
     }
     //! Gets number of children.
     //! \return number of children.
     size_t children_size() const {
-        return m_child_nodes.size();
+        return m_children_size;
     }
     //! Gets iterator to the child in question.
-    //! \return list iterator. If not found, returns \ref child_end.
-    list_iterator find_child(Node *node) const {
-        for (auto it = m_child_nodes.begin(); it != m_child_nodes.end(); ++it) {
-            if (*it == node)
-                return it;
-        }
-        return m_child_nodes.end();
+    //! \return child iterator. If not found, returns \ref child_end.
+    child_iterator find_child(Node *node) const {
+        if (node == nullptr || node->m_parent != this)
+            return this->child_end();
+        return child_iterator(this, node);
     }
     //! Appends a Node to this \ref Node.
     //! \param node \ref pointer to Node.
     void append_child(Node *node) {
-        m_child_nodes.push_back(node);
-        node->m_parent = this;
+        this->link_child(node, nullptr);
     }
     //! Removes a Node from this \ref Node.
     //! \param node \ref pointer to Node.
     void remove_child(Node *node) {
-        m_child_nodes.remove(node);
-        node->parent = nullptr;
+        assert(node->m_parent == this);
+        this->unlink_child(node);
+    }
+    //! Removes this \ref Node, together with its descendants, from its parent.
+    void detach() {
+        if (m_parent != nullptr)
+            m_parent->unlink_child(this);
+    }
+    //! Prepends a Node to this \ref Node.
+    //! \param node \ref pointer to Node.
+    void prepend_child(Node *node) {
+        this->link_child(node, m_first_child);
     }
     //! Removes all child \ref Node s
     void clear_children() {
-        m_child_nodes.clear();
+        while (m_first_child != nullptr)
+            this->unlink_child(m_first_child);
     }
     //! Inserts a Node before the specified child node.
     //! \param child \ref iterator to child node.
     //! \param node \ref pointer to \ref Node.
-    void insert_before_child(list_iterator child, Node *node) {
-        m_child_nodes.insert(child, node);
-        --child;
+    void insert_before_child(child_iterator child, Node *node) {
+        this->link_child(node, *child);
     }
     //! Inserts a Node after the specified child node.
     //! \param child \ref iterator to child node.
     //! \param node \ref pointer to \ref Node.
-    void insert_after_child(list_iterator child, Node *node) {
+    void insert_after_child(child_iterator child, Node *node) {
         ++child;
         this->insert_before_child(child, node);
     }
@@ -239,25 +390,96 @@ class Node {
     }
     //! Find an attribute's value.
     //! \param name attribute key.
-    //! \param value attribute value.
+    //! \return attribute value, empty if the attribute is missing.
     String<Ch> find_attribute(String<Ch> name) const {
-        return m_attributes.find(name)->second;
+        auto it = m_attributes.find(name);
+        if (it == m_attributes.end())
+            return String<Ch>();
+        return it->second;
+    }
+    //! Determines whether this \ref Node has an attribute.
+    //! \param name attribute key.
+    bool contains_attribute(const String<Ch> &name) const {
+        return m_attributes.find(name) != m_attributes.end();
     }
     //! Adds an attribute-value pair.
     //! \param name attribute key.
     //! \param value attribute value.
     void add_attribute(String<Ch> name, String<Ch> value) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->attribute_setting(this, name, value);
         m_attributes[name] = value;
     }
     //! Removes an attribute-value pair.
     //! \param name attribute key.
     void remove_attribute(String<Ch> name) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->attribute_removing(this, name);
         m_attributes.erase(name);
     }
     //! Removes all attribute-value pairs.
     void clear_attributes() {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr) {
+            for (const auto &att : m_attributes)
+                observer->attribute_removing(this, att.first);
+        }
         m_attributes.clear();
     }
+
+   private:
+    // Observer of the document this node is in, nullptr while parsing.
+    // Nodes created outside a document report to that of their first owned ancestor.
+    NodeObserver<Ch> *observer() const {
+        for (const Node *n = this; n != nullptr; n = n->m_parent) {
+            if (n->m_owner != nullptr)
+                return n->m_owner->observer();
+        }
+        return nullptr;
+    }
+
+    // Links node as a child in front of before, or last if before is nullptr
+    void link_child(Node *node, Node *before) {
+        assert(node != nullptr && node->m_parent == nullptr);
+        assert(before == nullptr || before->m_parent == this);
+        Node *after = before == nullptr ? m_last_child : before->m_prev_sibling;
+        node->m_parent = this;
+        node->m_prev_sibling = after;
+        node->m_next_sibling = before;
+        if (after == nullptr)
+            m_first_child = node;
+        else
+            after->m_next_sibling = node;
+        if (before == nullptr)
+            m_last_child = node;
+        else
+            before->m_prev_sibling = node;
+        ++m_children_size;
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->inserted(node);
+    }
+
+    // Unlinks a child from its siblings and this node
+    void unlink_child(Node *node) {
+        NodeObserver<Ch> *observer = this->observer();
+        if (observer != nullptr)
+            observer->removing(node);
+        if (node->m_prev_sibling == nullptr)
+            m_first_child = node->m_next_sibling;
+        else
+            node->m_prev_sibling->m_next_sibling = node->m_next_sibling;
+        if (node->m_next_sibling == nullptr)
+            m_last_child = node->m_prev_sibling;
+        else
+            node->m_next_sibling->m_prev_sibling = node->m_prev_sibling;
+        node->m_parent = nullptr;
+        node->m_prev_sibling = nullptr;
+        node->m_next_sibling = nullptr;
+        --m_children_size;
+    }
 };
 
 template <typename Ch>
@@ -0,0 +1,272 @@
+#ifndef NVPARSE_PATTERNINDEX_HPP_INCLUDED
+#define NVPARSE_PATTERNINDEX_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "hash.hpp"
+#include "hash_map.hpp"
+#include "string.hpp"
+#include "text.hpp"
+
+namespace nvparsehtml {
+//! Responsible for finding the values of one attribute by prefix, suffix,
+//! substring, whitespace separated word or hyphen prefix without comparing
+//! every value.
+//! Matches are positions in the vector of values the index was built from,
+//! which every query must be passed again, reported in ascending order.
+template <typename Ch>
+class PatternIndex {
+   public:
+    typedef uint32_t position_type;
+    typedef std::vector<position_type> position_list;
+
+    //! The ways a value can match a pattern
+    enum MATCH {
+        MATCH_PREFIX,    //!< ^= starts with the pattern
+        MATCH_SUFFIX,    //!< $= ends with the pattern
+        MATCH_CONTAINS,  //!< *= contains the pattern
+        MATCH_WORD,      //!< ~= one of the whitespace separated words is the pattern
+        MATCH_HYPHEN,    //!< |= is the pattern or starts with the pattern and '-'
+    };
+
+    //! Length of the substrings whose postings answer \ref MATCH_CONTAINS.
+    static constexpr size_t gram_length = 3;
+
+    //! Indexes values.
+    //! \param values the values, one per position.
+    void build(const std::vector<String<Ch>> &values) {
+        m_by_value.resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            m_by_value[i] = static_cast<position_type>(i);
+        m_by_reversed = m_by_value;
+        std::sort(m_by_value.begin(), m_by_value.end(),
+                  [&values](position_type lhs, position_type rhs) {
+                      return values[lhs] < values[rhs];
+                  });
+        std::sort(m_by_reversed.begin(), m_by_reversed.end(),
+                  [&values](position_type lhs, position_type rhs) {
+                      return reversed_less(values[lhs], values[rhs]);
+                  });
+        m_grams.clear();
+        m_words.clear();
+        for (size_t i = 0; i < values.size(); ++i) {
+            position_type position = static_cast<position_type>(i);
+            const String<Ch> &value = values[i];
+            for (size_t g = 0; g + gram_length <= value.length(); ++g)
+                add_posting(m_grams[gram_key(value.data() + g)], position);
+            for_each_word(value, [this, position](const String<Ch> &word) {
+                add_posting(m_words[word], position);
+            });
+        }
+    }
+
+    //! Finds the values matching a pattern.
+    //! \param values the values the index was built from.
+    //! \param match how values must match.
+    //! \param pattern \ref String of the pattern.
+    //! \param results vector the ascending positions of the matches are appended to.
+    void find(const std::vector<String<Ch>> &values,
+              MATCH match,
+              const String<Ch> &pattern,
+              position_list &results) const {
+        switch (match) {
+            case MATCH_PREFIX:
+                this->prefix(values, pattern, results);
+                break;
+            case MATCH_SUFFIX:
+                this->suffix(values, pattern, results);
+                break;
+            case MATCH_CONTAINS:
+                this->contains(values, pattern, results);
+                break;
+            case MATCH_WORD:
+                this->word(pattern, results);
+                break;
+            case MATCH_HYPHEN:
+                this->hyphen(values, pattern, results);
+                break;
+        }
+    }
+    //! Finds the values matching a pattern by comparing every value.
+    //! \param values the values.
+    //! \param match how values must match.
+    //! \param pattern \ref String of the pattern.
+    //! \param results vector the ascending positions of the matches are appended to.
+    static void scan(const std::vector<String<Ch>> &values,
+                     MATCH match,
+                     const String<Ch> &pattern,
+                     position_list &results) {
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (test(match, values[i], pattern))
+                results.push_back(static_cast<position_type>(i));
+        }
+    }
+    //! Does a value match a pattern?
+    //! \param match how the value must match.
+    //! \param value \ref String of the value.
+    //! \param pattern \ref String of the pattern.
+    //! \return whether the value matches.
+    static bool test(MATCH match, const String<Ch> &value, const String<Ch> &pattern) {
+        switch (match) {
+            case MATCH_PREFIX:
+                return !pattern.empty() && starts_with(value, pattern);
+            case MATCH_SUFFIX:
+                return !pattern.empty() && ends_with(value, pattern);
+            case MATCH_CONTAINS:
+                return !pattern.empty() && contains_text(value, pattern);
+            case MATCH_WORD: {
+                bool found = false;
+                if (valid_word(pattern)) {
+                    for_each_word(value, [&found, &pattern](const String<Ch> &word) {
+                        found = found || word == pattern;
+                    });
+                }
+                return found;
+            }
+            case MATCH_HYPHEN:
+                return starts_with(value, pattern) &&
+                       (value.length() == pattern.length() || value[pattern.length()] == Ch('-'));
+        }
+        return false;
+    }
+
+   private:
+    position_list m_by_value;     // positions sorted by value
+    position_list m_by_reversed;  // positions sorted by reversed value
+    HashMap<uint64_t, position_list> m_grams;
+    HashMap<String<Ch>, position_list> m_words;
+
+    void prefix(const std::vector<String<Ch>> &values,
+                const String<Ch> &prefix,
+                position_list &results) const {
+        if (prefix.empty())
+            return;
+        size_t first = results.size();
+        auto it = std::lower_bound(m_by_value.begin(), m_by_value.end(), prefix,
+                                   [&values](position_type position, const String<Ch> &key) {
+                                       return values[position] < key;
+                                   });
+        for (; it != m_by_value.end() && starts_with(values[*it], prefix); ++it)
+            results.push_back(*it);
+        std::sort(results.begin() + first, results.end());
+    }
+    void suffix(const std::vector<String<Ch>> &values,
+                const String<Ch> &suffix,
+                position_list &results) const {
+        if (suffix.empty())
+            return;
+        size_t first = results.size();
+        auto it = std::lower_bound(m_by_reversed.begin(), m_by_reversed.end(), suffix,
+                                   [&values](position_type position, const String<Ch> &key) {
+                                       return reversed_less(values[position], key);
+                                   });
+        for (; it != m_by_reversed.end() && ends_with(values[*it], suffix); ++it)
+            results.push_back(*it);
+        std::sort(results.begin() + first, results.end());
+    }
+    // Needles shorter than a gram are found by scanning
+    void contains(const std::vector<String<Ch>> &values,
+                  const String<Ch> &needle,
+                  position_list &results) const {
+        if (needle.empty())
+            return;
+        if (needle.length() < gram_length) {
+            scan(values, MATCH_CONTAINS, needle, results);
+            return;
+        }
+        // Start from the rarest gram of the needle, every match contains all of them
+        const position_list *rarest = nullptr;
+        for (size_t g = 0; g + gram_length <= needle.length(); ++g) {
+            auto it = m_grams.find(gram_key(needle.data() + g));
+            if (it == m_grams.end())
+                return;
+            if (rarest == nullptr || it->second.size() < rarest->size())
+                rarest = &it->second;
+        }
+        for (position_type position : *rarest) {
+            if (contains_text(values[position], needle))
+                results.push_back(position);
+        }
+    }
+    void word(const String<Ch> &word, position_list &results) const {
+        if (!valid_word(word))
+            return;
+        auto it = m_words.find(word);
+        if (it != m_words.end())
+            results.insert(results.end(), it->second.begin(), it->second.end());
+    }
+    void hyphen(const std::vector<String<Ch>> &values,
+                const String<Ch> &value,
+                position_list &results) const {
+        if (value.empty()) {
+            scan(values, MATCH_HYPHEN, value, results);
+            return;
+        }
+        position_list candidates;
+        this->prefix(values, value, candidates);
+        for (position_type position : candidates) {
+            if (test(MATCH_HYPHEN, values[position], value))
+                results.push_back(position);
+        }
+    }
+
+    static void add_posting(position_list &postings, position_type position) {
+        // Positions arrive in ascending order, a value adds each key once
+        if (postings.empty() || postings.back() != position)
+            postings.push_back(position);
+    }
+    static uint64_t gram_key(const Ch *text) {
+        return hash_bytes(text, gram_length * sizeof(Ch));
+    }
+    static bool starts_with(const String<Ch> &value, const String<Ch> &prefix) {
+        return value.length() >= prefix.length() &&
+               String<Ch>(value.data(), prefix.length()) == prefix;
+    }
+    static bool ends_with(const String<Ch> &value, const String<Ch> &suffix) {
+        return value.length() >= suffix.length() &&
+               String<Ch>(value.data() + value.length() - suffix.length(), suffix.length()) ==
+                   suffix;
+    }
+    static bool contains_text(const String<Ch> &value, const String<Ch> &needle) {
+        return value.view().find(needle.view()) != std::basic_string_view<Ch>::npos;
+    }
+    static bool valid_word(const String<Ch> &word) {
+        if (word.empty())
+            return false;
+        for (size_t i = 0; i < word.length(); ++i) {
+            if (whitespace_pred<Ch>::test(word[i]))
+                return false;
+        }
+        return true;
+    }
+    // Orders as if both strings were reversed, so values sharing a suffix are adjacent
+    static bool reversed_less(const String<Ch> &lhs, const String<Ch> &rhs) {
+        size_t length = lhs.length() < rhs.length() ? lhs.length() : rhs.length();
+        for (size_t i = 1; i <= length; ++i) {
+            Ch l = lhs[lhs.length() - i], r = rhs[rhs.length() - i];
+            if (l != r)
+                return l < r;
+        }
+        return lhs.length() < rhs.length();
+    }
+    template <class Visitor>
+    static void for_each_word(const String<Ch> &value, Visitor visit) {
+        size_t i = 0;
+        while (i < value.length()) {
+            while (i < value.length() && whitespace_pred<Ch>::test(value[i]))
+                ++i;
+            size_t start = i;
+            while (i < value.length() && !whitespace_pred<Ch>::test(value[i]))
+                ++i;
+            if (i > start)
+                visit(String<Ch>(value.data() + start, i - start));
+        }
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
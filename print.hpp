@@ -3,10 +3,12 @@
 
 #include <iterator>
 #include <ostream>
+#include <vector>
 
 #include "document.hpp"
 #include "node.hpp"
 #include "text.hpp"
+#include "traverse.hpp"
 
 namespace nvparsehtml {
 ///////////////////////////////////////////////////////////////////////
@@ -19,8 +21,6 @@ const bool print_no_indenting = false;  //!< Printer flag instructing the printe
 // Internal
 
 namespace internal {
-template <class OutIt, class Ch>
-inline OutIt print_children(OutIt out, Node<Ch> *node, int indent);
 ///////////////////////////////////////////////////////////////////////////
 // Internal character operations
 
@@ -237,7 +237,7 @@ inline OutIt print_cdata_node(OutIt out, Node<Ch> *node, int indent) {
     return out;
 }
 
-// Print element node
+// Print element node without children
 template <class OutIt, class Ch>
 inline OutIt print_element_node(OutIt out, Node<Ch> *node, int indent) {
     assert(node->type() <= Node<Ch>::NODE_ELEMENT);
@@ -250,29 +250,47 @@ inline OutIt print_element_node(OutIt out, Node<Ch> *node, int indent) {
     out = print_attributes(out, node);
 
     // If node is childless
-    if (node->children_empty() && node->value().empty()) {
+    if (node->value().empty()) {
         // Print childless node tag ending
         *out = Ch('/'), ++out;
         *out = Ch('>'), ++out;
         return out;
-    } else if (node->children_empty()) {
-        // Print normal node tag ending
-        *out = Ch('>'), ++out;
-        out = copy_chars_combine_ws(node->value(), out);
-        // Print node end
-        *out = Ch('<'), ++out;
-        *out = Ch('/'), ++out;
-        out = copy_chars(node->name(), out);
-        *out = Ch('>'), ++out;
-        return out;
     }
 
     // Print normal node tag ending
     *out = Ch('>'), ++out;
-    // Print all children with full indenting
+    out = copy_chars_combine_ws(node->value(), out);
+    // Print node end
+    *out = Ch('<'), ++out;
+    *out = Ch('/'), ++out;
+    out = copy_chars(node->name(), out);
+    *out = Ch('>'), ++out;
+    return out;
+}
+
+// Print start tag of element node with children
+template <class OutIt, class Ch>
+inline OutIt print_element_start(OutIt out, Node<Ch> *node, int indent) {
+    assert(node->type() <= Node<Ch>::NODE_ELEMENT);
+
+    // Print element name and attributes, if any
+    if (!print_no_indenting)
+        out = fill_chars(out, indent, Ch('\t'));
+    *out = Ch('<'), ++out;
+    out = copy_chars(node->name(), out);
+    out = print_attributes(out, node);
+
+    // Print normal node tag ending, children follow with full indenting
+    *out = Ch('>'), ++out;
     if (!print_no_indenting)
         *out = Ch('\n'), ++out;
-    out = print_children(out, node, indent + 1);
+    return out;
+}
+
+// Print end tag of element node with children
+template <class OutIt, class Ch>
+inline OutIt print_element_end(OutIt out, Node<Ch> *node, int indent) {
+    assert(node->type() <= Node<Ch>::NODE_ELEMENT);
     if (!print_no_indenting)
         out = fill_chars(out, indent, Ch('\t'));
     // Print node end
@@ -280,7 +298,6 @@ inline OutIt print_element_node(OutIt out, Node<Ch> *node, int indent) {
     *out = Ch('/'), ++out;
     out = copy_chars(node->name(), out);
     *out = Ch('>'), ++out;
-
     return out;
 }
 
@@ -400,9 +417,9 @@ inline OutIt print_pi_node(OutIt out, Node<Ch> *node, int indent) {
     return out;
 }
 
-// Print node
+// Print node that does not enclose its children
 template <class OutIt, class Ch>
-inline OutIt print_node(OutIt out, Node<Ch> *node, int indent) {
+inline OutIt print_leaf_node(OutIt out, Node<Ch> *node, int indent) {
     // Print proper node type
     switch (node->type()) {
         // Element
@@ -446,33 +463,58 @@ inline OutIt print_node(OutIt out, Node<Ch> *node, int indent) {
             out = print_pi_node(out, node, indent);
             break;
 
-        // Document
-        case Node<Ch>::NODE_DOCUMENT:
-            out = print_children(out, node, indent);
-            break;
-
             // Unknown
         default:
             assert(0);
             break;
     }
-
-    // If indenting not disabled, add line break after node
-    if (!print_no_indenting && node->type() != Node<Ch>::NODE_DOCUMENT)
-        *out = Ch('\n'), ++out;
-
-    // Return modified iterator
     return out;
 }
 
-// Print children of the node
+// Does the node print its children between its start and end?
+template <class Ch>
+inline bool encloses_children(Node<Ch> *node) {
+    if (node->type() == Node<Ch>::NODE_DOCUMENT)
+        return true;
+    return node->type() == Node<Ch>::NODE_ELEMENT && !node->children_empty();
+}
+
+// Print node and its children, walking the tree without recursion
 template <class OutIt, class Ch>
-inline OutIt print_children(OutIt out, Node<Ch> *node, int indent) {
-    if (node->name() == String<Ch>("html", 4))
-        indent = 0;
-    for (auto it = node->child_begin(); it != node->child_end(); ++it) {
-        out = print_node(out, *it, indent);
+inline OutIt print_node(OutIt out, Node<Ch> *root, int indent) {
+    // Indent of the children of each enclosing node being printed
+    std::vector<int> indents;
+    for (TreeWalker<Ch> walker(root); !walker.done(); walker.next()) {
+        Node<Ch> *node = walker.node();
+        if (walker.entering()) {
+            int node_indent = indents.empty() ? indent : indents.back();
+            if (!encloses_children(node)) {
+                out = print_leaf_node(out, node, node_indent);
+                walker.skip_children();
+                continue;
+            }
+            if (node->type() != Node<Ch>::NODE_DOCUMENT) {
+                out = print_element_start(out, node, node_indent);
+                ++node_indent;
+            }
+            if (node->name() == String<Ch>("html", 4))
+                node_indent = 0;
+            indents.push_back(node_indent);
+            continue;
+        }
+
+        if (encloses_children(node)) {
+            indents.pop_back();
+            if (node->type() != Node<Ch>::NODE_DOCUMENT)
+                out = print_element_end(out, node, indents.empty() ? indent : indents.back());
+        }
+
+        // If indenting not disabled, add line break after node
+        if (!print_no_indenting && node->type() != Node<Ch>::NODE_DOCUMENT)
+            *out = Ch('\n'), ++out;
     }
+
+    // Return modified iterator
     return out;
 }
 
@@ -0,0 +1,373 @@
+#ifndef NVPARSE_QUERYPLANNER_HPP_INCLUDED
+#define NVPARSE_QUERYPLANNER_HPP_INCLUDED
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "document_index.hpp"
+#include "node.hpp"
+#include "pattern_index.hpp"
+#include "selector.hpp"
+#include "selector_program.hpp"
+#include "string.hpp"
+#include "text.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+//! Responsible for evaluating a \ref Selector with the posting lists of a
+//! \ref DocumentIndex instead of testing every \ref Node.
+//! Every simple selector with a key the index knows, an id, type, class or
+//! attribute, gets the size of its posting list as its estimate. For each
+//! comma separated selector the cheapest key of the rightmost compound is
+//! the seed: only the \ref Node s of its posting list can match, and they
+//! are verified with a \ref SelectorProgram. A selector with a key whose
+//! posting list is empty, in any compound, matches nothing and is dropped.
+//! Without an index, or when a rightmost compound has no key, the plan
+//! scans the tree.
+template <class Ch>
+class QueryPlanner {
+   public:
+    typedef typename DocumentIndex<Ch>::handle_type handle_type;
+    typedef typename DocumentIndex<Ch>::posting_list posting_list;
+
+    //! Kinds of posting list a seed is taken from
+    enum SEED {
+        SEED_TYPE,       //!< \ref DocumentIndex::type_postings
+        SEED_CLASS,      //!< \ref DocumentIndex::class_postings
+        SEED_ATTRIBUTE,  //!< \ref DocumentIndex::attribute_postings_of
+        SEED_VALUE,      //!< \ref DocumentIndex::attribute_value_postings
+        SEED_PATTERN,    //!< attribute values matching a pattern through a \ref PatternIndex
+    };
+    //! Key whose posting list holds every candidate of one comma separated selector
+    struct Seed {
+        SEED kind;
+        String<Ch> name;   //!< type, class or attribute name
+        String<Ch> value;  //!< attribute value or pattern
+        typename PatternIndex<Ch>::MATCH match;
+        size_t estimate;  //!< number of candidates
+    };
+
+    //! Plans a selector.
+    //! \param selector the parsed \ref Selector.
+    //! \param index index of the document queried, nullptr to scan the tree.
+    QueryPlanner(const Selector &selector, const DocumentIndex<Ch> *index)
+        : m_program(selector), m_index(index), m_scan(index == nullptr) {
+        if (!m_scan)
+            this->plan(selector);
+    }
+    QueryPlanner(const QueryPlanner &) = delete;
+    QueryPlanner &operator=(const QueryPlanner &) = delete;
+
+    //! Does the plan test every \ref Node under the root?
+    //! \return whether the index is not used.
+    bool scans() const {
+        return m_scan;
+    }
+    //! Gets the seeds, one per comma separated selector that can match.
+    //! \return seeds, empty if the plan scans or nothing can match.
+    const std::vector<Seed> &seeds() const {
+        return m_seeds;
+    }
+    //! Gets the number of \ref Node s the plan verifies.
+    //! \return sum of the seed estimates, or the \ref Node count when scanning.
+    size_t estimate() const {
+        if (m_scan)
+            return m_index == nullptr ? 0 : m_index->size();
+        size_t estimate = 0;
+        for (const Seed &seed : m_seeds)
+            estimate += seed.estimate;
+        return estimate;
+    }
+    //! Gets the compiled selector candidates are verified with.
+    const SelectorProgram<Ch> &program() const {
+        return m_program;
+    }
+
+    //! Finds the \ref Node s under a root that match, like \ref Selector::select_all.
+    //! \param root the \ref Node whose descendants are tested, in the indexed document.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    void select_all(Node<Ch> *root, std::vector<Node<Ch> *> &results) const {
+        if (m_scan) {
+            m_program.select_all(root, results);
+            return;
+        }
+        posting_list candidates;
+        this->candidates(candidates);
+        for (handle_type handle : candidates) {
+            Node<Ch> *node = m_index->node(handle);
+            if (this->verify(node, root))
+                results.push_back(node);
+        }
+    }
+    //! Finds the first \ref Node s under a root that match, up to a limit.
+    //! The posting lists of the seeds are merged as the candidates are
+    //! verified, and neither goes past the last match needed.
+    //! \param root the \ref Node whose descendants are tested, in the indexed document.
+    //! \param limit most \ref Node s to find.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    void select_n(Node<Ch> *root, size_t limit, std::vector<Node<Ch> *> &results) const {
+        if (m_scan) {
+            m_program.select_n(root, limit, results);
+            return;
+        }
+        if (limit == 0)
+            return;
+        std::deque<posting_list> built;
+        std::vector<const posting_list *> lists;
+        this->seed_postings(lists, built);
+        this->merge(lists, [&](handle_type handle) {
+            Node<Ch> *node = m_index->node(handle);
+            if (!this->verify(node, root))
+                return true;
+            results.push_back(node);
+            return --limit != 0;
+        });
+    }
+    //! Finds the first \ref Node under a root that matches.
+    //! \param root the \ref Node whose descendants are tested, in the indexed document.
+    //! \return first matching \ref Node in document order, nullptr if none.
+    Node<Ch> *select_first(Node<Ch> *root) const {
+        if (m_scan)
+            return m_program.select_first(root);
+        std::vector<Node<Ch> *> results;
+        this->select_n(root, 1, results);
+        return results.empty() ? nullptr : results[0];
+    }
+    //! Determines whether a \ref Node under a root matches. Order does not
+    //! matter, so the seeds are tried one at a time, smallest posting list first.
+    //! \param root the \ref Node whose descendants are tested, in the indexed document.
+    //! \return whether \ref select_first finds a \ref Node.
+    bool exists(Node<Ch> *root) const {
+        if (m_scan)
+            return m_program.exists(root);
+        std::deque<posting_list> built;
+        std::vector<const posting_list *> lists;
+        this->seed_postings(lists, built);
+        for (const posting_list *list : lists) {
+            for (handle_type handle : *list) {
+                if (this->verify(m_index->node(handle), root))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    SelectorProgram<Ch> m_program;
+    const DocumentIndex<Ch> *m_index;
+    bool m_scan;
+    std::vector<Seed> m_seeds;
+    std::deque<std::basic_string<Ch>> m_text;  // keys converted to Ch, in place
+
+    void plan(const Selector &selector) {
+        for (uint32_t complex = 0; complex < selector.m_count;
+             complex = selector.token(complex).end) {
+            Seed best = {SEED_TYPE, String<Ch>(), String<Ch>(), PatternIndex<Ch>::MATCH_PREFIX, 0};
+            bool found = false;
+            bool empty = false;
+            uint32_t end = selector.token(complex).end;
+            for (uint32_t compound = complex + 1; compound < end && !empty;
+                 compound = selector.token(compound).end) {
+                bool rightmost = compound == selector.token(complex).link;
+                for (uint32_t simple = compound + 1; simple < selector.token(compound).end;
+                     simple = selector.token(simple).end) {
+                    Seed seed;
+                    if (!this->key(selector, selector.token(simple), seed))
+                        continue;
+                    // Every compound needs a match, so an empty key anywhere
+                    // rules the selector out; only the rightmost one seeds
+                    if (seed.estimate == 0) {
+                        empty = true;
+                        break;
+                    }
+                    if (rightmost && (!found || seed.estimate < best.estimate)) {
+                        best = seed;
+                        found = true;
+                    }
+                }
+            }
+            if (empty)
+                continue;
+            if (!found) {
+                m_scan = true;
+                m_seeds.clear();
+                return;
+            }
+            m_seeds.push_back(best);
+        }
+    }
+    // Gets the key of a simple selector and its estimate, false if the
+    // index cannot narrow it down
+    bool key(const Selector &selector, const Selector::Token &token, Seed &seed) {
+        switch (token.type) {
+            case Selector::SELECTOR_TYPE:
+                if (selector.is_universal(token))
+                    return false;
+                seed.kind = SEED_TYPE;
+                seed.name = this->add_string(selector.text(token.name), true);
+                seed.estimate = m_index->type_postings(seed.name).size();
+                return true;
+            case Selector::SELECTOR_CLASS:
+                seed.kind = SEED_CLASS;
+                seed.name = this->add_string(selector.text(token.name), false);
+                seed.estimate = m_index->class_postings(seed.name).size();
+                return true;
+            case Selector::SELECTOR_ID:
+                // Ids are attributes too, and unlike find_id their
+                // postings keep every Node sharing one
+                return this->attribute_key(String<char>("id", 2), Selector::ATT_OP_EQUALS,
+                                           selector.text(token.name), false, seed);
+            case Selector::SELECTOR_ATTRIBUTE:
+                return this->attribute_key(selector.text(token.name), token.op,
+                                           selector.text(token.value), token.case_insensitive,
+                                           seed);
+            default:
+                // Pseudo-classes may match Nodes without any key
+                return false;
+        }
+    }
+    bool attribute_key(const String<char> &name,
+                       Selector::ATT_OP op,
+                       const String<char> &value,
+                       bool case_insensitive,
+                       Seed &seed) {
+        seed.kind = SEED_ATTRIBUTE;
+        seed.name = this->add_string(name, true);
+        seed.estimate = m_index->attribute_postings_of(seed.name).size();
+        if (seed.estimate == 0 || case_insensitive)
+            return true;
+        if (op == Selector::ATT_OP_EQUALS && m_index->values_indexed(seed.name)) {
+            seed.kind = SEED_VALUE;
+            seed.value = this->add_string(value, false);
+            seed.estimate = m_index->attribute_value_postings(seed.name, seed.value).size();
+        } else if (op != Selector::ATT_OP_HAS && op != Selector::ATT_OP_EQUALS && !value.empty() &&
+                   m_index->patterns_indexed(seed.name)) {
+            // The pattern postings are built when queried, the attribute
+            // postings bound them
+            seed.kind = SEED_PATTERN;
+            seed.value = this->add_string(value, false);
+            seed.match = pattern_match(op);
+        }
+        return true;
+    }
+    static typename PatternIndex<Ch>::MATCH pattern_match(Selector::ATT_OP op) {
+        switch (op) {
+            case Selector::ATT_OP_ONE_EQUALS:
+                return PatternIndex<Ch>::MATCH_WORD;
+            case Selector::ATT_OP_HYPHEN:
+                return PatternIndex<Ch>::MATCH_HYPHEN;
+            case Selector::ATT_OP_SUFFIX:
+                return PatternIndex<Ch>::MATCH_SUFFIX;
+            case Selector::ATT_OP_CONTAINS:
+                return PatternIndex<Ch>::MATCH_CONTAINS;
+            default:
+                return PatternIndex<Ch>::MATCH_PREFIX;
+        }
+    }
+    String<Ch> add_string(const String<char> &s, bool lowercase) {
+        std::basic_string<Ch> text;
+        for (size_t i = 0; i < s.length(); ++i) {
+            Ch ch = static_cast<Ch>(static_cast<unsigned char>(s[i]));
+            text.push_back(lowercase ? internal::lower_char(ch) : ch);
+        }
+        m_text.push_back(std::move(text));
+        return String<Ch>(m_text.back().data(), m_text.back().size());
+    }
+
+    // Merges the postings of the seeds into sorted, distinct handles
+    void candidates(posting_list &results) const {
+        for (const Seed &seed : m_seeds) {
+            switch (seed.kind) {
+                case SEED_TYPE:
+                    DocumentIndex<Ch>::merge_postings(m_index->type_postings(seed.name), results);
+                    break;
+                case SEED_CLASS:
+                    DocumentIndex<Ch>::merge_postings(m_index->class_postings(seed.name), results);
+                    break;
+                case SEED_ATTRIBUTE:
+                    DocumentIndex<Ch>::merge_postings(m_index->attribute_postings_of(seed.name),
+                                                      results);
+                    break;
+                case SEED_VALUE:
+                    DocumentIndex<Ch>::merge_postings(
+                        m_index->attribute_value_postings(seed.name, seed.value), results);
+                    break;
+                case SEED_PATTERN:
+                    m_index->get_by_attribute(seed.name, seed.match, seed.value, results);
+                    break;
+            }
+        }
+    }
+    // Gets the posting list of each seed, the shortest first. Pattern
+    // postings are built into built.
+    void seed_postings(std::vector<const posting_list *> &lists,
+                       std::deque<posting_list> &built) const {
+        for (const Seed &seed : m_seeds) {
+            switch (seed.kind) {
+                case SEED_TYPE:
+                    lists.push_back(&m_index->type_postings(seed.name));
+                    break;
+                case SEED_CLASS:
+                    lists.push_back(&m_index->class_postings(seed.name));
+                    break;
+                case SEED_ATTRIBUTE:
+                    lists.push_back(&m_index->attribute_postings_of(seed.name));
+                    break;
+                case SEED_VALUE:
+                    lists.push_back(&m_index->attribute_value_postings(seed.name, seed.value));
+                    break;
+                case SEED_PATTERN:
+                    built.emplace_back();
+                    m_index->get_by_attribute(seed.name, seed.match, seed.value, built.back());
+                    lists.push_back(&built.back());
+                    break;
+            }
+        }
+        std::sort(lists.begin(), lists.end(), [](const posting_list *a, const posting_list *b) {
+            return a->size() < b->size();
+        });
+    }
+    // Calls visit with the handles of sorted lists in ascending order, each
+    // once, until it returns false
+    template <class F>
+    static void merge(const std::vector<const posting_list *> &lists, F visit) {
+        std::vector<size_t> positions(lists.size(), 0);
+        while (true) {
+            bool found = false;
+            handle_type next = 0;
+            for (size_t i = 0; i < lists.size(); ++i) {
+                if (positions[i] < lists[i]->size() &&
+                    (!found || (*lists[i])[positions[i]] < next)) {
+                    next = (*lists[i])[positions[i]];
+                    found = true;
+                }
+            }
+            if (!found)
+                return;
+            for (size_t i = 0; i < lists.size(); ++i) {
+                if (positions[i] < lists[i]->size() && (*lists[i])[positions[i]] == next)
+                    ++positions[i];
+            }
+            if (!visit(next))
+                return;
+        }
+    }
+    // Is a candidate below root and a match?
+    bool verify(Node<Ch> *node, Node<Ch> *root) const {
+        if (node == root)
+            return false;
+        if (root != static_cast<Node<Ch> *>(m_index->document())) {
+            Node<Ch> *parent = node->parent();
+            while (parent != nullptr && parent != root)
+                parent = parent->parent();
+            if (parent == nullptr)
+                return false;
+        }
+        return m_program.match(node, root);
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -1,18 +1,52 @@
 #ifndef NVPARSE_SELECTOR_HPP_INCLUDED
 #define NVPARSE_SELECTOR_HPP_INCLUDED
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
 #include <list>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
 
+#include "ancestor_filter.hpp"
+#include "hash_map.hpp"
+#include "node.hpp"
 #include "string.hpp"
 #include "text.hpp"
+#include "traverse.hpp"
 
 namespace nvparsehtml {
-//! Responsible for parsing a CSS selector and storing it as an AST
+template <class Ch>
+class SelectorProgram;
+template <class Ch>
+class QueryPlanner;
+template <class Ch>
+class SelectorSet;
+
+//! Responsible for parsing a CSS selector, storing it as an AST and
+//! matching it against \ref Node s.
+//! Complex selectors are matched right to left: the rightmost compound is
+//! tested against a \ref Node first, then each combinator walks to the
+//! parents or preceding siblings that could match the compound on its left.
+//! The AST is one array of plain tokens followed by a copy of the
+//! expression they refer to, in a single allocation, so parsing allocates
+//! once and copying a selector is one memcpy.
 class Selector {
+    template <class Ch>
+    friend class SelectorProgram;
+    template <class Ch>
+    friend class QueryPlanner;
+    template <class Ch>
+    friend class SelectorSet;
+
     //! The selector types
     enum ESELECTOR {
         SELECTOR_TYPE,               //!< element types like div, input, etc.
@@ -32,6 +66,15 @@ class Selector {
         SELECTOR_SUEDO_CLASS_HAS,    //!< :has suedo class info not contained in DOM tree.
         SELECTOR_SUEDO_ELEMENT,      //!< :: suedo elements not in html.
         SELECTOR_ROOT,               //!< denotes a root selector
+
+        // Structural pseudo-classes, An+B in Token::nth_step and nth_offset
+        SELECTOR_SUEDO_CLASS_NTH_CHILD,         //!< :nth-child(An+B) and :first-child
+        SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD,    //!< :nth-last-child(An+B) and :last-child
+        SELECTOR_SUEDO_CLASS_NTH_OF_TYPE,       //!< :nth-of-type(An+B) and :first-of-type
+        SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE,  //!< :nth-last-of-type(An+B) and :last-of-type
+        SELECTOR_SUEDO_CLASS_ONLY_CHILD,        //!< :only-child
+        SELECTOR_SUEDO_CLASS_ONLY_OF_TYPE,      //!< :only-of-type
+        SELECTOR_SUEDO_CLASS_EMPTY,             //!< :empty, no element or text children
     };
 
     enum ATT_OP {
@@ -44,306 +87,1138 @@ class Selector {
         ATT_OP_CONTAINS,    //!< *= contains value
     };
 
-    struct Token {
-        Token(ESELECTOR t_type)
-            : type(t_type),
-              left(nullptr),
-              right(nullptr),
-              sub(nullptr),
-              op(ATT_OP_HAS),
-              case_insensitive(false) {
-        }
+    //! How the answers of a pseudo-class are kept during a walk, see \ref Memo
+    enum MEMO {
+        MEMO_NONE,      //!< not kept, the arguments are single compounds
+        MEMO_LAZY,      //!< kept per \ref Node once tested
+        MEMO_HAS,       //!< :has without sibling combinators, bottom-up at once in \ref select_all
+        MEMO_POSITION,  //!< structural pseudo-classes, positions kept per \ref Node
+    };
+    //! Position of an element among the element children of its parent, from 1
+    struct Position {
+        uint32_t index;
+        uint32_t count;       //!< number of element children
+        uint32_t type_index;  //!< among the children with the same name
+        uint32_t type_count;
+    };
 
+    //! No token
+    static constexpr uint32_t npos = 0xFFFFFFFF;
+    //! One node of the AST. The tokens lie in one array, each followed by
+    //! the tokens it holds up to \ref end: a complex selector, typed
+    //! SELECTOR_OR, holds its compounds; a compound, typed by the combinator
+    //! on its left or SELECTOR_ROOT, holds its simple selectors; :is, :not,
+    //! :where and :has hold the complexes of their arguments.
+    struct Token {
         ESELECTOR type;
-        std::shared_ptr<Token> left;
-        std::shared_ptr<Token> right;
-        std::shared_ptr<Token> sub;
-        std::string name;
-        std::string value;
         ATT_OP op;
+        MEMO memo;
         bool case_insensitive;
+        uint32_t end;   //!< index past the tokens held
+        uint32_t link;  //!< last compound of a complex, compound on the left of a compound
+        Span name;       //!< in the copy of the expression, see \ref text
+        Span value;      //!< in the copy of the expression
+        Span keys;       //!< ancestor keys of a complex, see \ref AncestorFilter
+        int nth_step;    //!< A of An+B
+        int nth_offset;  //!< B of An+B
     };
+    static_assert(std::is_trivially_copyable<Token>::value, "tokens are copied as bytes");
 
-    std::shared_ptr<Token> m_ptoken;
+    // Tokens, then the ancestor keys, then the expression, in one allocation
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_size;          // bytes of m_buffer
+    uint32_t m_count;       // tokens of the comma separated complexes
+    size_t m_keys_offset;   // of the ancestor keys in m_buffer
+    size_t m_text_offset;   // of the expression in m_buffer
+    bool m_filtered;        // some complex has ancestor keys
+    bool m_memoized;        // some simple, at any depth, has a memo
 
-   public:
-    //! Initiatizes the local expression string
-    //! \param expression CSS expression to parse as a string.
-    Selector(const std::string &expression) : Selector(expression.c_str()) {
-    }
-    //! Initiatizes the local expression string
-    //! \param expression CSS expression to parse as a c-string.
-    Selector(const char *expression) {
-        char *expr = const_cast<char *>(expression);
-        m_ptoken = this->parse_to_list(expr);
-    }
+    //! Answers of pseudo-classes by \ref Node, kept for one walk under a root.
+    //! A walk over every descendant, as \ref select_all does, numbers the
+    //! subtree of its root in pre-order the first time an answer is needed,
+    //! one entry per \ref Node, and answers a :has for all of them at once.
+    //! A walk that may stop early numbers the \ref Node s as they are tested,
+    //! and so do both for the \ref Node s outside the subtree that combinators
+    //! reach.
+    template <class Ch>
+    struct Memo {
+        static constexpr uint32_t npos = 0xFFFFFFFF;
 
-   private:
-    std::shared_ptr<Token> parse_to_list(char *&expression) {
-        assert(expression);
-        auto root = std::make_shared<Token>(SELECTOR_ROOT);
-        std::shared_ptr<Token> cur_token = root;
-        char *text = expression;
-        // Skip whitespace at the start
-        Text<char>::template skip<whitespace_pred<char>>(text);
-        while (true) {
-            if (*text == 0) {
-                break;
+        Node<Ch> *root;
+        bool whole;                     // the walk visits every descendant of root
+        uint32_t subtree;               // nodes of the subtree of root, numbered first if whole
+        std::vector<Node<Ch> *> nodes;  // by number
+        std::vector<uint32_t> parents;  // parent number of each of the subtree, npos for root
+        HashMap<const Node<Ch> *, uint32_t> numbers;
+        HashMap<const Token *, size_t> slots;      // of a pseudo-class in answers
+        std::deque<std::vector<uint8_t>> answers;  // 0 unknown, 1 no, 2 yes, by number
+        HashMap<const Node<Ch> *, Position> positions;  // of the children of parents seen
+        HashMap<const Node<Ch> *, Position> leading;    // index and type index of elements seen
+
+        Memo(Node<Ch> *root, bool whole) : root(root), whole(whole), subtree(0) {
+        }
+
+        uint32_t number(Node<Ch> *node) {
+            if (whole && nodes.empty()) {
+                for (Node<Ch> *n : pre_order(root)) {
+                    numbers[n] = static_cast<uint32_t>(nodes.size());
+                    parents.push_back(n == root ? npos : numbers.find(n->parent())->second);
+                    nodes.push_back(n);
+                }
+                subtree = static_cast<uint32_t>(nodes.size());
             }
-            switch (*text) {
-                case ' ':
-                    cur_token = this->parse_space(text, cur_token);
+            auto it = numbers.find(node);
+            if (it != numbers.end())
+                return it->second;
+            uint32_t number = static_cast<uint32_t>(nodes.size());
+            numbers[node] = number;
+            nodes.push_back(node);
+            return number;
+        }
+        // Finds the position of node for a structural pseudo-class
+        Position position(Node<Ch> *node, ESELECTOR type) {
+            // Counting from the start does not need the siblings after node
+            bool leading_only =
+                type == SELECTOR_SUEDO_CLASS_NTH_CHILD || type == SELECTOR_SUEDO_CLASS_NTH_OF_TYPE;
+            if (!whole && leading_only)
+                return this->leading_position(node);
+            return this->sibling_position(node);
+        }
+        // Finds the positions of all the children of the parent of node at once
+        Position sibling_position(Node<Ch> *node) {
+            auto it = positions.find(node);
+            if (it != positions.end())
+                return it->second;
+            Node<Ch> *parent = node->parent();
+            if (parent == nullptr)
+                return Position{1, 1, 1, 1};
+            HashMap<String<Ch>, uint32_t> type_counts;
+            uint32_t count = 0;
+            for (Node<Ch> *child = parent->first_child(); child != nullptr;
+                 child = child->next_sibling()) {
+                if (child->type() <= Node<Ch>::NODE_ELEMENT)
+                    positions[child] = Position{++count, 0, ++type_counts[child->name()], 0};
+            }
+            for (Node<Ch> *child = parent->first_child(); child != nullptr;
+                 child = child->next_sibling()) {
+                if (child->type() <= Node<Ch>::NODE_ELEMENT) {
+                    Position &position = positions.find(child)->second;
+                    position.count = count;
+                    position.type_count = type_counts.find(child->name())->second;
+                }
+            }
+            return positions.find(node)->second;
+        }
+        // Finds the index and type index of node, leaving the counts 0, by
+        // walking back to the nearest siblings already seen
+        Position leading_position(Node<Ch> *node) {
+            auto it = leading.find(node);
+            if (it != leading.end())
+                return it->second;
+            Position position = {1, 0, 1, 0};
+            bool index_known = false;
+            for (Node<Ch> *sibling = previous_element(node); sibling != nullptr;
+                 sibling = previous_element(sibling)) {
+                bool same_type = sibling->name() == node->name();
+                auto seen = leading.find(sibling);
+                if (seen == leading.end()) {
+                    position.index += !index_known;
+                    position.type_index += same_type;
+                    continue;
+                }
+                if (!index_known)
+                    position.index += seen->second.index;
+                index_known = true;
+                if (same_type) {
+                    position.type_index += seen->second.type_index;
                     break;
+                }
+            }
+            leading[node] = position;
+            return position;
+        }
+    };
+
+    //! Builds the tokens of an expression. It runs twice: first without
+    //! tokens, only counting them and reporting errors, then writing them
+    //! into a buffer of the size counted.
+    class Parser {
+       public:
+        Parser(const char *expression, Token *tokens)
+            : m_expression(expression), m_tokens(tokens), m_count(0), m_peak(0) {
+        }
+
+        void parse() {
+            const char *text = m_expression;
+            this->parse_list(text, false, 0);
+        }
+        //! Gets the number of tokens of the comma separated complexes.
+        uint32_t count() const {
+            return m_count;
+        }
+        //! Gets the number of tokens written at most, empty alternatives
+        //! included before they were dropped.
+        uint32_t peak() const {
+            return m_peak;
+        }
+
+       private:
+        const char *m_expression;
+        Token *m_tokens;  // nullptr while counting
+        uint32_t m_count;
+        uint32_t m_peak;
+        Token m_scratch;  // stands for every token while counting
+
+        Token &at(uint32_t i) {
+            return m_tokens != nullptr ? m_tokens[i] : m_scratch;
+        }
+        uint32_t add(ESELECTOR type) {
+            Token token = {};
+            token.type = type;
+            token.end = m_count + 1;
+            token.link = npos;
+            if (m_tokens != nullptr)
+                new (m_tokens + m_count) Token(token);
+            m_peak = std::max(m_peak, m_count + 1);
+            return m_count++;
+        }
+        Span span(const char *start, const char *end) const {
+            return Span{static_cast<uint32_t>(start - m_expression),
+                        static_cast<uint32_t>(end - start)};
+        }
+        template <class Pred>
+        static const char *skip(const char *text) {
+            while (Pred::test(*text))
+                ++text;
+            return text;
+        }
+        // At most 10 code units of the text, for errors
+        static std::string excerpt(const char *text) {
+            size_t length = 0;
+            while (length < 10 && text[length] != 0)
+                ++length;
+            return std::string(text, length);
+        }
+        static bool is_name(const char *start, const char *end, const char *name) {
+            size_t length = std::strlen(name);
+            return static_cast<size_t>(end - start) == length &&
+                   internal::equal_ci(start, name, length);
+        }
+
+        // Parses comma separated complexes up to close, or the end of the
+        // expression if close is 0. Arguments of :has are relative to the
+        // element they test: they start with an empty compound, matched by
+        // that element only.
+        void parse_list(const char *&text, bool relative, char close) {
+            while (true) {
+                uint32_t complex = this->add(SELECTOR_OR);
+                // Drop empty alternatives, as in "a,"
+                if (!this->parse_complex(text, complex, relative, close))
+                    m_count = complex;
+                if (*text == ',') {
+                    ++text;
+                    continue;
+                }
+                if (*text != close)
+                    throw std::runtime_error("unexpected end of data");
+                return;
+            }
+        }
+        // Parses compounds joined by combinators, false if there are none
+        bool parse_complex(const char *&text, uint32_t complex, bool relative, char close) {
+            uint32_t compound = this->add(SELECTOR_ROOT);
+            bool empty = true;                    // compound has no simple selector
+            ESELECTOR combinator = SELECTOR_ROOT;  // none yet
+            bool spaced = false;
+            while (true) {
+                if (whitespace_pred<char>::test(*text)) {
+                    text = skip<whitespace_pred<char>>(text);
+                    spaced = true;
+                    continue;
+                }
+                if (*text == 0 || *text == ',' || (close != 0 && *text == close))
+                    break;
+                switch (*text) {
+                    case '>':
+                        combinator = SELECTOR_CHILDREN;
+                        ++text;
+                        continue;
+                    case '~':
+                        combinator = SELECTOR_SIBLING;
+                        ++text;
+                        continue;
+                    case '+':
+                        combinator = SELECTOR_SIBLING_ADJACENT;
+                        ++text;
+                        continue;
+                    case '|':
+                        throw std::runtime_error("the column combinator || is not supported");
+                    default:
+                        break;
+                }
+                // A simple selector, which starts a compound after a combinator,
+                // whitespace or the empty compound of a relative selector
+                bool anchor = empty && relative && compound == complex + 1;
+                if (combinator != SELECTOR_ROOT || (spaced && !empty) || anchor) {
+                    compound = this->add_compound(compound, combinator);
+                    empty = true;
+                }
+                this->parse_simple(text);
+                empty = false;
+                combinator = SELECTOR_ROOT;
+                spaced = false;
+            }
+            // A combinator at the end stands for an empty compound
+            if (combinator != SELECTOR_ROOT)
+                compound = this->add_compound(compound, combinator);
+            at(compound).end = m_count;
+            at(complex).link = compound;
+            at(complex).end = m_count;
+            return !empty || compound != complex + 1;
+        }
+        uint32_t add_compound(uint32_t left, ESELECTOR combinator) {
+            at(left).end = m_count;
+            uint32_t compound =
+                this->add(combinator == SELECTOR_ROOT ? SELECTOR_DESCENDANT : combinator);
+            at(compound).link = left;
+            return compound;
+        }
+        void parse_simple(const char *&text) {
+            switch (*text) {
                 case '.':
-                    cur_token = this->parse_name(text, cur_token, SELECTOR_CLASS);
+                    this->parse_name(text, SELECTOR_CLASS);
                     break;
                 case '#':
-                    cur_token = this->parse_name(text, cur_token, SELECTOR_ID);
+                    this->parse_name(text, SELECTOR_ID);
                     break;
                 case '[':
-                    cur_token = this->parse_attribute(text, cur_token);
-                    break;
-                case ',':
-                    cur_token = this->parse_symbol(text, cur_token, SELECTOR_OR);
-                    break;
-                case '>':
-                    cur_token = this->parse_symbol(text, cur_token, SELECTOR_CHILDREN);
-                    break;
-                case '~':
-                    cur_token = this->parse_symbol(text, cur_token, SELECTOR_SIBLING);
-                    break;
-                case '+':
-                    cur_token = this->parse_symbol(text, cur_token, SELECTOR_SIBLING_ADJACENT);
-                    break;
-                case '|':
-                    cur_token = this->parse_symbol(text, cur_token, SELECTOR_COL);
+                    this->parse_attribute(text);
                     break;
                 case ':':
-                    cur_token = this->ignore_suedo(text, cur_token);
+                    this->parse_pseudo(text);
                     break;
                 default:
-                    cur_token = this->parse_type(text, cur_token);
+                    this->parse_type(text);
             }
         }
-        if (cur_token->type == SELECTOR_DESCENDANT) {  // remove whitespace at end
-            cur_token = nullptr;
+
+        void parse_pseudo(const char *&text) {
+            ++text;
+            if (*text == ':') {
+                ++text;
+                const char *start = text;
+                text = skip<selector_text_pred<char>>(text);
+                at(this->add(SELECTOR_SUEDO_ELEMENT)).name = this->span(start, text);
+                return;
+            }
+            const char *start = text;
+            text = skip<selector_text_pred<char>>(text);
+            if (*text != '(') {
+                ESELECTOR type = structural_type(start, text);
+                if (type == SELECTOR_SUEDO_CLASS)
+                    throw std::runtime_error("unsupported pseudo-class :" +
+                                             std::string(start, text - start));
+                uint32_t token = this->add(type);
+                at(token).name = this->span(start, text);
+                // :first-child and the like are :nth-child(1) and the like
+                at(token).nth_offset = 1;
+                return;
+            }
+            ESELECTOR type = SELECTOR_SUEDO_CLASS;
+            if (is_name(start, text, "nth-child")) {
+                return this->parse_nth(text, SELECTOR_SUEDO_CLASS_NTH_CHILD);
+            } else if (is_name(start, text, "nth-last-child")) {
+                return this->parse_nth(text, SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD);
+            } else if (is_name(start, text, "nth-of-type")) {
+                return this->parse_nth(text, SELECTOR_SUEDO_CLASS_NTH_OF_TYPE);
+            } else if (is_name(start, text, "nth-last-of-type")) {
+                return this->parse_nth(text, SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE);
+            } else if (is_name(start, text, "is")) {
+                type = SELECTOR_SUEDO_CLASS_IS;
+            } else if (is_name(start, text, "not")) {
+                type = SELECTOR_SUEDO_CLASS_NOT;
+            } else if (is_name(start, text, "has")) {
+                type = SELECTOR_SUEDO_CLASS_HAS;
+            } else if (is_name(start, text, "where")) {
+                type = SELECTOR_SUEDO_CLASS_WHERE;
+            } else {
+                throw std::runtime_error("expected :is, :not, :where, :has, :nth-* but got " +
+                                         excerpt(text));
+            }
+            uint32_t token = this->add(type);
+            at(token).name = this->span(start, text);
+            ++text;
+            this->parse_list(text, type == SELECTOR_SUEDO_CLASS_HAS, ')');
+            ++text;
+            at(token).end = m_count;
         }
-        if (root->right.get() != nullptr) {
-            return root->right;
+        // Types of the structural pseudo-classes without an argument
+        static ESELECTOR structural_type(const char *start, const char *end) {
+            if (is_name(start, end, "first-child"))
+                return SELECTOR_SUEDO_CLASS_NTH_CHILD;
+            if (is_name(start, end, "last-child"))
+                return SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD;
+            if (is_name(start, end, "first-of-type"))
+                return SELECTOR_SUEDO_CLASS_NTH_OF_TYPE;
+            if (is_name(start, end, "last-of-type"))
+                return SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE;
+            if (is_name(start, end, "only-child"))
+                return SELECTOR_SUEDO_CLASS_ONLY_CHILD;
+            if (is_name(start, end, "only-of-type"))
+                return SELECTOR_SUEDO_CLASS_ONLY_OF_TYPE;
+            if (is_name(start, end, "empty"))
+                return SELECTOR_SUEDO_CLASS_EMPTY;
+            return SELECTOR_SUEDO_CLASS;
+        }
+        // Parses the An+B argument of :nth-child and the like: odd, even, an
+        // integer, or an integer or sign before n, optionally followed by a
+        // signed integer.
+        void parse_nth(const char *&text, ESELECTOR type) {
+            ++text;
+            const char *end = text;
+            while (*end != ')') {
+                if (*end == 0)
+                    throw std::runtime_error("unexpected end of data");
+                ++end;
+            }
+            // Without whitespace, lowercase
+            char argument[32];
+            size_t length = 0;
+            for (const char *c = text; c < end; ++c) {
+                if (whitespace_pred<char>::test(*c))
+                    continue;
+                if (length + 1 == sizeof(argument))
+                    throw std::runtime_error("expected An+B but got " + std::string(text, end));
+                argument[length++] = internal::lower_char(*c);
+            }
+            argument[length] = 0;
+            long step = 0;
+            long offset = 0;
+            if (is_name(argument, argument + length, "odd")) {
+                step = 2;
+                offset = 1;
+            } else if (is_name(argument, argument + length, "even")) {
+                step = 2;
+            } else {
+                const char *n = std::strchr(argument, 'n');
+                char *stop = nullptr;
+                bool valid;
+                if (n == nullptr) {
+                    offset = std::strtol(argument, &stop, 10);
+                    valid = length != 0 && stop == argument + length;
+                } else {
+                    if (n == argument || is_name(argument, n, "+"))
+                        step = 1;
+                    else if (is_name(argument, n, "-"))
+                        step = -1;
+                    else
+                        step = std::strtol(argument, &stop, 10);
+                    valid = stop == nullptr || stop == n;
+                    const char *rest = n + 1;
+                    if (*rest != 0) {
+                        offset = std::strtol(rest, &stop, 10);
+                        valid = valid && (*rest == '+' || *rest == '-') && rest[1] != 0 &&
+                                stop == argument + length;
+                    }
+                }
+                if (!valid)
+                    throw std::runtime_error("expected An+B but got " + std::string(text, end));
+            }
+            uint32_t token = this->add(type);
+            at(token).name = this->span(text, end);
+            at(token).nth_step = static_cast<int>(step);
+            at(token).nth_offset = static_cast<int>(offset);
+            text = end + 1;
+        }
+
+        void parse_type(const char *&text) {
+            const char *start = text;
+            if (*text == '*')
+                ++text;
+            else
+                text = skip<selector_text_pred<char>>(text);
+            if (text == start) {
+                throw std::runtime_error("expected parseable text here: " + excerpt(text));
+            }
+            at(this->add(SELECTOR_TYPE)).name = this->span(start, text);
         }
-        return root;
-    }
 
-    std::shared_ptr<Token> ignore_suedo(char *&text, std::shared_ptr<Token> prev_token) {
-        ++text;
-        char *start = text;
-        if (*text == ':') {
+        void parse_name(const char *&text, ESELECTOR type) {
             ++text;
-            start = text;
-            Text<char>::template skip<selector_text_pred<char>>(text);
-            std::string name(start, text - start);
-            auto token = std::make_shared<Token>(SELECTOR_SUEDO_ELEMENT);
-            token->name = name;
-            prev_token->right = token;
-            token->left = prev_token;
-            return token;
-        }
-        Text<char>::template skip<selector_text_pred<char>>(text);
-        if (*text != '(') {
-            std::string name(start, text - start);
-            auto token = std::make_shared<Token>(SELECTOR_SUEDO_CLASS);
-            token->name = name;
-            prev_token->right = token;
-            token->left = prev_token;
-            return token;
-        }
-        String<char> name(start, text - start);
-        name.to_lowercase();
-        ESELECTOR type = SELECTOR_SUEDO_CLASS;
-        if (name == String<char>("is", 2)) {
-            type = SELECTOR_SUEDO_CLASS_IS;
-        } else if (name == String<char>("not", 3)) {
-            type = SELECTOR_SUEDO_CLASS_NOT;
-        } else if (name == String<char>("has", 3)) {
-            type = SELECTOR_SUEDO_CLASS_HAS;
-        } else if (name == String<char>("where", 5)) {
-            type = SELECTOR_SUEDO_CLASS_WHERE;
-        } else {
-            throw std::runtime_error(std::string("expected :is, :not, :where, :has but got ") +
-                                     std::string(text, 10));
-        }
-        auto token = std::make_shared<Token>(type);
-        ++text;
-        start = text;
-        size_t paren_count = 1;
-        while (paren_count > 0) {
+            if (*text == 0) {
+                throw std::runtime_error("unexpected end of data");
+            }
+            const char *start = text;
+            text = skip<selector_text_pred<char>>(text);
+            if (text == start) {
+                throw std::runtime_error("expected parseable text here: " + excerpt(text));
+            }
+            at(this->add(type)).name = this->span(start, text);
+        }
+
+        void parse_attribute(const char *&text) {
             ++text;
+            text = skip<whitespace_pred<char>>(text);
             if (*text == 0) {
                 throw std::runtime_error("unexpected end of data");
             }
-            if (*text == ')' && *(text - 1) != '\\') {
-                --paren_count;
-            } else if (*text == '(' && *(text - 1) != '\\') {
-                ++paren_count;
+            if (*text == '=') {
+                throw std::runtime_error("expected parseable text here but got '=': " +
+                                         excerpt(text));
+            }
+            // The name ends before whitespace, an operator or the end of the brackets
+            const char *start = text;
+            while (attribute_name_pred<char>::test(*text) &&
+                   std::strchr("~|^$*]", *text) == nullptr)
+                ++text;
+            if (text == start) {
+                throw std::runtime_error("expected parseable text here: " + excerpt(text));
+            }
+            uint32_t token = this->add(SELECTOR_ATTRIBUTE);
+            at(token).name = this->span(start, text);
+            text = skip<whitespace_pred<char>>(text);
+            ATT_OP op = ATT_OP_EQUALS;
+            if (*text != '=' && *text != ']') {
+                switch (*text) {
+                    case '~':
+                        op = ATT_OP_ONE_EQUALS;
+                        break;
+                    case '|':
+                        op = ATT_OP_HYPHEN;
+                        break;
+                    case '^':
+                        op = ATT_OP_PREFIX;
+                        break;
+                    case '$':
+                        op = ATT_OP_SUFFIX;
+                        break;
+                    case '*':
+                        op = ATT_OP_CONTAINS;
+                        break;
+                    default:
+                        this->expect_end(text);
+                }
+                ++text;
+                if (*text != '=')
+                    this->expect_end(text);
+            }
+            if (*text == '=') {
+                ++text;
+                text = skip<whitespace_pred<char>>(text);
+                const char *value = text;
+                if (*text == '"' || *text == '\'') {
+                    ++value;
+                    text = *text == '"' ? skip<attribute_value_pred<char, char('"')>>(value)
+                                        : skip<attribute_value_pred<char, char('\'')>>(value);
+                    at(token).value = this->span(value, text);
+                    if (*text != 0)
+                        ++text;
+                } else {
+                    while (*text != 0 && *text != ']' && !whitespace_pred<char>::test(*text))
+                        ++text;
+                    at(token).value = this->span(value, text);
+                }
+                // An empty unquoted value, as in [name=], only asks for the name
+                at(token).op = text == value ? ATT_OP_HAS : op;
+                // [name=value i] compares the value case-insensitively
+                text = skip<whitespace_pred<char>>(text);
+                if (*text == 'i' || *text == 'I' || *text == 's' || *text == 'S') {
+                    at(token).case_insensitive = *text == 'i' || *text == 'I';
+                    ++text;
+                    text = skip<whitespace_pred<char>>(text);
+                }
             }
+            this->expect_end(text);
+            ++text;  // advance past ']'
         }
-        std::string expression(start, text - start);
-        Selector selector(expression);
-        token->sub = selector.m_ptoken;
-        prev_token->right = token;
-        token->left = prev_token;
-        ++text;
-        return token;
+        static void expect_end(const char *text) {
+            if (*text == 0)
+                throw std::runtime_error("unexpected end of data");
+            if (*text != ']')
+                throw std::runtime_error("expected ] but got " + excerpt(text));
+        }
+    };
+
+   public:
+    //! Initiatizes the local expression string
+    //! \param expression CSS expression to parse as a string.
+    Selector(const std::string &expression) : Selector(expression.c_str()) {
+    }
+    //! Initiatizes the local expression string
+    //! \param expression CSS expression to parse as a c-string.
+    Selector(const char *expression) : m_filtered(false), m_memoized(false) {
+        Parser counter(expression, nullptr);
+        counter.parse();
+        // A key per simple selector at most
+        size_t capacity = counter.peak();
+        size_t length = std::strlen(expression);
+        m_keys_offset = capacity * sizeof(Token);
+        m_text_offset = m_keys_offset + capacity * sizeof(uint32_t);
+        m_size = m_text_offset + length + 1;
+        m_buffer.reset(new char[m_size]);
+        std::memcpy(m_buffer.get() + m_text_offset, expression, length + 1);
+        Parser writer(m_buffer.get() + m_text_offset, this->tokens());
+        writer.parse();
+        m_count = writer.count();
+        uint32_t key_count = 0;
+        m_memoized = this->annotate(0, m_count, true, key_count);
+        m_filtered = key_count != 0;
     }
+    //! Copies a selector, the tokens and the expression at once.
+    Selector(const Selector &other)
+        : m_buffer(new char[other.m_size]),
+          m_size(other.m_size),
+          m_count(other.m_count),
+          m_keys_offset(other.m_keys_offset),
+          m_text_offset(other.m_text_offset),
+          m_filtered(other.m_filtered),
+          m_memoized(other.m_memoized) {
+        std::memcpy(m_buffer.get(), other.m_buffer.get(), m_size);
+    }
+    Selector(Selector &&) = default;
+    Selector &operator=(const Selector &other) {
+        if (this != &other)
+            *this = Selector(other);
+        return *this;
+    }
+    Selector &operator=(Selector &&) = default;
 
-    std::shared_ptr<Token> parse_symbol(char *&text,
-                                        std::shared_ptr<Token> prev_token,
-                                        ESELECTOR type) {
-        ++text;
-        if (*text == '|') {
-            ++text;
+    //! Determines whether a \ref Node matches.
+    //! \param node the \ref Node to test.
+    //! \return whether node matches any of the comma separated selectors.
+    template <class Ch>
+    bool match(Node<Ch> *node) const {
+        return this->match_any(0, m_count, node, static_cast<Node<Ch> *>(nullptr),
+                               static_cast<Memo<Ch> *>(nullptr));
+    }
+    //! Finds the \ref Node s under a root that match.
+    //! Combinators may reach above root, as with querySelectorAll, and a
+    //! selector starting with a combinator, like "> p", is relative to root.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    template <class Ch>
+    void select_all(Node<Ch> *root, std::vector<Node<Ch> *> &results) const {
+        this->select(root, &results, std::numeric_limits<size_t>::max());
+    }
+    //! Finds the first \ref Node s under a root that match, stopping the walk
+    //! at the limit.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \param limit most \ref Node s to find.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    template <class Ch>
+    void select_n(Node<Ch> *root, size_t limit, std::vector<Node<Ch> *> &results) const {
+        if (limit != 0)
+            this->select(root, &results, limit);
+    }
+    //! Finds the first \ref Node under a root that matches.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \return first matching \ref Node in document order, nullptr if none.
+    template <class Ch>
+    Node<Ch> *select_first(Node<Ch> *root) const {
+        return this->select(root, static_cast<std::vector<Node<Ch> *> *>(nullptr), 1);
+    }
+    //! Determines whether a \ref Node under a root matches.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \return whether \ref select_first finds a \ref Node.
+    template <class Ch>
+    bool exists(Node<Ch> *root) const {
+        return this->select_first(root) != nullptr;
+    }
+
+   private:
+    Token *tokens() {
+        return reinterpret_cast<Token *>(m_buffer.get());
+    }
+    const Token &token(uint32_t i) const {
+        return reinterpret_cast<const Token *>(m_buffer.get())[i];
+    }
+    String<char> text(const Span &span) const {
+        return String<char>(m_buffer.get() + m_text_offset + span.offset, span.length);
+    }
+    const uint32_t *keys(const Token &complex) const {
+        return reinterpret_cast<const uint32_t *>(m_buffer.get() + m_keys_offset) +
+               complex.keys.offset;
+    }
+    bool is_universal(const Token &token) const {
+        return token.type == SELECTOR_TYPE && token.name.length == 1 &&
+               this->text(token.name)[0] == '*';
+    }
+
+    // Walks the descendants of root, appending the matches to results, or
+    // returning the first if results is nullptr, until limit are found.
+    // An AncestorFilter skips the complexes whose ancestors are missing
+    // without walking up, and a Memo keeps the answers of pseudo-classes for
+    // the walk.
+    template <class Ch>
+    Node<Ch> *select(Node<Ch> *root, std::vector<Node<Ch> *> *results, size_t limit) const {
+        AncestorFilter<Ch> filter;
+        if (m_filtered)
+            filter.reset(root);
+        // Only a walk that cannot stop early pays for answering whole subtrees
+        Memo<Ch> memo(root, limit == std::numeric_limits<size_t>::max());
+        Memo<Ch> *kept = m_memoized ? &memo : nullptr;
+        auto range = pre_order(root);
+        auto it = range.begin();
+        for (++it; it != range.end(); ++it) {
+            if (m_filtered)
+                filter.advance(*it);
+            for (uint32_t i = 0; i < m_count; i = this->token(i).end) {
+                const Token &complex = this->token(i);
+                // Without ancestor keys the filter passes everything
+                if (!filter.may_contain_all(this->keys(complex), complex.keys.length) ||
+                    !this->match_from(complex.link, *it, root, kept))
+                    continue;
+                if (results == nullptr)
+                    return *it;
+                results->push_back(*it);
+                if (--limit == 0)
+                    return *it;
+                break;
+            }
         }
-        if (prev_token->type == SELECTOR_DESCENDANT) {
-            prev_token->type = type;
+        return nullptr;
+    }
+
+    // Sets how the pseudo-classes of the complexes in [first, end) keep
+    // their answers, and with keyed set collects the ancestor keys of each.
+    // Returns whether some answer is kept.
+    bool annotate(uint32_t first, uint32_t end, bool keyed, uint32_t &key_count) {
+        Token *tokens = this->tokens();
+        bool memoized = false;
+        for (uint32_t complex = first; complex < end; complex = tokens[complex].end) {
+            tokens[complex].keys = Span{key_count, 0};
+            for (uint32_t compound = complex + 1; compound < tokens[complex].end;
+                 compound = tokens[compound].end) {
+                for (uint32_t simple = compound + 1; simple < tokens[compound].end;
+                     simple = tokens[simple].end) {
+                    Token &token = tokens[simple];
+                    if (is_structural(token.type)) {
+                        token.memo = MEMO_POSITION;
+                    } else if (simple + 1 < token.end) {
+                        uint32_t unused = 0;
+                        memoized = this->annotate(simple + 1, token.end, false, unused) ||
+                                   memoized;
+                        token.memo = this->memo_of(simple);
+                    }
+                    memoized = memoized || token.memo != MEMO_NONE;
+                }
+                if (keyed && compound != tokens[complex].link)
+                    this->ancestor_keys(compound, tokens[compound].end, key_count);
+            }
+            tokens[complex].keys.length = key_count - tokens[complex].keys.offset;
         }
-        return prev_token;
+        return memoized;
+    }
+    // Collects the keys of a compound that must match an ancestor of the
+    // rightmost one: one left of a descendant or child combinator. One left
+    // of a sibling combinator matches a sibling of an ancestor instead.
+    // Keys that are not ASCII are left out, as they may be encoded unlike
+    // the document.
+    void ancestor_keys(uint32_t compound, uint32_t right, uint32_t &key_count) {
+        typedef AncestorFilter<char> filter;
+        ESELECTOR combinator = this->token(right).type;
+        if (combinator != SELECTOR_DESCENDANT && combinator != SELECTOR_CHILDREN)
+            return;
+        uint32_t *keys = reinterpret_cast<uint32_t *>(m_buffer.get() + m_keys_offset);
+        for (uint32_t simple = compound + 1; simple < right; simple = this->token(simple).end) {
+            const Token &token = this->token(simple);
+            String<char> name = this->text(token.name);
+            bool ascii = true;
+            for (size_t i = 0; i < name.length(); ++i)
+                ascii = ascii && static_cast<unsigned char>(name[i]) < 0x80;
+            if (!ascii)
+                continue;
+            if (token.type == SELECTOR_TYPE && !this->is_universal(token))
+                keys[key_count++] = filter::hash(filter::KIND_TYPE, name.data(), name.length());
+            else if (token.type == SELECTOR_CLASS)
+                keys[key_count++] = filter::hash(filter::KIND_CLASS, name.data(), name.length());
+            else if (token.type == SELECTOR_ID)
+                keys[key_count++] = filter::hash(filter::KIND_ID, name.data(), name.length());
+        }
+    }
+    // Keeping answers pays when arguments walk the tree: :has always does,
+    // :is, :not and :where when an argument has a combinator
+    MEMO memo_of(uint32_t simple) const {
+        const Token &token = this->token(simple);
+        bool complex_argument = false;
+        bool siblings = false;
+        for (uint32_t complex = simple + 1; complex < token.end;
+             complex = this->token(complex).end) {
+            complex_argument = complex_argument || this->token(complex).link != complex + 1;
+            for (uint32_t compound = this->token(complex + 1).end;
+                 compound < this->token(complex).end; compound = this->token(compound).end) {
+                ESELECTOR combinator = this->token(compound).type;
+                siblings = siblings || combinator == SELECTOR_SIBLING ||
+                           combinator == SELECTOR_SIBLING_ADJACENT;
+            }
+        }
+        if (token.type == SELECTOR_SUEDO_CLASS_HAS)
+            return siblings ? MEMO_LAZY : MEMO_HAS;
+        return complex_argument ? MEMO_LAZY : MEMO_NONE;
+    }
+    static bool is_structural(ESELECTOR type) {
+        return type >= SELECTOR_SUEDO_CLASS_NTH_CHILD && type <= SELECTOR_SUEDO_CLASS_EMPTY;
     }
 
-    std::shared_ptr<Token> parse_space(char *&text, std::shared_ptr<Token> prev_token) {
-        Text<char>::template skip<whitespace_pred<char>>(text);
-        switch (prev_token->type) {
-            case SELECTOR_OR:
+    template <class Ch>
+    static bool is_element(Node<Ch> *node) {
+        return node->type() <= Node<Ch>::NODE_ELEMENT;
+    }
+    template <class Ch>
+    static Node<Ch> *previous_element(Node<Ch> *node) {
+        do {
+            node = node->previous_sibling();
+        } while (node != nullptr && !is_element(node));
+        return node;
+    }
+
+    // Matches the complexes in [first, end)
+    template <class Ch>
+    bool match_any(uint32_t first,
+                   uint32_t end,
+                   Node<Ch> *node,
+                   Node<Ch> *scope,
+                   Memo<Ch> *memo) const {
+        for (uint32_t complex = first; complex < end; complex = this->token(complex).end) {
+            if (this->match_from(this->token(complex).link, node, scope, memo))
+                return true;
+        }
+        return false;
+    }
+    // Matches a compound on node and the compounds on its left
+    template <class Ch>
+    bool match_from(uint32_t compound, Node<Ch> *node, Node<Ch> *scope, Memo<Ch> *memo) const {
+        if (!this->match_compound(compound, node, scope, memo))
+            return false;
+        uint32_t left = this->token(compound).link;
+        if (left == npos)
+            return true;
+        switch (this->token(compound).type) {
             case SELECTOR_DESCENDANT:
+                for (Node<Ch> *parent = node->parent(); parent != nullptr;
+                     parent = parent->parent()) {
+                    if (this->match_from(left, parent, scope, memo))
+                        return true;
+                }
+                return false;
             case SELECTOR_CHILDREN:
+                return node->parent() != nullptr &&
+                       this->match_from(left, node->parent(), scope, memo);
             case SELECTOR_SIBLING:
-            case SELECTOR_SIBLING_ADJACENT:
-            case SELECTOR_COL:
-                return prev_token;
+                for (Node<Ch> *sibling = previous_element(node); sibling != nullptr;
+                     sibling = previous_element(sibling)) {
+                    if (this->match_from(left, sibling, scope, memo))
+                        return true;
+                }
+                return false;
+            case SELECTOR_SIBLING_ADJACENT: {
+                Node<Ch> *sibling = previous_element(node);
+                return sibling != nullptr && this->match_from(left, sibling, scope, memo);
+            }
             default:
-                break;
+                return false;
         }
-        auto token = std::make_shared<Token>(SELECTOR_DESCENDANT);
-        prev_token->right = token;
-        token->left = prev_token;
-        return token;
     }
-
-    std::shared_ptr<Token> parse_type(char *&text, std::shared_ptr<Token> prev_token) {
-        char *start = text;
-        Text<char>::template skip<selector_text_pred<char>>(text);
-        if (text == start) {
-            throw std::runtime_error(std::string("expected parseable text here: ") +
-                                     std::string(text, 10));
-        }
-        std::string name(start, text - start);
-        auto token = std::make_shared<Token>(SELECTOR_TYPE);
-        token->name = name;
-        prev_token->right = token;
-        token->left = prev_token;
-        return token;
+    template <class Ch>
+    bool match_compound(uint32_t compound,
+                        Node<Ch> *node,
+                        Node<Ch> *scope,
+                        Memo<Ch> *memo) const {
+        uint32_t end = this->token(compound).end;
+        // An empty compound only stands for the root of a relative selector
+        if (compound + 1 == end)
+            return node == scope;
+        if (!is_element(node))
+            return false;
+        for (uint32_t simple = compound + 1; simple < end; simple = this->token(simple).end) {
+            if (!this->match_simple(simple, node, memo))
+                return false;
+        }
+        return true;
     }
-
-    std::shared_ptr<Token> parse_name(char *&text,
-                                      std::shared_ptr<Token> prev_token,
-                                      ESELECTOR type) {
-        ++text;
-        if (*text == 0) {
-            throw std::runtime_error("unexpected end of data");
-        }
-        char *start = text;
-        Text<char>::template skip<selector_text_pred<char>>(text);
-        if (text == start) {
-            throw std::runtime_error(std::string("expected parseable text here: ") +
-                                     std::string(text, 10));
-        }
-        std::string name(start, text - start);
-        auto token = std::make_shared<Token>(type);
-        token->name = name;
-        prev_token->right = token;
-        token->left = prev_token;
-        return token;
+    template <class Ch>
+    bool match_simple(uint32_t simple, Node<Ch> *node, Memo<Ch> *memo) const {
+        const Token &token = this->token(simple);
+        switch (token.type) {
+            case SELECTOR_TYPE:
+                return this->is_universal(token) ||
+                       equal_text(node->name(), this->text(token.name), true);
+            case SELECTOR_CLASS:
+                for (auto it = node->class_begin(); it != node->class_end(); ++it) {
+                    if (equal_text(*it, this->text(token.name), false))
+                        return true;
+                }
+                return false;
+            case SELECTOR_ID:
+                return equal_text(node->id(), this->text(token.name), false);
+            case SELECTOR_ATTRIBUTE:
+                for (auto it = node->attribute_begin(); it != node->attribute_end(); ++it) {
+                    if (equal_text(it->first, this->text(token.name), true))
+                        return match_value(token.op, this->text(token.value),
+                                           token.case_insensitive, it->second);
+                }
+                return false;
+            case SELECTOR_SUEDO_CLASS_IS:
+            case SELECTOR_SUEDO_CLASS_WHERE:
+            case SELECTOR_SUEDO_CLASS_NOT:
+            case SELECTOR_SUEDO_CLASS_HAS:
+                if (memo != nullptr && token.memo != MEMO_NONE)
+                    return this->match_memoized(simple, node, *memo);
+                return this->match_pseudo(simple, node, memo);
+            case SELECTOR_SUEDO_CLASS_NTH_CHILD:
+            case SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD:
+            case SELECTOR_SUEDO_CLASS_NTH_OF_TYPE:
+            case SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE:
+            case SELECTOR_SUEDO_CLASS_ONLY_CHILD:
+            case SELECTOR_SUEDO_CLASS_ONLY_OF_TYPE:
+                return match_position(token.type, token.nth_step, token.nth_offset,
+                                      memo != nullptr ? memo->position(node, token.type)
+                                                      : position_of(node));
+            case SELECTOR_SUEDO_CLASS_EMPTY:
+                return is_empty(node);
+            default:
+                // Pseudo-elements are not in the tree
+                return false;
+        }
     }
-
-    std::shared_ptr<Token> parse_attribute(char *&text, std::shared_ptr<Token> prev_token) {
-        ++text;
-        if (*text == 0) {
-            throw std::runtime_error("unexpected end of data");
+    static bool match_position(ESELECTOR type, int step, int offset, const Position &position) {
+        switch (type) {
+            case SELECTOR_SUEDO_CLASS_NTH_CHILD:
+                return nth(step, offset, position.index);
+            case SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD:
+                return nth(step, offset, position.count - position.index + 1);
+            case SELECTOR_SUEDO_CLASS_NTH_OF_TYPE:
+                return nth(step, offset, position.type_index);
+            case SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE:
+                return nth(step, offset, position.type_count - position.type_index + 1);
+            case SELECTOR_SUEDO_CLASS_ONLY_CHILD:
+                return position.count == 1;
+            default:
+                return position.type_count == 1;
         }
-        Text<char>::template skip<whitespace_pred<char>>(text);
-
-        char *start = text;
-        Text<char>::template skip<target_or_end_pred<char, char(']')>>(text);
-        if (text == start) {
-            throw std::runtime_error(std::string("expected parseable text here: ") +
-                                     std::string(text, 10));
-        }
-        auto token = std::make_shared<Token>(SELECTOR_ATTRIBUTE);
-        String<char> s(start, text - start);
-        ++text;  // advance past ']'
-        if (s[0] == '=') {
-            throw std::runtime_error(std::string("expected parseable text here but got '=': ") +
-                                     std::string(text, 10));
-        }
-        size_t eq_loc = s.length();
-        for (size_t i = 1; i < s.length(); ++i) {
-            if (s[i] == '=') {
-                eq_loc = i;
-                break;
+    }
+    // Is index, from 1, A * n + B for some n >= 0?
+    static bool nth(long step, long offset, uint32_t index) {
+        long rest = static_cast<long>(index) - offset;
+        if (step == 0)
+            return rest == 0;
+        return rest % step == 0 && rest / step >= 0;
+    }
+    // Finds the position of an element by walking its siblings, without a Memo
+    template <class Ch>
+    static Position position_of(Node<Ch> *node) {
+        Position position = {1, 1, 1, 1};
+        if (node->parent() == nullptr)
+            return position;
+        position = Position{0, 0, 0, 0};
+        String<Ch> name = node->name();
+        bool before = true;
+        for (Node<Ch> *child = node->parent()->first_child(); child != nullptr;
+             child = child->next_sibling()) {
+            if (!is_element(child))
+                continue;
+            bool same_type = child->name() == name;
+            ++position.count;
+            position.type_count += same_type;
+            if (before) {
+                ++position.index;
+                position.type_index += same_type;
             }
+            before = before && child != node;
         }
-        if (eq_loc >= s.length() - 1) {
-            char *end = start;
-            Text<char>::template skip<attribute_name_pred<char>>(end);
-            std::string name(start, end - start);
-            token->name = name;
-            prev_token->right = token;
-            token->left = prev_token;
-            return token;
+        return position;
+    }
+    // Comments and processing instructions do not count. Text may be in data
+    // children or, without them, in the value of the element.
+    template <class Ch>
+    static bool is_empty(Node<Ch> *node) {
+        if (!node->value().empty())
+            return false;
+        for (Node<Ch> *child = node->first_child(); child != nullptr;
+             child = child->next_sibling()) {
+            if (is_element(child))
+                return false;
+            if ((child->type() == Node<Ch>::NODE_DATA || child->type() == Node<Ch>::NODE_CDATA) &&
+                !child->value().empty())
+                return false;
         }
-
-        char *val_start = start + eq_loc + 1;
-        char *end = val_start;
-        Text<char>::template skip<whitespace_pred<char>>(val_start);
-        if (*val_start == '"') {
-            ++val_start;
-            end = val_start;
-            Text<char>::template skip<attribute_value_pred<char, char('"')>>(end);
-        } else if (*val_start == '\'') {
-            ++val_start;
-            end = val_start;
-            Text<char>::template skip<attribute_value_pred<char, char('\'')>>(end);
-        } else {
-            end = val_start;
-            Text<char>::template skip<text_pred<char>>(end);
-        }
-        std::string value(val_start, end - val_start);
-        token->value = value;
-        switch (s[eq_loc - 1]) {
-            case '~':
-                token->op = ATT_OP_ONE_EQUALS;
-                break;
-            case '|':
-                token->op = ATT_OP_HYPHEN;
-                break;
-            case '^':
-                token->op = ATT_OP_PREFIX;
-                break;
-            case '$':
-                token->op = ATT_OP_SUFFIX;
-                break;
-            case '*':
-                token->op = ATT_OP_CONTAINS;
-                break;
+        return true;
+    }
+    template <class Ch>
+    bool match_pseudo(uint32_t simple, Node<Ch> *node, Memo<Ch> *memo) const {
+        const Token &token = this->token(simple);
+        switch (token.type) {
+            case SELECTOR_SUEDO_CLASS_NOT:
+                return !this->match_any(simple + 1, token.end, node,
+                                        static_cast<Node<Ch> *>(nullptr), memo);
+            case SELECTOR_SUEDO_CLASS_HAS:
+                return this->match_has(simple + 1, token.end, node, memo);
             default:
-                token->op = ATT_OP_EQUALS;
-        }
-        end = start;
-        Text<char>::template skip<attribute_name_pred<char>>(end);
-        std::string name(start, end - start);
-        token->name = name;
-        prev_token->right = token;
-        token->left = prev_token;
-        return token;
+                return this->match_any(simple + 1, token.end, node,
+                                       static_cast<Node<Ch> *>(nullptr), memo);
+        }
+    }
+    template <class Ch>
+    bool match_memoized(uint32_t simple, Node<Ch> *node, Memo<Ch> &memo) const {
+        const Token *token = &this->token(simple);
+        uint32_t number = memo.number(node);
+        auto slot = memo.slots.find(token);
+        if (slot == memo.slots.end()) {
+            memo.slots[token] = memo.answers.size();
+            // The deque keeps answers in place while nested pseudo-classes add theirs
+            memo.answers.emplace_back(memo.nodes.size(), uint8_t(0));
+            if (token->memo == MEMO_HAS && memo.whole)
+                this->has_bottom_up(simple, memo, memo.answers.back());
+            slot = memo.slots.find(token);
+        }
+        std::vector<uint8_t> &answers = memo.answers[slot->second];
+        // Nodes numbered since the slot was made
+        if (answers.size() <= number)
+            answers.resize(memo.nodes.size(), uint8_t(0));
+        if (answers[number] == 0)
+            answers[number] = this->match_pseudo(simple, node, &memo) ? 2 : 1;
+        return answers[number] == 2;
+    }
+    // Answers :has for every Node of the subtree in one pass, children before parents.
+    // For a relative selector with compounds 1..k, below[i] tells whether
+    // a descendant of a Node matches compounds i..k, the one on the left
+    // of each an ancestor of the one on its right, and beneath[i] whether
+    // a child does; a Node matches compound i and the rest if it matches
+    // the compound and has the descendant or child needed for i + 1.
+    template <class Ch>
+    void has_bottom_up(uint32_t simple, Memo<Ch> &memo, std::vector<uint8_t> &answers) const {
+        size_t count = memo.subtree;
+        std::fill(answers.begin(), answers.begin() + count, uint8_t(1));
+        for (uint32_t complex = simple + 1; complex < this->token(simple).end;
+             complex = this->token(complex).end) {
+            std::vector<uint32_t> compounds;
+            for (uint32_t compound = complex + 1; compound < this->token(complex).end;
+                 compound = this->token(compound).end)
+                compounds.push_back(compound);
+            size_t k = compounds.size() - 1;
+            std::vector<std::vector<uint8_t>> below(k + 1, std::vector<uint8_t>(count, 0));
+            std::vector<std::vector<uint8_t>> beneath(k + 1, std::vector<uint8_t>(count, 0));
+            for (size_t j = count; j-- > 0;) {
+                uint32_t parent = memo.parents[j];
+                for (size_t i = k; i >= 1; --i) {
+                    bool rest =
+                        i == k || (this->token(compounds[i + 1]).type == SELECTOR_DESCENDANT
+                                       ? below[i + 1][j]
+                                       : beneath[i + 1][j]);
+                    bool matches =
+                        rest && this->match_compound(compounds[i], memo.nodes[j],
+                                                     static_cast<Node<Ch> *>(nullptr), &memo);
+                    if (parent != Memo<Ch>::npos) {
+                        below[i][parent] |= static_cast<uint8_t>(matches || below[i][j]);
+                        beneath[i][parent] |= static_cast<uint8_t>(matches);
+                    }
+                }
+            }
+            bool descendant = this->token(compounds[1]).type == SELECTOR_DESCENDANT;
+            for (size_t j = 0; j < count; ++j) {
+                if (descendant ? below[1][j] : beneath[1][j])
+                    answers[j] = 2;
+            }
+        }
+    }
+    // Relative selectors reach the descendants of node, and with a sibling
+    // combinator the following siblings and their descendants
+    template <class Ch>
+    bool match_has(uint32_t first, uint32_t end, Node<Ch> *node, Memo<Ch> *memo) const {
+        bool siblings = false;
+        for (uint32_t complex = first; complex < end; complex = this->token(complex).end) {
+            ESELECTOR combinator = this->token(this->token(complex + 1).end).type;
+            siblings = siblings || combinator == SELECTOR_SIBLING ||
+                       combinator == SELECTOR_SIBLING_ADJACENT;
+        }
+        Node<Ch> *last = node;
+        if (siblings) {
+            while (last->next_sibling() != nullptr)
+                last = last->next_sibling();
+        }
+        for (Node<Ch> *candidate = node; candidate != nullptr;) {
+            // Next in pre-order, not leaving the subtree of last
+            if (candidate->first_child() != nullptr) {
+                candidate = candidate->first_child();
+            } else {
+                while (candidate != last && candidate->next_sibling() == nullptr)
+                    candidate = candidate->parent();
+                if (candidate == last)
+                    break;
+                candidate = candidate->next_sibling();
+            }
+            if (this->match_any(first, end, candidate, node, memo))
+                return true;
+        }
+        return false;
+    }
+    template <class Ch>
+    static bool match_value(ATT_OP op,
+                            const String<char> &pattern,
+                            bool ci,
+                            const String<Ch> &value) {
+        switch (op) {
+            case ATT_OP_HAS:
+                return true;
+            case ATT_OP_EQUALS:
+                return equal_text(value, pattern, ci);
+            case ATT_OP_ONE_EQUALS: {
+                if (pattern.empty())
+                    return false;
+                for (size_t i = 0; i < pattern.length(); ++i) {
+                    if (whitespace_pred<char>::test(pattern[i]))
+                        return false;
+                }
+                size_t i = 0;
+                while (i < value.length()) {
+                    while (i < value.length() && whitespace_pred<Ch>::test(value[i]))
+                        ++i;
+                    size_t start = i;
+                    while (i < value.length() && !whitespace_pred<Ch>::test(value[i]))
+                        ++i;
+                    if (i - start == pattern.length() && text_at(value, start, pattern, ci))
+                        return true;
+                }
+                return false;
+            }
+            case ATT_OP_HYPHEN:
+                return text_at(value, 0, pattern, ci) &&
+                       (value.length() == pattern.length() || value[pattern.length()] == Ch('-'));
+            case ATT_OP_PREFIX:
+                return !pattern.empty() && text_at(value, 0, pattern, ci);
+            case ATT_OP_SUFFIX:
+                return !pattern.empty() && value.length() >= pattern.length() &&
+                       text_at(value, value.length() - pattern.length(), pattern, ci);
+            case ATT_OP_CONTAINS:
+                if (pattern.empty())
+                    return false;
+                for (size_t i = 0; i + pattern.length() <= value.length(); ++i) {
+                    if (text_at(value, i, pattern, ci))
+                        return true;
+                }
+                return false;
+        }
+        return false;
+    }
+    // Compares selector text with the text at an offset of a \ref String
+    template <class Ch>
+    static bool text_at(const String<Ch> &text,
+                        size_t offset,
+                        const String<char> &pattern,
+                        bool ci) {
+        if (offset + pattern.length() > text.length())
+            return false;
+        for (size_t i = 0; i < pattern.length(); ++i) {
+            Ch lhs = text[offset + i];
+            Ch rhs = static_cast<Ch>(static_cast<unsigned char>(pattern[i]));
+            if (lhs != rhs && (!ci || internal::lower_char(lhs) != internal::lower_char(rhs)))
+                return false;
+        }
+        return true;
+    }
+    template <class Ch>
+    static bool equal_text(const String<Ch> &text, const String<char> &pattern, bool ci) {
+        return text.length() == pattern.length() && text_at(text, 0, pattern, ci);
     }
 };
 }  // namespace nvparsehtml
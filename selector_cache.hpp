@@ -0,0 +1,169 @@
+#ifndef NVPARSE_SELECTORCACHE_HPP_INCLUDED
+#define NVPARSE_SELECTORCACHE_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hash_map.hpp"
+#include "selector.hpp"
+#include "string.hpp"
+
+namespace nvparsehtml {
+//! Responsible for parsing each selector expression once and sharing the
+//! \ref Selector between the threads that query with it.
+//! Expressions map to immutable selectors in a bounded table split into
+//! shards by hash, each behind its own mutex, so lookups of different
+//! expressions rarely wait for each other. A full shard evicts with the
+//! CLOCK algorithm: its hand clears the reference bit of the entries looked
+//! up since it last passed them and evicts the first one without it.
+//! Evicted selectors stay valid for whoever still holds them.
+class SelectorCache {
+   public:
+    typedef std::shared_ptr<const Selector> selector_ptr;
+
+    //! Creates an empty cache.
+    //! \param capacity most selectors kept, rounded up to a multiple of shards.
+    //! \param shards number of independently locked parts of the table.
+    explicit SelectorCache(size_t capacity = 1024, size_t shards = 16)
+        : m_shard_count(std::max<size_t>(shards, 1)),
+          m_shard_capacity(std::max<size_t>((capacity + m_shard_count - 1) / m_shard_count, 1)),
+          m_shards(new shard[m_shard_count]) {
+        for (size_t i = 0; i < m_shard_count; ++i) {
+            // Keys point into the entries, which must not move
+            m_shards[i].entries.reserve(m_shard_capacity);
+            m_shards[i].hand = 0;
+            m_shards[i].hits = 0;
+            m_shards[i].misses = 0;
+        }
+    }
+    SelectorCache(const SelectorCache &) = delete;
+    SelectorCache &operator=(const SelectorCache &) = delete;
+
+    //! Gets the selector of an expression, parsing it on a miss.
+    //! Parsing errors are thrown and not cached.
+    //! \param expression CSS expression.
+    //! \return the parsed \ref Selector, shared.
+    selector_ptr get(const std::string &expression) {
+        return this->get(expression.c_str(), expression.size());
+    }
+    //! Gets the selector of an expression, parsing it on a miss.
+    //! Parsing errors are thrown and not cached.
+    //! \param expression CSS expression as a c-string.
+    //! \return the parsed \ref Selector, shared.
+    selector_ptr get(const char *expression) {
+        return this->get(expression, std::strlen(expression));
+    }
+
+    //! Gets the number of lookups that found their selector.
+    uint64_t hits() const {
+        uint64_t hits = 0;
+        for (size_t i = 0; i < m_shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            hits += m_shards[i].hits;
+        }
+        return hits;
+    }
+    //! Gets the number of lookups that parsed their expression.
+    uint64_t misses() const {
+        uint64_t misses = 0;
+        for (size_t i = 0; i < m_shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            misses += m_shards[i].misses;
+        }
+        return misses;
+    }
+    //! Gets the number of selectors kept.
+    size_t size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < m_shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            size += m_shards[i].entries.size();
+        }
+        return size;
+    }
+    //! Gets the most selectors kept.
+    size_t capacity() const {
+        return m_shard_capacity * m_shard_count;
+    }
+    //! Forgets every selector, keeping the counters.
+    void clear() {
+        for (size_t i = 0; i < m_shard_count; ++i) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            m_shards[i].slots.clear();
+            m_shards[i].entries.clear();
+            m_shards[i].hand = 0;
+        }
+    }
+
+   private:
+    struct entry {
+        std::string expression;  // the key points into it
+        selector_ptr selector;
+        bool referenced;  // looked up since the hand passed
+    };
+    struct shard {
+        mutable std::mutex mutex;
+        HashMap<HashedString<char>, size_t> slots;  // entry of each expression
+        std::vector<entry> entries;
+        size_t hand;  // next entry the clock looks at
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    size_t m_shard_count;
+    size_t m_shard_capacity;
+    std::unique_ptr<shard[]> m_shards;
+
+    selector_ptr get(const char *expression, size_t length) {
+        HashedString<char> key(String<char>(expression, length));
+        shard &s = m_shards[(key.hash() >> 32) % m_shard_count];
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.slots.find(key);
+            if (it != s.slots.end()) {
+                ++s.hits;
+                s.entries[it->second].referenced = true;
+                return s.entries[it->second].selector;
+            }
+            ++s.misses;
+        }
+        // Parse without the lock, other lookups of the shard go on
+        selector_ptr selector = std::make_shared<const Selector>(expression);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.slots.find(key);
+        if (it != s.slots.end())
+            return s.entries[it->second].selector;  // parsed by another thread meanwhile
+        size_t slot = s.entries.size();
+        if (slot < m_shard_capacity) {
+            s.entries.emplace_back();
+        } else {
+            slot = this->evict(s);
+            const std::string &evicted = s.entries[slot].expression;
+            s.slots.erase(HashedString<char>(String<char>(evicted.data(), evicted.size())));
+        }
+        entry &e = s.entries[slot];
+        e.expression.assign(expression, length);
+        e.selector = selector;
+        e.referenced = false;
+        s.slots[HashedString<char>(String<char>(e.expression.data(), e.expression.size()))] = slot;
+        return selector;
+    }
+    // Finds the entry to replace in a full shard
+    static size_t evict(shard &s) {
+        while (s.entries[s.hand].referenced) {
+            s.entries[s.hand].referenced = false;
+            s.hand = (s.hand + 1) % s.entries.size();
+        }
+        size_t slot = s.hand;
+        s.hand = (s.hand + 1) % s.entries.size();
+        return slot;
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,590 @@
+#ifndef NVPARSE_SELECTORPROGRAM_HPP_INCLUDED
+#define NVPARSE_SELECTORPROGRAM_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "node.hpp"
+#include "selector.hpp"
+#include "string.hpp"
+#include "text.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+//! Responsible for matching a \ref Selector against \ref Node s through a
+//! flat array of instructions instead of its AST.
+//! Each comma separated selector becomes a run of instructions that test
+//! the rightmost compound, move to a parent or previous sibling, test the
+//! next compound, and so on. Descendant and general sibling moves leave a
+//! choice point; a failed test resumes from the latest one, or from the
+//! next selector when none is left. Strings are converted to Ch and
+//! lowercased where HTML ignores case once, when compiling.
+template <class Ch>
+class SelectorProgram {
+   public:
+    enum OPCODE : uint8_t {
+        OP_TRY,           //!< starts a selector, arg is where the next one starts
+        OP_MATCH,         //!< the selector matched
+        OP_FAIL,          //!< never matches, e.g. a pseudo-element
+        OP_ELEMENT,       //!< the node is an element
+        OP_SCOPE,         //!< the node is the scope a relative selector starts from
+        OP_TYPE,          //!< the node is an element named string arg
+        OP_CLASS,         //!< the node has class string arg
+        OP_ID,            //!< the node has id string arg
+        OP_ATTRIBUTE,     //!< attribute string arg matches string value by op
+        OP_IS,            //!< the program at arg matches the node
+        OP_NOT,           //!< the program at arg does not match the node
+        OP_HAS,           //!< the relative program at arg matches from the node
+        OP_POSITION,      //!< the position among siblings matches, op is the pseudo-class
+        OP_EMPTY,         //!< the node has no element or text children
+        OP_PARENT,        //!< moves to the parent
+        OP_ANCESTOR,      //!< moves to the parent, then further up on failure
+        OP_PREVIOUS,      //!< moves to the previous element sibling
+        OP_PREVIOUS_ANY,  //!< moves to the previous element sibling, then further on failure
+    };
+    //! Attribute operators, as in \ref Selector
+    enum ATT_OP : uint8_t {
+        ATT_OP_HAS,
+        ATT_OP_EQUALS,
+        ATT_OP_ONE_EQUALS,
+        ATT_OP_HYPHEN,
+        ATT_OP_PREFIX,
+        ATT_OP_SUFFIX,
+        ATT_OP_CONTAINS,
+    };
+    //! Flags of an instruction
+    enum FLAGS : uint8_t {
+        FLAG_CASE_INSENSITIVE = 1,  //!< OP_ATTRIBUTE compares the value ignoring case
+        FLAG_SIBLINGS = 2,          //!< OP_HAS also looks at following siblings
+    };
+    struct Instruction {
+        OPCODE opcode;
+        ATT_OP op;
+        uint8_t flags;
+        uint32_t arg;    //!< string, program counter, jump target or A of An+B
+        uint32_t value;  //!< attribute value string or B of An+B
+    };
+
+    //! Target of the last OP_TRY
+    static constexpr uint32_t npos = 0xFFFFFFFF;
+
+    //! Compiles a selector.
+    //! \param selector the parsed \ref Selector.
+    SelectorProgram(const Selector &selector) : m_max_choices(0) {
+        pending_list pending;
+        this->emit_program(selector, 0, selector.m_count, pending);
+        // Arguments of pseudo-classes follow, each as a program of its own
+        for (size_t i = 0; i < pending.size(); ++i) {
+            uint32_t entry = static_cast<uint32_t>(m_code.size());
+            this->emit_program(selector, pending[i].first, pending[i].end, pending);
+            m_code[pending[i].pc].arg = entry;
+        }
+        this->view_strings();
+    }
+    SelectorProgram(const SelectorProgram &other)
+        : m_code(other.m_code),
+          m_text(other.m_text),
+          m_spans(other.m_spans),
+          m_max_choices(other.m_max_choices) {
+        this->view_strings();
+    }
+    SelectorProgram(SelectorProgram &&) = default;
+    SelectorProgram &operator=(const SelectorProgram &other) {
+        if (this != &other)
+            *this = SelectorProgram(other);
+        return *this;
+    }
+    SelectorProgram &operator=(SelectorProgram &&) = default;
+
+    //! Gets the instructions.
+    //! \return instructions, the program starts at the first.
+    const std::vector<Instruction> &code() const {
+        return m_code;
+    }
+    //! Gets a string used by the instructions.
+    //! \param i arg or value of an instruction.
+    //! \return \ref String of the string.
+    const String<Ch> &string(uint32_t i) const {
+        return m_strings[i];
+    }
+
+    //! Determines whether a \ref Node matches.
+    //! \param node the \ref Node to test.
+    //! \return whether node matches any of the comma separated selectors.
+    bool match(Node<Ch> *node) const {
+        return this->run(0, node, nullptr);
+    }
+    //! Determines whether a \ref Node matches, with a relative selector
+    //! like "> p" starting from scope.
+    //! \param node the \ref Node to test.
+    //! \param scope the \ref Node relative selectors start from.
+    //! \return whether node matches any of the comma separated selectors.
+    bool match(Node<Ch> *node, Node<Ch> *scope) const {
+        return this->run(0, node, scope);
+    }
+    //! Finds the \ref Node s under a root that match, like \ref Selector::select_all.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    void select_all(Node<Ch> *root, std::vector<Node<Ch> *> &results) const {
+        auto range = pre_order(root);
+        auto it = range.begin();
+        for (++it; it != range.end(); ++it) {
+            if (this->run(0, *it, root))
+                results.push_back(*it);
+        }
+    }
+    //! Finds the first \ref Node s under a root that match, stopping the walk
+    //! at the limit.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \param limit most \ref Node s to find.
+    //! \param results vector the matching \ref Node s are appended to, in document order.
+    void select_n(Node<Ch> *root, size_t limit, std::vector<Node<Ch> *> &results) const {
+        if (limit == 0)
+            return;
+        auto range = pre_order(root);
+        auto it = range.begin();
+        for (++it; it != range.end(); ++it) {
+            if (!this->run(0, *it, root))
+                continue;
+            results.push_back(*it);
+            if (--limit == 0)
+                return;
+        }
+    }
+    //! Finds the first \ref Node under a root that matches.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \return first matching \ref Node in document order, nullptr if none.
+    Node<Ch> *select_first(Node<Ch> *root) const {
+        auto range = pre_order(root);
+        auto it = range.begin();
+        for (++it; it != range.end(); ++it) {
+            if (this->run(0, *it, root))
+                return *it;
+        }
+        return nullptr;
+    }
+    //! Determines whether a \ref Node under a root matches.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \return whether \ref select_first finds a \ref Node.
+    bool exists(Node<Ch> *root) const {
+        return this->select_first(root) != nullptr;
+    }
+
+   private:
+    // Arguments of a pseudo-class, the complexes in [first, end), to compile
+    // after the program of the instruction at pc
+    struct pending_program {
+        uint32_t pc;
+        uint32_t first;
+        uint32_t end;
+    };
+    typedef std::vector<pending_program> pending_list;
+
+    // A node to retry the move at pc from
+    struct choice {
+        uint32_t pc;
+        Node<Ch> *node;
+    };
+    // Choice points kept on the stack of run
+    static constexpr size_t local_choices = 16;
+
+    std::vector<Instruction> m_code;
+    std::vector<Ch> m_text;
+    std::vector<Span> m_spans;
+    std::vector<String<Ch>> m_strings;  // views of m_spans in m_text
+    size_t m_max_choices;               // most moves with choice points in one selector
+
+    ///////////////////////////////////////////////////////////////////////
+    // Compiling
+
+    void emit(OPCODE opcode, uint32_t arg = 0, uint8_t flags = 0) {
+        m_code.push_back(Instruction{opcode, ATT_OP_HAS, flags, arg, 0});
+    }
+    uint32_t add_string(const String<char> &s, bool lowercase) {
+        Span span = {static_cast<uint32_t>(m_text.size()), static_cast<uint32_t>(s.length())};
+        for (size_t i = 0; i < s.length(); ++i)
+            m_text.push_back(static_cast<Ch>(static_cast<unsigned char>(s[i])));
+        if (lowercase)
+            internal::lower_chars(m_text.data() + span.offset, span.length);
+        m_spans.push_back(span);
+        return static_cast<uint32_t>(m_spans.size() - 1);
+    }
+    // Points the strings into m_text, once it is complete
+    void view_strings() {
+        m_strings.clear();
+        m_strings.reserve(m_spans.size());
+        for (const Span &span : m_spans)
+            m_strings.push_back(String<Ch>(m_text.data() + span.offset, span.length));
+    }
+
+    // Compiles the complexes in [first, end), each compound from the right
+    void emit_program(const Selector &selector,
+                      uint32_t first,
+                      uint32_t end,
+                      pending_list &pending) {
+        size_t try_pc = m_code.size();
+        for (uint32_t complex = first; complex < end; complex = selector.token(complex).end) {
+            try_pc = m_code.size();
+            this->emit(OP_TRY);
+            size_t choices = 0;
+            for (uint32_t compound = selector.token(complex).link;;
+                 compound = selector.token(compound).link) {
+                this->emit_compound(selector, compound, pending);
+                if (selector.token(compound).link == Selector::npos)
+                    break;
+                switch (selector.token(compound).type) {
+                    case Selector::SELECTOR_DESCENDANT:
+                        this->emit(OP_ANCESTOR);
+                        ++choices;
+                        break;
+                    case Selector::SELECTOR_CHILDREN:
+                        this->emit(OP_PARENT);
+                        break;
+                    case Selector::SELECTOR_SIBLING:
+                        this->emit(OP_PREVIOUS_ANY);
+                        ++choices;
+                        break;
+                    default:
+                        this->emit(OP_PREVIOUS);
+                }
+            }
+            this->emit(OP_MATCH);
+            m_max_choices = std::max(m_max_choices, choices);
+            m_code[try_pc].arg = static_cast<uint32_t>(m_code.size());
+        }
+        if (first == end) {
+            this->emit(OP_TRY);
+            this->emit(OP_FAIL);
+        }
+        // The last selector has nowhere to go on failure
+        m_code[try_pc].arg = npos;
+    }
+    // Tests that reject most nodes go first
+    void emit_compound(const Selector &selector, uint32_t compound, pending_list &pending) {
+        uint32_t end = selector.token(compound).end;
+        if (compound + 1 == end) {
+            this->emit(OP_SCOPE);
+            return;
+        }
+        bool typed = false;
+        for (uint32_t simple = compound + 1; simple < end; simple = selector.token(simple).end) {
+            const Selector::Token &token = selector.token(simple);
+            if (token.type == Selector::SELECTOR_SUEDO_ELEMENT) {
+                this->emit(OP_FAIL);
+                return;
+            }
+            typed =
+                typed || (token.type == Selector::SELECTOR_TYPE && !selector.is_universal(token));
+        }
+        if (!typed)
+            this->emit(OP_ELEMENT);
+        static const Selector::ESELECTOR order[] = {
+            Selector::SELECTOR_ID,
+            Selector::SELECTOR_TYPE,
+            Selector::SELECTOR_CLASS,
+            Selector::SELECTOR_ATTRIBUTE,
+            Selector::SELECTOR_SUEDO_CLASS_NTH_CHILD,
+            Selector::SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD,
+            Selector::SELECTOR_SUEDO_CLASS_NTH_OF_TYPE,
+            Selector::SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE,
+            Selector::SELECTOR_SUEDO_CLASS_ONLY_CHILD,
+            Selector::SELECTOR_SUEDO_CLASS_ONLY_OF_TYPE,
+            Selector::SELECTOR_SUEDO_CLASS_EMPTY,
+            Selector::SELECTOR_SUEDO_CLASS_IS,
+            Selector::SELECTOR_SUEDO_CLASS_WHERE,
+            Selector::SELECTOR_SUEDO_CLASS_NOT,
+            Selector::SELECTOR_SUEDO_CLASS_HAS,
+        };
+        for (Selector::ESELECTOR type : order) {
+            for (uint32_t simple = compound + 1; simple < end;
+                 simple = selector.token(simple).end) {
+                if (selector.token(simple).type == type)
+                    this->emit_simple(selector, simple, pending);
+            }
+        }
+    }
+    void emit_simple(const Selector &selector, uint32_t simple, pending_list &pending) {
+        const Selector::Token &token = selector.token(simple);
+        switch (token.type) {
+            case Selector::SELECTOR_TYPE:
+                if (!selector.is_universal(token))
+                    this->emit(OP_TYPE, this->add_string(selector.text(token.name), true));
+                break;
+            case Selector::SELECTOR_CLASS:
+                this->emit(OP_CLASS, this->add_string(selector.text(token.name), false));
+                break;
+            case Selector::SELECTOR_ID:
+                this->emit(OP_ID, this->add_string(selector.text(token.name), false));
+                break;
+            case Selector::SELECTOR_ATTRIBUTE: {
+                Instruction instruction;
+                instruction.opcode = OP_ATTRIBUTE;
+                instruction.op = static_cast<ATT_OP>(token.op);
+                instruction.flags = token.case_insensitive ? FLAG_CASE_INSENSITIVE : 0;
+                instruction.arg = this->add_string(selector.text(token.name), true);
+                instruction.value = this->add_string(selector.text(token.value), false);
+                m_code.push_back(instruction);
+                break;
+            }
+            case Selector::SELECTOR_SUEDO_CLASS_HAS: {
+                uint8_t flags = 0;
+                for (uint32_t complex = simple + 1; complex < token.end;
+                     complex = selector.token(complex).end) {
+                    Selector::ESELECTOR combinator =
+                        selector.token(selector.token(complex + 1).end).type;
+                    if (combinator == Selector::SELECTOR_SIBLING ||
+                        combinator == Selector::SELECTOR_SIBLING_ADJACENT)
+                        flags = FLAG_SIBLINGS;
+                }
+                pending.push_back(
+                    pending_program{static_cast<uint32_t>(m_code.size()), simple + 1, token.end});
+                this->emit(OP_HAS, 0, flags);
+                break;
+            }
+            case Selector::SELECTOR_SUEDO_CLASS_NTH_CHILD:
+            case Selector::SELECTOR_SUEDO_CLASS_NTH_LAST_CHILD:
+            case Selector::SELECTOR_SUEDO_CLASS_NTH_OF_TYPE:
+            case Selector::SELECTOR_SUEDO_CLASS_NTH_LAST_OF_TYPE:
+            case Selector::SELECTOR_SUEDO_CLASS_ONLY_CHILD:
+            case Selector::SELECTOR_SUEDO_CLASS_ONLY_OF_TYPE: {
+                // The pseudo-class goes in op, which is wide enough for it
+                Instruction instruction;
+                instruction.opcode = OP_POSITION;
+                instruction.op = static_cast<ATT_OP>(token.type);
+                instruction.flags = 0;
+                instruction.arg = static_cast<uint32_t>(token.nth_step);
+                instruction.value = static_cast<uint32_t>(token.nth_offset);
+                m_code.push_back(instruction);
+                break;
+            }
+            case Selector::SELECTOR_SUEDO_CLASS_EMPTY:
+                this->emit(OP_EMPTY);
+                break;
+            default:
+                pending.push_back(
+                    pending_program{static_cast<uint32_t>(m_code.size()), simple + 1, token.end});
+                this->emit(token.type == Selector::SELECTOR_SUEDO_CLASS_NOT ? OP_NOT : OP_IS);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // Running
+
+    static bool is_element(const Node<Ch> *node) {
+        return node->type() <= Node<Ch>::NODE_ELEMENT;
+    }
+    static Node<Ch> *previous_element(Node<Ch> *node) {
+        do {
+            node = node->previous_sibling();
+        } while (node != nullptr && !is_element(node));
+        return node;
+    }
+
+    bool run(uint32_t entry, Node<Ch> *start, Node<Ch> *scope) const {
+        choice local[local_choices];
+        std::vector<choice> heap;
+        choice *choices = local;
+        if (m_max_choices > local_choices) {
+            heap.resize(m_max_choices);
+            choices = heap.data();
+        }
+        size_t top = 0;
+        uint32_t pc = entry;
+        uint32_t next = npos;
+        Node<Ch> *node = start;
+        while (true) {
+            const Instruction &in = m_code[pc];
+            bool ok;
+            switch (in.opcode) {
+                case OP_TRY:
+                    next = in.arg;
+                    node = start;
+                    top = 0;
+                    ++pc;
+                    continue;
+                case OP_MATCH:
+                    return true;
+                case OP_FAIL:
+                    ok = false;
+                    break;
+                case OP_ELEMENT:
+                    ok = is_element(node);
+                    break;
+                case OP_SCOPE:
+                    ok = node == scope;
+                    break;
+                case OP_TYPE:
+                    ok = is_element(node) && compare_ci(node->name(), m_strings[in.arg]);
+                    break;
+                case OP_CLASS:
+                    ok = !node->classes_empty() && node->contains_class(m_strings[in.arg]);
+                    break;
+                case OP_ID:
+                    ok = node->id() == m_strings[in.arg];
+                    break;
+                case OP_ATTRIBUTE:
+                    ok = this->match_attribute(in, node);
+                    break;
+                case OP_IS:
+                    ok = this->run(in.arg, node, nullptr);
+                    break;
+                case OP_NOT:
+                    ok = !this->run(in.arg, node, nullptr);
+                    break;
+                case OP_HAS:
+                    ok = this->match_has(in, node);
+                    break;
+                case OP_POSITION:
+                    ok = this->match_position(in, node);
+                    break;
+                case OP_EMPTY:
+                    ok = Selector::is_empty(node);
+                    break;
+                case OP_PARENT:
+                    node = node->parent();
+                    ok = node != nullptr;
+                    break;
+                case OP_PREVIOUS:
+                    node = previous_element(node);
+                    ok = node != nullptr;
+                    break;
+                case OP_ANCESTOR:
+                    node = node->parent();
+                    ok = node != nullptr;
+                    if (ok)
+                        choices[top++] = choice{pc, node};
+                    break;
+                case OP_PREVIOUS_ANY:
+                    node = previous_element(node);
+                    ok = node != nullptr;
+                    if (ok)
+                        choices[top++] = choice{pc, node};
+                    break;
+                default:
+                    ok = false;
+            }
+            if (ok) {
+                ++pc;
+                continue;
+            }
+            // Retry the latest move that has somewhere else to go
+            while (top > 0) {
+                choice &last = choices[top - 1];
+                last.node = m_code[last.pc].opcode == OP_ANCESTOR ? last.node->parent()
+                                                                   : previous_element(last.node);
+                if (last.node != nullptr)
+                    break;
+                --top;
+            }
+            if (top > 0) {
+                node = choices[top - 1].node;
+                pc = choices[top - 1].pc + 1;
+            } else if (next != npos) {
+                pc = next;
+            } else {
+                return false;
+            }
+        }
+    }
+
+    bool match_attribute(const Instruction &in, Node<Ch> *node) const {
+        const String<Ch> &name = m_strings[in.arg];
+        if (in.op == ATT_OP_HAS)
+            return node->contains_attribute(name);
+        String<Ch> value = node->find_attribute(name);
+        const String<Ch> &pattern = m_strings[in.value];
+        bool ci = (in.flags & FLAG_CASE_INSENSITIVE) != 0;
+        bool matched = false;
+        switch (in.op) {
+            case ATT_OP_EQUALS:
+                matched = equal(value, 0, pattern, ci) && value.length() == pattern.length();
+                break;
+            case ATT_OP_ONE_EQUALS:
+                matched = one_equals(value, pattern, ci);
+                break;
+            case ATT_OP_HYPHEN:
+                matched = equal(value, 0, pattern, ci) && (value.length() == pattern.length() ||
+                                                           value[pattern.length()] == Ch('-'));
+                break;
+            case ATT_OP_PREFIX:
+                matched = !pattern.empty() && equal(value, 0, pattern, ci);
+                break;
+            case ATT_OP_SUFFIX:
+                matched = !pattern.empty() && value.length() >= pattern.length() &&
+                          equal(value, value.length() - pattern.length(), pattern, ci);
+                break;
+            case ATT_OP_CONTAINS:
+                if (pattern.empty())
+                    break;
+                for (size_t i = 0; !matched && i + pattern.length() <= value.length(); ++i)
+                    matched = equal(value, i, pattern, ci);
+                break;
+            default:
+                break;
+        }
+        // An empty value may also be a missing attribute
+        return matched && (!value.empty() || node->contains_attribute(name));
+    }
+    // Walks the siblings: a program keeps nothing between Nodes
+    bool match_position(const Instruction &in, Node<Ch> *node) const {
+        return Selector::match_position(static_cast<Selector::ESELECTOR>(in.op),
+                                        static_cast<int>(in.arg), static_cast<int>(in.value),
+                                        Selector::position_of(node));
+    }
+    // Relative programs start at the node and reach its descendants, and
+    // with FLAG_SIBLINGS its following siblings and their descendants
+    bool match_has(const Instruction &in, Node<Ch> *node) const {
+        Node<Ch> *last = node;
+        if ((in.flags & FLAG_SIBLINGS) != 0) {
+            while (last->next_sibling() != nullptr)
+                last = last->next_sibling();
+        }
+        for (Node<Ch> *candidate = node; candidate != nullptr;) {
+            if (candidate->first_child() != nullptr) {
+                candidate = candidate->first_child();
+            } else {
+                while (candidate != last && candidate->next_sibling() == nullptr)
+                    candidate = candidate->parent();
+                if (candidate == last)
+                    break;
+                candidate = candidate->next_sibling();
+            }
+            if (this->run(in.arg, candidate, node))
+                return true;
+        }
+        return false;
+    }
+
+    // Compares pattern with the text at an offset of value
+    static bool equal(const String<Ch> &value, size_t offset, const String<Ch> &pattern, bool ci) {
+        if (offset + pattern.length() > value.length())
+            return false;
+        String<Ch> text(value.data() + offset, pattern.length());
+        return ci ? compare_ci(text, pattern) : text == pattern;
+    }
+    static bool one_equals(const String<Ch> &value, const String<Ch> &word, bool ci) {
+        if (word.empty())
+            return false;
+        for (size_t i = 0; i < word.length(); ++i) {
+            if (whitespace_pred<Ch>::test(word[i]))
+                return false;
+        }
+        size_t i = 0;
+        while (i < value.length()) {
+            while (i < value.length() && whitespace_pred<Ch>::test(value[i]))
+                ++i;
+            size_t start = i;
+            while (i < value.length() && !whitespace_pred<Ch>::test(value[i]))
+                ++i;
+            if (i - start == word.length() && equal(value, start, word, ci))
+                return true;
+        }
+        return false;
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef NVPARSE_SELECTORSET_HPP_INCLUDED
+#define NVPARSE_SELECTORSET_HPP_INCLUDED
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ancestor_filter.hpp"
+#include "hash_map.hpp"
+#include "node.hpp"
+#include "selector.hpp"
+#include "string.hpp"
+#include "traverse.hpp"
+
+namespace nvparsehtml {
+//! Responsible for matching many \ref Selector s in one walk of a tree.
+//! Each comma separated selector is filed under a key of its rightmost
+//! compound, its id, else a class, else its type, as style engines do with
+//! their rules. A \ref Node is then only tested against the selectors filed
+//! under its own id, classes and name, and the few without a key.
+//! While walking, an \ref AncestorFilter skips the selectors whose
+//! ancestors are missing, and the answers of pseudo-classes are kept for
+//! every selector.
+template <class Ch>
+class SelectorSet {
+   public:
+    SelectorSet() : m_filtered(false), m_memoized(false) {
+    }
+
+    //! Adds a selector.
+    //! \param selector the parsed \ref Selector, copied.
+    //! \return number of the selector, its position in the results.
+    size_t add(const Selector &selector) {
+        size_t number = m_selectors.size();
+        m_selectors.push_back(selector);
+        m_filtered = m_filtered || selector.m_filtered;
+        m_memoized = m_memoized || selector.m_memoized;
+        const Selector &added = m_selectors.back();
+        for (uint32_t complex = 0; complex < added.m_count; complex = added.token(complex).end)
+            this->file(rule{number, &added, complex});
+        return number;
+    }
+    //! Adds a selector.
+    //! \param expression CSS expression to parse.
+    //! \return number of the selector, its position in the results.
+    size_t add(const std::string &expression) {
+        return this->add(Selector(expression));
+    }
+    //! Adds a selector.
+    //! \param expression CSS expression to parse as a c-string.
+    //! \return number of the selector, its position in the results.
+    size_t add(const char *expression) {
+        return this->add(Selector(expression));
+    }
+    //! Gets number of selectors.
+    size_t size() const {
+        return m_selectors.size();
+    }
+    //! Gets a selector.
+    //! \param number number returned by \ref add.
+    const Selector &selector(size_t number) const {
+        return m_selectors[number];
+    }
+
+    //! Finds the selectors a \ref Node matches.
+    //! \param node the \ref Node to test.
+    //! \param numbers vector the numbers of the matching selectors are appended to, ascending.
+    void match(Node<Ch> *node, std::vector<size_t> &numbers) const {
+        size_t first = numbers.size();
+        walk state = {nullptr, nullptr};
+        this->match_node(node, nullptr, state, [&numbers, first](size_t number, Node<Ch> *) {
+            for (size_t i = first; i < numbers.size(); ++i) {
+                if (numbers[i] == number)
+                    return;
+            }
+            numbers.push_back(number);
+        });
+        std::sort(numbers.begin() + first, numbers.end());
+    }
+    //! Finds the \ref Node s under a root that match each selector, like
+    //! \ref Selector::select_all for every selector, in one walk.
+    //! \param root the \ref Node whose descendants are tested.
+    //! \param results vector resized to \ref size, the matches of each selector
+    //! are appended to its entry in document order.
+    void select_all(Node<Ch> *root, std::vector<std::vector<Node<Ch> *>> &results) const {
+        results.resize(m_selectors.size());
+        AncestorFilter<Ch> filter;
+        if (m_filtered)
+            filter.reset(root);
+        Selector::Memo<Ch> memo(root, true);
+        walk state = {m_filtered ? &filter : nullptr, m_memoized ? &memo : nullptr};
+        auto range = pre_order(root);
+        auto it = range.begin();
+        for (++it; it != range.end(); ++it) {
+            if (m_filtered)
+                filter.advance(*it);
+            this->match_node(*it, root, state, [&results](size_t number, Node<Ch> *node) {
+                // Two alternatives of one selector may both match
+                std::vector<Node<Ch> *> &matches = results[number];
+                if (matches.empty() || matches.back() != node)
+                    matches.push_back(node);
+            });
+        }
+    }
+
+   private:
+    // One comma separated selector of a selector
+    struct rule {
+        size_t number;
+        const Selector *selector;
+        uint32_t complex;  // token of the complex in selector
+    };
+    typedef HashMap<String<Ch>, std::vector<rule>> rule_map;
+    // What one walk shares between the tests of its Nodes
+    struct walk {
+        const AncestorFilter<Ch> *filter;  // nullptr to test every rule
+        Selector::Memo<Ch> *memo;          // nullptr to keep no answers
+    };
+
+    std::deque<Selector> m_selectors;  // a deque keeps the selectors in place
+    bool m_filtered;                   // some selector has ancestor keys
+    bool m_memoized;                   // some selector keeps answers of pseudo-classes
+    rule_map m_id_rules;
+    rule_map m_class_rules;
+    rule_map m_type_rules;
+    std::vector<rule> m_universal_rules;
+    std::deque<std::basic_string<Ch>> m_keys;  // key text converted to Ch
+
+    void file(const rule &r) {
+        const Selector &selector = *r.selector;
+        uint32_t compound = selector.token(r.complex).link;
+        const Selector::Token *key = nullptr;
+        for (uint32_t simple = compound + 1; simple < selector.token(compound).end;
+             simple = selector.token(simple).end) {
+            const Selector::Token *token = &selector.token(simple);
+            if (token->type == Selector::SELECTOR_ID) {
+                key = token;
+                break;
+            }
+            if (token->type == Selector::SELECTOR_CLASS &&
+                (key == nullptr || key->type == Selector::SELECTOR_TYPE))
+                key = token;
+            else if (token->type == Selector::SELECTOR_TYPE && !selector.is_universal(*token) &&
+                     key == nullptr)
+                key = token;
+        }
+        if (key == nullptr) {
+            m_universal_rules.push_back(r);
+            return;
+        }
+        switch (key->type) {
+            case Selector::SELECTOR_ID:
+                m_id_rules[this->add_key(selector.text(key->name), false)].push_back(r);
+                break;
+            case Selector::SELECTOR_CLASS:
+                m_class_rules[this->add_key(selector.text(key->name), false)].push_back(r);
+                break;
+            default:
+                // Types match whatever the case, names are lowercase
+                m_type_rules[this->add_key(selector.text(key->name), true)].push_back(r);
+        }
+    }
+    String<Ch> add_key(const String<char> &s, bool lowercase) {
+        std::basic_string<Ch> text;
+        for (size_t i = 0; i < s.length(); ++i) {
+            Ch ch = static_cast<Ch>(static_cast<unsigned char>(s[i]));
+            text.push_back(lowercase ? internal::lower_char(ch) : ch);
+        }
+        m_keys.push_back(std::move(text));
+        return String<Ch>(m_keys.back().data(), m_keys.back().size());
+    }
+
+    // Calls matched(number, node) for every rule filed under a key of node
+    // that matches it, skipping those the filter of the walk rules out
+    template <class F>
+    void match_node(Node<Ch> *node, Node<Ch> *scope, walk &state, F matched) const {
+        // Every rule has a rightmost compound to test, which needs an element
+        if (node->type() > Node<Ch>::NODE_ELEMENT)
+            return;
+        if (!m_id_rules.empty() && !node->id().empty())
+            this->match_rules(m_id_rules, node->id(), node, scope, state, matched);
+        if (!m_class_rules.empty()) {
+            for (auto it = node->class_begin(); it != node->class_end(); ++it)
+                this->match_rules(m_class_rules, *it, node, scope, state, matched);
+        }
+        if (!m_type_rules.empty()) {
+            String<Ch> name = node->name();
+            std::basic_string<Ch> lowered;
+            for (size_t i = 0; i < name.length(); ++i) {
+                if (internal::lower_char(name[i]) != name[i]) {
+                    lowered.assign(name.data(), name.length());
+                    internal::lower_chars(&lowered[0], lowered.size());
+                    name = String<Ch>(lowered.data(), lowered.size());
+                    break;
+                }
+            }
+            this->match_rules(m_type_rules, name, node, scope, state, matched);
+        }
+        this->match_list(m_universal_rules, node, scope, state, matched);
+    }
+    template <class F>
+    void match_rules(const rule_map &rules,
+                     const String<Ch> &key,
+                     Node<Ch> *node,
+                     Node<Ch> *scope,
+                     walk &state,
+                     F &matched) const {
+        auto it = rules.find(key);
+        if (it != rules.end())
+            this->match_list(it->second, node, scope, state, matched);
+    }
+    template <class F>
+    void match_list(const std::vector<rule> &rules,
+                    Node<Ch> *node,
+                    Node<Ch> *scope,
+                    walk &state,
+                    F &matched) const {
+        for (const rule &r : rules) {
+            const Selector::Token &complex = r.selector->token(r.complex);
+            if (state.filter != nullptr &&
+                !state.filter->may_contain_all(r.selector->keys(complex), complex.keys.length))
+                continue;
+            if (r.selector->match_from(complex.link, node, scope, state.memo))
+                matched(r.number, node);
+        }
+    }
+};
+}  // namespace nvparsehtml
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef NVPARSE_SIMD_HPP_INCLUDED
+#define NVPARSE_SIMD_HPP_INCLUDED
+
+#include <cstdint>
+
+// Vector code paths follow the instruction sets the compiler targets.
+// Define NVPARSE_NO_SIMD to force the scalar code paths.
+#if !defined(NVPARSE_NO_SIMD)
+#if defined(__AVX2__)
+#define NVPARSE_SIMD_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NVPARSE_SIMD_SSE2
+#endif
+#endif
+
+#if defined(NVPARSE_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(NVPARSE_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace nvparsehtml {
+namespace internal {
+// Position of the lowest set bit, mask must not be 0
+inline unsigned count_trailing_zeros(uint64_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+// Number of set bits
+inline unsigned count_bits(uint64_t mask) {
+#if defined(_MSC_VER)
+    return static_cast<unsigned>(__popcnt64(mask));
+#else
+    return static_cast<unsigned>(__builtin_popcountll(mask));
+#endif
+}
+}  // namespace internal
+}  // namespace nvparsehtml
+
+#endif
@@ -2,9 +2,165 @@
 #define NVPARSE_STRING_HPP_INCLUDED
 
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
 #include <cwctype>
+#include <functional>
+#include <string_view>
+
+#include "hash.hpp"
+#include "simd.hpp"
 
 namespace nvparsehtml {
+namespace internal {
+///////////////////////////////////////////////////////////////////////////
+// Case folding, ASCII without a locale lookup
+
+inline char lower_char(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return static_cast<char>(c + ('a' - 'A'));
+    if (static_cast<unsigned char>(c) < 0x80)
+        return c;
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+inline char upper_char(char c) {
+    if (c >= 'a' && c <= 'z')
+        return static_cast<char>(c - ('a' - 'A'));
+    if (static_cast<unsigned char>(c) < 0x80)
+        return c;
+    return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+}
+inline wchar_t lower_char(wchar_t c) {
+    if (c >= L'A' && c <= L'Z')
+        return static_cast<wchar_t>(c + (L'a' - L'A'));
+    if (c >= 0 && c < 0x80)
+        return c;
+    return static_cast<wchar_t>(std::towlower(c));
+}
+inline wchar_t upper_char(wchar_t c) {
+    if (c >= L'a' && c <= L'z')
+        return static_cast<wchar_t>(c - (L'a' - L'A'));
+    if (c >= 0 && c < 0x80)
+        return c;
+    return static_cast<wchar_t>(std::towupper(c));
+}
+template <typename Ch>
+inline Ch lower_char(Ch c) {
+    return static_cast<Ch>(std::tolower(c));
+}
+template <typename Ch>
+inline Ch upper_char(Ch c) {
+    return static_cast<Ch>(std::toupper(c));
+}
+
+template <typename Ch>
+inline void lower_chars(Ch *text, size_t length) {
+    for (size_t i = 0; i < length; ++i)
+        text[i] = lower_char(text[i]);
+}
+template <typename Ch>
+inline void upper_chars(Ch *text, size_t length) {
+    for (size_t i = 0; i < length; ++i)
+        text[i] = upper_char(text[i]);
+}
+template <typename Ch>
+inline bool equal_ci(const Ch *lhs, const Ch *rhs, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (lhs[i] != rhs[i] && lower_char(lhs[i]) != lower_char(rhs[i]))
+            return false;
+    }
+    return true;
+}
+
+#if defined(NVPARSE_SIMD_SSE2)
+// Each block folds the ASCII letters of 16 (or 32) bytes at once. Bytes of
+// 0x80 and above never fall in the letter ranges, they are returned in a
+// mask and only those bytes go through the locale-aware scalar path.
+
+// Adds 'A' ^ 0x80 so that 'A'..'Z' become the 26 smallest signed bytes
+inline __m128i ascii_fold_16(__m128i v, char first, bool lower) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - first)));
+    __m128i in_range = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+    __m128i bit = _mm_and_si128(in_range, _mm_set1_epi8(0x20));
+    return lower ? _mm_or_si128(v, bit) : _mm_andnot_si128(bit, v);
+}
+
+#if defined(NVPARSE_SIMD_AVX2)
+inline __m256i ascii_fold_32(__m256i v, char first, bool lower) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - first)));
+    __m256i in_range = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), shifted);
+    __m256i bit = _mm256_and_si256(in_range, _mm256_set1_epi8(0x20));
+    return lower ? _mm256_or_si256(v, bit) : _mm256_andnot_si256(bit, v);
+}
+#endif
+
+// Folds a run of chars, lower selects the direction
+inline void fold_chars(char *text, size_t length, bool lower) {
+    char first = lower ? 'A' : 'a';
+    size_t i = 0;
+#if defined(NVPARSE_SIMD_AVX2)
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i));
+        uint32_t non_ascii = static_cast<uint32_t>(_mm256_movemask_epi8(v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(text + i), ascii_fold_32(v, first, lower));
+        while (non_ascii != 0) {
+            size_t k = i + count_trailing_zeros(non_ascii);
+            text[k] = lower ? lower_char(text[k]) : upper_char(text[k]);
+            non_ascii &= non_ascii - 1;
+        }
+    }
+#endif
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        uint32_t non_ascii = static_cast<uint32_t>(_mm_movemask_epi8(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(text + i), ascii_fold_16(v, first, lower));
+        while (non_ascii != 0) {
+            size_t k = i + count_trailing_zeros(non_ascii);
+            text[k] = lower ? lower_char(text[k]) : upper_char(text[k]);
+            non_ascii &= non_ascii - 1;
+        }
+    }
+    for (; i < length; ++i)
+        text[i] = lower ? lower_char(text[i]) : upper_char(text[i]);
+}
+
+inline void lower_chars(char *text, size_t length) {
+    fold_chars(text, length, true);
+}
+inline void upper_chars(char *text, size_t length) {
+    fold_chars(text, length, false);
+}
+
+inline bool equal_ci(const char *lhs, const char *rhs, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+        __m128i equal = _mm_cmpeq_epi8(ascii_fold_16(l, 'A', true), ascii_fold_16(r, 'A', true));
+        uint32_t differ = ~static_cast<uint32_t>(_mm_movemask_epi8(equal)) & 0xFFFF;
+        if (differ == 0)
+            continue;
+        // Differing ASCII bytes are a definite mismatch, only non-ASCII ones
+        // need the locale to decide
+        uint32_t non_ascii = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(l, r)));
+        if ((differ & ~non_ascii) != 0)
+            return false;
+        while (differ != 0) {
+            size_t k = i + count_trailing_zeros(differ);
+            if (lower_char(lhs[k]) != lower_char(rhs[k]))
+                return false;
+            differ &= differ - 1;
+        }
+    }
+    for (; i < length; ++i) {
+        if (lhs[i] != rhs[i] && lower_char(lhs[i]) != lower_char(rhs[i]))
+            return false;
+    }
+    return true;
+}
+#endif
+}  // namespace internal
+
 template <typename Ch>
 class String {
     Ch *m_c;
@@ -16,6 +172,24 @@ class String {
     String(const Ch *text, size_t length) : m_length(length) {
         m_c = const_cast<Ch *>(text);
     }
+    String(std::basic_string_view<Ch> view) : m_length(view.size()) {
+        m_c = const_cast<Ch *>(view.data());
+    }
+
+    //! Views the characters without copying them.
+    //! \return std::basic_string_view over the same characters.
+    std::basic_string_view<Ch> view() const {
+        return std::basic_string_view<Ch>(m_c, m_length);
+    }
+    operator std::basic_string_view<Ch>() const {
+        return this->view();
+    }
+
+    //! Hashes the characters.
+    //! \return 64-bit hash, equal for equal \ref String s.
+    uint64_t hash() const {
+        return hash_bytes(m_c, m_length * sizeof(Ch));
+    }
 
     size_t length() const {
         return m_length;
@@ -43,56 +217,48 @@ class String {
     }
 
     void to_uppercase() {
-        for (size_t i = 0; i < m_length; ++i) {
-            m_c[i] = std::toupper(m_c[i]);
-        }
+        internal::upper_chars(m_c, m_length);
     }
 
     void to_lowercase() {
-        for (size_t i = 0; i < m_length; ++i) {
-            m_c[i] = std::tolower(m_c[i]);
-        }
+        internal::lower_chars(m_c, m_length);
     }
 };
 
-template <>
-void String<wchar_t>::to_uppercase() {
-    for (size_t i = 0; i < m_length; ++i) {
-        m_c[i] = std::towupper(m_c[i]);
-    }
-}
+//! \ref String with its hash computed once and kept alongside the span
+template <typename Ch>
+class HashedString {
+    String<Ch> m_str;
+    uint64_t m_hash;
 
-template <>
-void String<wchar_t>::to_lowercase() {
-    for (size_t i = 0; i < m_length; ++i) {
-        m_c[i] = std::towlower(m_c[i]);
+   public:
+    HashedString() : m_hash(String<Ch>().hash()) {
+    }
+    HashedString(const String<Ch> &str) : m_str(str), m_hash(str.hash()) {
     }
-}
 
-template <typename Ch>
-void to_uppercase(Ch *text, size_t length) {
-    for (size_t i = 0; i < length; ++i) {
-        text[i] = std::toupper(text[i]);
+    const String<Ch> &str() const {
+        return m_str;
     }
-}
-template <>
-void to_uppercase<wchar_t>(wchar_t *text, size_t length) {
-    for (size_t i = 0; i < length; ++i) {
-        text[i] = std::towupper(text[i]);
+    uint64_t hash() const {
+        return m_hash;
     }
-}
+};
+
+//! 32-bit offset and length of a \ref String within a source buffer
+struct Span {
+    uint32_t offset;
+    uint32_t length;
+};
 
 template <typename Ch>
-void to_lowercase(Ch *text, size_t length) {
-    for (size_t i = 0; i < length; ++i) {
-        text[i] = std::tolower(text[i]);
-    }
+inline void to_uppercase(Ch *text, size_t length) {
+    internal::upper_chars(text, length);
 }
-template <>
-void to_lowercase<wchar_t>(wchar_t *text, size_t length) {
-    for (size_t i = 0; i < length; ++i) {
-        text[i] = std::towlower(text[i]);
-    }
+
+template <typename Ch>
+inline void to_lowercase(Ch *text, size_t length) {
+    internal::lower_chars(text, length);
 }
 
 template <typename Ch>
@@ -147,20 +313,36 @@ inline bool operator!=(const String<Ch> &lhs, const String<Ch> &rhs) {
 }
 
 template <typename Ch>
-inline bool compare_ci(const String<Ch> &lhs, const String<Ch> &rhs) {
-    const Ch *rhs_c = rhs.data();
-    size_t rhs_length = rhs.length();
-    const Ch *lhs_c = lhs.data();
-    size_t lhs_length = lhs.length();
+inline bool operator==(const HashedString<Ch> &lhs, const HashedString<Ch> &rhs) {
+    return lhs.hash() == rhs.hash() && lhs.str() == rhs.str();
+}
+template <typename Ch>
+inline bool operator!=(const HashedString<Ch> &lhs, const HashedString<Ch> &rhs) {
+    return !(lhs == rhs);
+}
 
-    if (lhs_length != rhs_length)
+template <typename Ch>
+inline bool compare_ci(const String<Ch> &lhs, const String<Ch> &rhs) {
+    if (lhs.length() != rhs.length())
         return false;
-    for (size_t i = 0; i < lhs_length; ++i) {
-        if (std::towlower(lhs_c[i]) != std::towlower(rhs_c[i]))
-            return false;
-    }
-    return true;
+    return internal::equal_ci(lhs.data(), rhs.data(), lhs.length());
 }
 }  // namespace nvparsehtml
 
+namespace std {
+template <typename Ch>
+struct hash<nvparsehtml::String<Ch>> {
+    size_t operator()(const nvparsehtml::String<Ch> &s) const noexcept {
+        return static_cast<size_t>(s.hash());
+    }
+};
+
+template <typename Ch>
+struct hash<nvparsehtml::HashedString<Ch>> {
+    size_t operator()(const nvparsehtml::HashedString<Ch> &s) const noexcept {
+        return static_cast<size_t>(s.hash());
+    }
+};
+}  // namespace std
+
 #endif
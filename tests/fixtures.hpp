@@ -0,0 +1,51 @@
+#ifndef NVPARSE_TEST_FIXTURES_HPP_INCLUDED
+#define NVPARSE_TEST_FIXTURES_HPP_INCLUDED
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "string.hpp"
+
+//! Fixtures shared by the test files: the page the selector engines are
+//! tested on, expressions they compare with \ref Selector on it, and
+//! conversions between c-strings, std::string and \ref String.
+namespace nvparse_test {
+//! Page every expression of \ref selector_expressions is run over. Parsing
+//! changes its text, parse a copy.
+const char selector_page[] =
+    "<html id=\"h\"><body id=\"b\">"
+    "<div id=\"d1\" class=\"a b\" lang=\"en-US\" data-x=\"foo bar\" title=\"Hello\">"
+    "<p id=\"p1\" class=\"a\">x</p><!-- c --><span id=\"s1\"></span><p id=\"p2\"><em "
+    "id=\"e1\"></em></p>"
+    "</div>"
+    "<div id=\"d2\" class=\"b\" lang=\"en\"><p id=\"p3\" class=\"c\"></p></div>"
+    "<ul id=\"u\"><li id=\"l1\"></li><li id=\"l2\" class=\"sel\"></li><li id=\"l3\"></li></ul>"
+    "</body></html>";
+
+//! Gets expressions covering every combinator, attribute operator and
+//! pseudo-class, followed by those of one engine.
+//! \param more expressions of the engine tested.
+inline std::vector<const char *> selector_expressions(std::initializer_list<const char *> more) {
+    std::vector<const char *> expressions = {
+        "p", "*", ".a.b", "#d2", "em, li.sel, #d2", "div p", "div > p.a", "body > * > p",
+        "p ~ p", "p+span", "li + li", "div ~ ul li", "[lang]", "[lang=en]", "[lang|=en]",
+        "[lang^=en-]", "[lang$=US]", "[lang*=n-U]", "[data-x~=bar]", "[title=hello i]",
+        "div:not(.a)", "p:is(.a, .c)", "div:where(#d2) p", "div:has(em)", "div:has(> p.c)",
+        "p:has(+ span)", "li:has(~ .sel)", "li:nth-child(2n+1)", "p:nth-of-type(2)",
+        "li:last-child", "p:only-of-type", ":not(div p):is(p, li)"};
+    expressions.insert(expressions.end(), more);
+    return expressions;
+}
+
+//! Views a c-string.
+inline nvparsehtml::String<char> str(const char *text) {
+    return nvparsehtml::String<char>(text, std::char_traits<char>::length(text));
+}
+//! Copies a \ref String.
+inline std::string text(const nvparsehtml::String<char> &s) {
+    return std::string(s.data(), s.length());
+}
+}  // namespace nvparse_test
+
+#endif
@@ -0,0 +1,22 @@
+#include <cstring>
+
+#include "test.hpp"
+
+// Runs every test, or those whose name contains the first argument
+int main(int argc, char **argv) {
+    size_t run = 0;
+    for (const nvparse_test::Case &c : nvparse_test::cases()) {
+        if (argc > 1 && std::strstr(c.name, argv[1]) == nullptr)
+            continue;
+        size_t before = nvparse_test::failures();
+        try {
+            c.run();
+        } catch (const std::exception &e) {
+            nvparse_test::fail(c.name, 0, std::string("unexpected exception: ") + e.what());
+        }
+        std::cout << (nvparse_test::failures() == before ? "ok   " : "FAIL ") << c.name << "\n";
+        ++run;
+    }
+    std::cout << run << " tests, " << nvparse_test::failures() << " failed checks\n";
+    return nvparse_test::failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#ifndef NVPARSE_TEST_HPP_INCLUDED
+#define NVPARSE_TEST_HPP_INCLUDED
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//! Minimal test harness: TEST(name) defines a test case that registers
+//! itself, CHECK records a failure without stopping the case, and
+//! main.cpp runs every case and returns non-zero if any check failed.
+namespace nvparse_test {
+struct Case {
+    const char *name;
+    void (*run)();
+};
+inline std::vector<Case> &cases() {
+    static std::vector<Case> registered;
+    return registered;
+}
+inline size_t &failures() {
+    static size_t count = 0;
+    return count;
+}
+inline void fail(const char *file, int line, const std::string &what) {
+    ++failures();
+    std::cerr << file << ":" << line << ": check failed: " << what << "\n";
+}
+struct Registrar {
+    Registrar(const char *name, void (*run)()) {
+        cases().push_back(Case{name, run});
+    }
+};
+}  // namespace nvparse_test
+
+#define NVPARSE_TEST_JOIN2(a, b) a##b
+#define NVPARSE_TEST_JOIN(a, b) NVPARSE_TEST_JOIN2(a, b)
+
+#define TEST(name)                                                      \
+    static void NVPARSE_TEST_JOIN(test_, name)();                       \
+    static nvparse_test::Registrar NVPARSE_TEST_JOIN(registrar_, name)( \
+        #name, &NVPARSE_TEST_JOIN(test_, name));                        \
+    static void NVPARSE_TEST_JOIN(test_, name)()
+
+#define CHECK(condition)                                        \
+    do {                                                        \
+        if (!(condition))                                       \
+            nvparse_test::fail(__FILE__, __LINE__, #condition); \
+    } while (false)
+
+#define CHECK_EQ(lhs, rhs)                                            \
+    do {                                                              \
+        if (!((lhs) == (rhs)))                                        \
+            nvparse_test::fail(__FILE__, __LINE__, #lhs " == " #rhs); \
+    } while (false)
+
+#define CHECK_THROWS(expression)                                                         \
+    do {                                                                                 \
+        bool thrown = false;                                                             \
+        try {                                                                            \
+            expression;                                                                  \
+        } catch (const std::exception &) {                                               \
+            thrown = true;                                                               \
+        }                                                                                \
+        if (!thrown)                                                                     \
+            nvparse_test::fail(__FILE__, __LINE__, "expected " #expression " to throw"); \
+    } while (false)
+
+#endif
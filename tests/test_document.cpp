@@ -0,0 +1,76 @@
+#include <memory>
+#include <string>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::text;
+
+namespace {
+const char source[] =
+    "<html><body><div id=\"d\" class=\"a\" title=\"t\"><p class=\"b\">x</p></div></body></html>";
+
+// Overwrites a buffer, so that strings still pointing into it show
+void scribble(std::string &buffer) {
+    buffer.assign(buffer.size(), '#');
+}
+}  // namespace
+
+TEST(document_adopt_copies_strings) {
+    std::string copy(source);
+    std::unique_ptr<DocumentNode<char>> from(new DocumentNode<char>());
+    from->parse(&copy[0]);
+    Node<char> *div = from->first_child()->first_child()->first_child();
+    DocumentNode<char> to;
+    Node<char> *html = to.create_node(Node<char>::NODE_ELEMENT);
+    to.append_child(html);
+    html->append_child(to.adopt(div));
+    from.reset();
+    scribble(copy);
+    CHECK(div->parent() == html);
+    CHECK_EQ(text(div->name()), "div");
+    CHECK_EQ(text(div->id()), "d");
+    CHECK(div->contains_class(String<char>("a", 1)));
+    CHECK_EQ(text(div->find_attribute(String<char>("title", 5))), "t");
+    Node<char> *p = div->first_child();
+    CHECK_EQ(text(p->name()), "p");
+    CHECK(p->contains_class(String<char>("b", 1)));
+    CHECK_EQ(text(p->value()), "x");
+}
+
+TEST(document_deep_clone_copies_strings) {
+    std::string copy(source);
+    DocumentNode<char> from;
+    from.parse(&copy[0]);
+    Node<char> *div = from.first_child()->first_child()->first_child();
+    DocumentNode<char> to;
+    Node<char> *clone = to.deep_clone(div);
+    to.append_child(clone);
+    from.clear();
+    scribble(copy);
+    CHECK(clone != div);
+    CHECK_EQ(text(clone->name()), "div");
+    CHECK_EQ(text(clone->id()), "d");
+    CHECK_EQ(text(clone->find_attribute(String<char>("title", 5))), "t");
+    CHECK_EQ(clone->children_size(), 1u);
+    CHECK_EQ(text(clone->first_child()->value()), "x");
+}
+
+TEST(document_clear_forgets_source) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.keep_original_source(true);
+    doc.parse(&copy[0]);
+    CHECK_EQ(text(doc.source()), source);
+    CHECK_EQ(text(doc.original_source()), source);
+    doc.clear();
+    CHECK(doc.source().empty());
+    CHECK(doc.original_source().empty());
+
+    std::string broken("<!-- unterminated");
+    doc.parse(&copy[0]);
+    CHECK_THROWS(doc.parse(&broken[0]));
+    CHECK(doc.source().empty());
+}
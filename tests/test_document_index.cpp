@@ -0,0 +1,155 @@
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "fixtures.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+
+namespace {
+char source[] =
+    "<html><body><div id=\"d1\" class=\"a b\"><p id=\"p1\" class=\"b\"></p></div>"
+    "<div id=\"d2\" class=\"b\"><p id=\"p2\" class=\"a\"></p></div></body></html>";
+
+// Ids of the nodes of a bitmap, comma separated
+std::string ids(const DocumentIndex<char> &index, const Bitmap &bitmap) {
+    DocumentIndex<char>::posting_list handles;
+    bitmap.handles(handles);
+    std::vector<Node<char> *> nodes;
+    index.nodes(handles, nodes);
+    std::string ids;
+    for (Node<char> *node : nodes) {
+        if (!ids.empty())
+            ids += ",";
+        ids.append(node->id().data(), node->id().length());
+    }
+    return ids;
+}
+}  // namespace
+
+TEST(document_index_bitmaps) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    CHECK_EQ(ids(index, index.class_bitmap(str("b"))), "d1,p1,d2");
+    CHECK_EQ(ids(index, index.type_bitmap(str("div"))), "d1,d2");
+    Bitmap both = index.class_bitmap(str("a"));
+    both &= index.class_bitmap(str("b"));
+    CHECK_EQ(ids(index, both), "d1");
+    Bitmap divs_a = index.type_bitmap(str("div"));
+    divs_a &= index.class_bitmap(str("a"));
+    CHECK_EQ(ids(index, divs_a), "d1");
+    CHECK_EQ(index.class_bitmap(str("missing")).count(), 0u);
+    CHECK_EQ(index.class_bitmap(str("missing")).size(), index.size());
+}
+
+TEST(document_index_bitmaps_built_once) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    std::string name("a");
+    const Bitmap &first = index.class_bitmap(String<char>(name.data(), name.size()));
+    name = "x";  // the cache must not keep the caller's string
+    CHECK(&index.class_bitmap(str("a")) == &first);
+    CHECK(&index.type_bitmap(str("p")) == &index.type_bitmap(str("p")));
+    CHECK(&index.class_bitmap(str("p")) != &index.type_bitmap(str("p")));
+    CHECK_EQ(ids(index, index.class_bitmap(str("a"))), "d1,p2");
+}
+
+namespace {
+// A page large enough to be split between four threads
+std::string large_source() {
+    std::string page = "<html><body>";
+    for (int i = 0; i < 20000; ++i) {
+        std::string n = std::to_string(i);
+        page += "<div id=\"d" + n + "\" class=\"c" + std::to_string(i % 7) + " all\" data-n=\"" +
+                std::to_string(i % 13) + "\"><p title=\"" + n + "\">x</p><br></div>";
+    }
+    return page + "</body></html>";
+}
+
+// Do both indexes hold the same keys and posting lists?
+bool same_index(const DocumentIndex<char> &a, const DocumentIndex<char> &b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t handle = 0; handle < a.size(); ++handle) {
+        if (a.node(handle) != b.node(handle))
+            return false;
+    }
+    size_t ids = 0, classes = 0, types = 0, attributes = 0;
+    for (auto it = a.ids_begin(); it != a.ids_end(); ++it, ++ids) {
+        if (b.find_id(it->first) != it->second)
+            return false;
+    }
+    for (auto it = a.classes_begin(); it != a.classes_end(); ++it, ++classes) {
+        if (b.class_postings(it->first) != it->second)
+            return false;
+    }
+    for (auto it = a.types_begin(); it != a.types_end(); ++it, ++types) {
+        if (b.type_postings(it->first) != it->second)
+            return false;
+    }
+    for (auto it = a.attributes_begin(); it != a.attributes_end(); ++it, ++attributes) {
+        if (b.attribute_postings_of(it->first) != it->second.nodes ||
+            b.values_indexed(it->first) != it->second.values_indexed)
+            return false;
+    }
+    for (auto it = b.ids_begin(); it != b.ids_end(); ++it)
+        --ids;
+    for (auto it = b.classes_begin(); it != b.classes_end(); ++it)
+        --classes;
+    for (auto it = b.types_begin(); it != b.types_end(); ++it)
+        --types;
+    for (auto it = b.attributes_begin(); it != b.attributes_end(); ++it)
+        --attributes;
+    return ids == 0 && classes == 0 && types == 0 && attributes == 0;
+}
+}  // namespace
+
+TEST(document_index_parallel) {
+    std::string copy = large_source();
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    for (unsigned threads : {1u, 2u, 4u}) {
+        DocumentIndex<char> parallel(&doc, threads);
+        CHECK(same_index(index, parallel));
+        CHECK(parallel.attribute_value_postings(str("data-n"), str("5")) ==
+              index.attribute_value_postings(str("data-n"), str("5")));
+        CHECK(parallel.attribute_value_postings(str("title"), str("19999")) ==
+              index.attribute_value_postings(str("title"), str("19999")));
+    }
+    std::vector<String<char>> values{str("data-n")};
+    DocumentIndex<char> some(&doc, values);
+    DocumentIndex<char> parallel(&doc, values, 4);
+    CHECK(same_index(some, parallel));
+    CHECK(!parallel.values_indexed(str("title")));
+    CHECK_EQ(parallel.attribute_value_postings(str("data-n"), str("12")).size(), 1538u);
+}
+
+TEST(document_index_keeps_value_attribute_names) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    {
+        std::string name("id");
+        doc.index_on_parse(std::vector<String<char>>{String<char>(name.data(), name.size())});
+        name = "xx";  // neither the document nor the index may keep the caller's string
+    }
+    doc.parse(&copy[0]);
+    CHECK(doc.index() != nullptr);
+    CHECK(doc.index()->values_indexed(str("id")));
+    CHECK(!doc.index()->values_indexed(str("class")));
+    CHECK_EQ(doc.index()->attribute_value_postings(str("id"), str("p2")).size(), 1u);
+
+    std::string name("id");
+    std::vector<String<char>> names{String<char>(name.data(), name.size())};
+    DocumentIndex<char> index(&doc, names);
+    name = "xx";
+    CHECK(index.values_indexed(str("id")));
+    CHECK_EQ(index.attribute_value_postings(str("id"), str("d1")).size(), 1u);
+}
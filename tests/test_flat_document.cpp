@@ -0,0 +1,67 @@
+#include <memory>
+#include <string>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "flat_document.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+using nvparse_test::text;
+
+namespace {
+const char source[] =
+    "<html><body><div id=\"d\" class=\"a b\" title=\"t\"><p class=\"a\">x</p></div></body></html>";
+}  // namespace
+
+TEST(flat_document_mirrors_nodes) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    FlatDocument<char> flat(doc);
+    CHECK_EQ(flat.size(), 5u);
+    FlatNode<char> div = flat.at(3);
+    CHECK_EQ(text(div.name()), "div");
+    CHECK_EQ(text(div.id()), "d");
+    CHECK(div.contains_class(str("b")));
+    std::string classes;
+    for (auto it = div.class_begin(); it != div.class_end(); ++it)
+        classes += text(*it) + ";";
+    CHECK_EQ(classes, "a;b;");
+    std::string attributes;
+    for (auto it = div.attribute_begin(); it != div.attribute_end(); ++it)
+        attributes += text(it->first) + "=" + text((*it).second) + ";";
+    CHECK_EQ(attributes, "id=d;title=t;");
+    CHECK_EQ(div.attributes_size(), 2u);
+    CHECK_EQ(div.children_size(), 1u);
+    CHECK_EQ(text((*div.child_begin()).value()), "x");
+}
+
+TEST(flat_document_copies_strings_outside_source) {
+    std::string copy(source);
+    std::unique_ptr<DocumentNode<char>> doc(new DocumentNode<char>());
+    doc->parse(&copy[0]);
+    Node<char> *body = doc->first_child()->first_child();
+    body->append_child(doc->deep_clone(body->first_child()));
+    Node<char> *added = doc->create_node(Node<char>::NODE_ELEMENT);
+    added->name(doc->allocate_string(str("section")));
+    added->value(doc->allocate_string(str("v")));
+    added->add_class(doc->allocate_string(str("new")));
+    added->add_attribute(doc->allocate_string(str("lang")), doc->allocate_string(str("en")));
+    body->append_child(added);
+
+    FlatDocument<char> flat(*doc);
+    doc.reset();
+    CHECK_EQ(flat.size(), 8u);
+    FlatNode<char> clone = flat.at(5);
+    CHECK_EQ(text(clone.name()), "div");
+    CHECK_EQ(text(clone.find_attribute(str("title"))), "t");
+    CHECK(clone.contains_class(str("a")));
+    FlatNode<char> section = flat.at(7);
+    CHECK_EQ(text(section.name()), "section");
+    CHECK_EQ(text(section.value()), "v");
+    CHECK(flat.value_span(7).offset >= flat.source().length());
+    CHECK(section.contains_class(str("new")));
+    CHECK_EQ(text(section.find_attribute(str("lang"))), "en");
+}
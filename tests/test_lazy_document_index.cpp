@@ -0,0 +1,81 @@
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "fixtures.hpp"
+#include "lazy_document_index.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+
+namespace {
+char source[] =
+    "<html><body><div id=\"d1\" class=\"a b\" lang=\"en\"><p id=\"p1\" class=\"b\"></p></div>"
+    "<div id=\"d2\" class=\"b\"><p id=\"p2\" class=\"a\" lang=\"fr\"></p><br></div>"
+    "</body></html>";
+}  // namespace
+
+TEST(lazy_document_index_matches_document_index) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    LazyDocumentIndex<char> lazy(&doc);
+    const char *names[] = {"a", "b", "div", "p", "br", "lang", "missing"};
+    for (const char *name : names) {
+        CHECK(lazy.class_postings(str(name)) == index.class_postings(str(name)));
+        CHECK(lazy.type_postings(str(name)) == index.type_postings(str(name)));
+        CHECK(lazy.attribute_postings_of(str(name)).nodes ==
+              index.attribute_postings_of(str(name)));
+    }
+    CHECK(lazy.find_id(str("p2")) == index.find_id(str("p2")));
+    CHECK(lazy.find_id(str("missing")) == LazyDocumentIndex<char>::npos);
+    CHECK_EQ(lazy.size(), index.size());
+    std::vector<Node<char> *> nodes;
+    lazy.get_by_attribute(str("lang"), str("fr"), nodes);
+    CHECK(nodes.size() == 1 && nodes[0] == index.get_by_id(str("p2")));
+}
+
+TEST(lazy_document_index_requested_keys) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    LazyDocumentIndex<char> lazy(&doc);
+    lazy.request_class(str("a"));
+    lazy.request_type(str("p"));
+    lazy.request_id(str("d2"));
+    lazy.resolve();
+    const LazyDocumentIndex<char>::posting_list &classes = lazy.class_postings(str("a"));
+    // Later keys must not move the posting lists already handed out
+    lazy.class_postings(str("b"));
+    lazy.type_postings(str("div"));
+    CHECK(&lazy.class_postings(str("a")) == &classes);
+    CHECK_EQ(classes.size(), 2u);
+    CHECK_EQ(lazy.type_postings(str("p")).size(), 2u);
+    CHECK(lazy.get_by_id(str("d2")) != nullptr);
+    CHECK(lazy.get_by_class(str("a")) == lazy.get_by_id(str("d1")));
+}
+
+TEST(lazy_document_index_keeps_own_keys) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    LazyDocumentIndex<char> lazy(&doc);
+    std::string name("a");
+    std::string id("d2");
+    const LazyDocumentIndex<char>::posting_list &classes =
+        lazy.class_postings(String<char>(name.data(), name.size()));
+    const LazyDocumentIndex<char>::attribute_postings &attributes =
+        lazy.attribute_postings_of(String<char>(name.data(), name.size()));
+    lazy.find_id(String<char>(id.data(), id.size()));
+    name = "x";  // the index must not keep the caller's strings
+    id = "xx";
+    CHECK(&lazy.class_postings(str("a")) == &classes);
+    CHECK(&lazy.attribute_postings_of(str("a")) == &attributes);
+    CHECK_EQ(classes.size(), 2u);
+    CHECK(lazy.class_postings(str("x")).empty());
+    CHECK(lazy.get_by_id(str("d2")) != nullptr);
+    CHECK(lazy.find_id(str("xx")) == LazyDocumentIndex<char>::npos);
+}
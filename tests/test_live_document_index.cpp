@@ -0,0 +1,87 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "live_document_index.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+
+namespace {
+char source[] =
+    "<html><body><div id=\"d1\" class=\"a\"><p id=\"p1\" class=\"b\"></p></div>"
+    "<div id=\"d2\" class=\"b\" lang=\"en\"></div></body></html>";
+
+// Ids of the nodes of a posting list, comma separated
+std::string ids(const LiveDocumentIndex<char> &index,
+                const LiveDocumentIndex<char>::posting_list &postings) {
+    std::vector<Node<char> *> nodes;
+    index.nodes(postings, nodes);
+    std::string ids;
+    for (Node<char> *node : nodes) {
+        if (!ids.empty())
+            ids += ",";
+        ids.append(node->id().data(), node->id().length());
+    }
+    return ids;
+}
+}  // namespace
+
+TEST(live_document_index_follows_changes) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    LiveDocumentIndex<char> index(&doc);
+    CHECK_EQ(ids(index, index.class_postings(str("b"))), "p1,d2");
+    Node<char> *d1 = index.get_by_class(str("a"));
+    Node<char> *d2 = index.get_by_class(str("b"))->parent()->next_sibling();
+    d2->add_class(str("a"));
+    CHECK_EQ(ids(index, index.class_postings(str("a"))), "d1,d2");
+    d1->remove_class(str("a"));
+    CHECK_EQ(ids(index, index.class_postings(str("a"))), "d2");
+    Node<char> *p = doc.create_node(Node<char>::NODE_ELEMENT);
+    p->id(str("p2"));
+    p->add_class(str("b"));
+    d1->prepend_child(p);
+    CHECK_EQ(ids(index, index.class_postings(str("b"))), "p2,p1,d2");
+    d1->remove_child(p);
+    CHECK_EQ(ids(index, index.class_postings(str("b"))), "p1,d2");
+}
+
+TEST(live_document_index_unowned_nodes) {
+    // Declared first, so that it outlives the document it is linked into
+    Node<char> orphan;
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    LiveDocumentIndex<char> index(&doc);
+    Node<char> *d2 = index.get_by_class(str("b"))->parent()->next_sibling();
+    orphan.id(str("o"));
+    d2->append_child(&orphan);
+    CHECK_EQ(ids(index, index.class_postings(str("z"))), "");
+    orphan.add_class(str("z"));
+    CHECK_EQ(ids(index, index.class_postings(str("z"))), "o");
+    orphan.add_attribute(str("title"), str("t"));
+    CHECK_EQ(ids(index, index.attribute_postings_of(str("title"))), "o");
+    orphan.id(str("o2"));
+    CHECK(index.get_by_id(str("o2")) == &orphan);
+    CHECK(index.get_by_id(str("o")) == nullptr);
+    orphan.remove_class(str("z"));
+    CHECK_EQ(ids(index, index.class_postings(str("z"))), "");
+    d2->remove_child(&orphan);
+}
+
+TEST(live_document_index_outlives_document) {
+    std::string copy(source);
+    std::unique_ptr<DocumentNode<char>> doc(new DocumentNode<char>());
+    doc->parse(&copy[0]);
+    LiveDocumentIndex<char> index(doc.get());
+    CHECK(index.size() > 0);
+    doc.reset();
+    CHECK(index.document() == nullptr);
+    CHECK_EQ(index.size(), 0u);
+    CHECK(index.class_postings(str("a")).empty());
+}
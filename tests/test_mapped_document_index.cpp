@@ -0,0 +1,101 @@
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "fixtures.hpp"
+#include "mapped_document_index.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+
+namespace {
+const char source[] =
+    "<p class=\"a\">&lt;b&gt;x</p><div id='d' title=\"&amp;\" class=\"a b\"><i></i></div>";
+
+// Serialized index, in words so that it is aligned as the reader wants
+struct serialized {
+    std::vector<uint64_t> words;
+    size_t size;
+
+    serialized(const DocumentIndex<char> &index) {
+        std::ostringstream out;
+        MappedDocumentIndex<char>::write(index, out);
+        std::string bytes = out.str();
+        words.resize((bytes.size() + 7) / 8);
+        std::memcpy(words.data(), bytes.data(), bytes.size());
+        size = bytes.size();
+    }
+    unsigned char *bytes() {
+        return reinterpret_cast<unsigned char *>(words.data());
+    }
+};
+}  // namespace
+
+TEST(mapped_document_index_round_trip) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.keep_original_source(true);
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    serialized data(index);
+    MappedDocumentIndex<char> mapped(data.bytes(), data.size);
+    CHECK_EQ(mapped.size(), index.size());
+    CHECK(mapped.source() == str(source));
+    CHECK_EQ(mapped.find_id(str("d")), index.find_id(str("d")));
+    CHECK_EQ(mapped.class_postings(str("a")).size(), 2u);
+    MappedDocumentIndex<char>::posting_list found;
+    mapped.get_by_attribute(str("title"), str("&"), found);
+    CHECK_EQ(found.size(), 1u);
+
+    // The stored source parses into the same numbering
+    std::string again(mapped.source().data(), mapped.source().length());
+    DocumentNode<char> reparsed;
+    reparsed.parse(&again[0]);
+    DocumentIndex<char> reindexed(&reparsed);
+    CHECK_EQ(reindexed.size(), mapped.size());
+    for (size_t handle = 0; handle < reindexed.size(); ++handle) {
+        Node<char> *node = reindexed.node(static_cast<uint32_t>(handle));
+        CHECK(node->name() == index.node(static_cast<uint32_t>(handle))->name());
+        CHECK(node->value() == index.node(static_cast<uint32_t>(handle))->value());
+    }
+}
+
+TEST(mapped_document_index_without_source) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    serialized data(index);
+    MappedDocumentIndex<char> mapped(data.bytes(), data.size);
+    CHECK(mapped.source().empty());
+    CHECK_EQ(mapped.find_id(str("d")), index.find_id(str("d")));
+    CHECK_EQ(mapped.type_postings(str("i")).size(), 1u);
+}
+
+TEST(mapped_document_index_corrupt) {
+    std::string copy(source);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    serialized data(index);
+    CHECK_THROWS(MappedDocumentIndex<char>(data.bytes(), 16));
+    CHECK_THROWS(MappedDocumentIndex<char>(data.bytes(), data.size - 8));
+
+    // Header: magic, five 32 bit fields, then an offset and a count per section
+    uint64_t classes;  // first class entry: key offset and length, first posting, count
+    std::memcpy(&classes, data.bytes() + 24 + 2 * 16, sizeof(classes));
+    uint32_t first = 0xFFFFFFF0;
+    std::memcpy(data.bytes() + classes + 8, &first, sizeof(first));
+    CHECK_THROWS(MappedDocumentIndex<char>(data.bytes(), data.size));
+    first = 0;
+    std::memcpy(data.bytes() + classes + 8, &first, sizeof(first));
+    MappedDocumentIndex<char>(data.bytes(), data.size);
+    uint32_t length = 0x7FFFFFFF;
+    std::memcpy(data.bytes() + classes + 4, &length, sizeof(length));
+    CHECK_THROWS(MappedDocumentIndex<char>(data.bytes(), data.size));
+}
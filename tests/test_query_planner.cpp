@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "document_index.hpp"
+#include "fixtures.hpp"
+#include "query_planner.hpp"
+#include "selector.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::str;
+using nvparse_test::selector_expressions;
+using nvparse_test::selector_page;
+
+TEST(query_planner_matches_selector) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    index.index_patterns(str("lang"));
+    Node<char> *d1 = index.get_by_id(str("d1"));
+    Node<char> *roots[] = {&doc, d1};
+    // Selectors with an empty key are dropped from the plan
+    for (const char *expression : selector_expressions({"p.missing", "p, .missing"})) {
+        Selector selector(expression);
+        QueryPlanner<char> planner(selector, &index);
+        for (Node<char> *root : roots) {
+            std::vector<Node<char> *> expected, results;
+            selector.select_all(root, expected);
+            planner.select_all(root, results);
+            CHECK(results == expected);
+            CHECK(planner.select_first(root) == (expected.empty() ? nullptr : expected[0]));
+            CHECK(planner.exists(root) == !expected.empty());
+            for (size_t limit = 1; limit <= expected.size(); ++limit) {
+                std::vector<Node<char> *> some;
+                planner.select_n(root, limit, some);
+                CHECK(some.size() == limit);
+                CHECK(std::equal(some.begin(), some.end(), expected.begin()));
+            }
+        }
+    }
+}
+
+TEST(query_planner_seeds) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    DocumentIndex<char> index(&doc);
+    index.index_patterns(str("lang"));
+    typedef QueryPlanner<char> Planner;
+
+    CHECK(Planner(Selector("p.c"), nullptr).scans());
+    CHECK(Planner(Selector("*"), &index).scans());
+    CHECK(Planner(Selector("p, :first-child"), &index).scans());
+
+    // The smallest posting list of the rightmost compound
+    Planner classes(Selector("div p.c"), &index);
+    CHECK(!classes.scans());
+    CHECK_EQ(classes.seeds().size(), 1u);
+    CHECK(classes.seeds()[0].kind == Planner::SEED_CLASS);
+    CHECK_EQ(classes.estimate(), 1u);
+
+    Planner values(Selector("[lang=en]"), &index);
+    CHECK_EQ(values.seeds().size(), 1u);
+    CHECK(values.seeds()[0].kind == Planner::SEED_VALUE);
+    CHECK_EQ(values.estimate(), 1u);
+
+    Planner patterns(Selector("[lang^=en]"), &index);
+    CHECK_EQ(patterns.seeds().size(), 1u);
+    CHECK(patterns.seeds()[0].kind == Planner::SEED_PATTERN);
+
+    // An empty key anywhere drops its selector
+    Planner missing(Selector(".missing p, li"), &index);
+    CHECK(!missing.scans());
+    CHECK_EQ(missing.seeds().size(), 1u);
+    CHECK(missing.seeds()[0].kind == Planner::SEED_TYPE);
+    CHECK_EQ(missing.estimate(), 3u);
+}
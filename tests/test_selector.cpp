@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "selector.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::selector_page;
+
+namespace {
+// Ids of the matches under root, comma separated, checking select_first agrees
+std::string select(Node<char> *root, const char *expression) {
+    Selector selector(expression);
+    std::vector<Node<char> *> results;
+    selector.select_all(root, results);
+    CHECK(selector.select_first(root) == (results.empty() ? nullptr : results[0]));
+    std::string ids;
+    for (Node<char> *node : results) {
+        if (!ids.empty())
+            ids += ",";
+        ids.append(node->id().data(), node->id().length());
+    }
+    return ids;
+}
+}  // namespace
+
+TEST(selector_types_classes_ids) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    CHECK_EQ(select(&doc, "p"), "p1,p2,p3");
+    CHECK_EQ(select(&doc, "P"), "p1,p2,p3");
+    CHECK_EQ(select(&doc, ".a"), "d1,p1");
+    CHECK_EQ(select(&doc, ".a.b"), "d1");
+    CHECK_EQ(select(&doc, "em, li.sel, #d2"), "e1,d2,l2");
+    CHECK_EQ(select(&doc, "div "), "d1,d2");
+    CHECK_EQ(select(&doc, "  ul\tli "), "l1,l2,l3");
+}
+
+TEST(selector_combinators) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    CHECK_EQ(select(&doc, "div p"), "p1,p2,p3");
+    CHECK_EQ(select(&doc, "div > p.a"), "p1");
+    CHECK_EQ(select(&doc, "#d1>em"), "");
+    CHECK_EQ(select(&doc, "body > * > p"), "p1,p2,p3");
+    CHECK_EQ(select(&doc, "p ~ p"), "p2");
+    CHECK_EQ(select(&doc, "p+span"), "s1");
+    CHECK_EQ(select(&doc, "span + p"), "p2");
+    CHECK_EQ(select(&doc, "li + li"), "l2,l3");
+    CHECK_EQ(select(&doc, ".sel ~ li"), "l3");
+    CHECK_EQ(select(&doc, "div ~ ul li"), "l1,l2,l3");
+}
+
+TEST(selector_attributes) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    CHECK_EQ(select(&doc, "[lang]"), "d1,d2");
+    CHECK_EQ(select(&doc, "[lang=en]"), "d2");
+    CHECK_EQ(select(&doc, "[lang='en-US']"), "d1");
+    CHECK_EQ(select(&doc, "[lang|=en]"), "d1,d2");
+    CHECK_EQ(select(&doc, "[lang^=en-]"), "d1");
+    CHECK_EQ(select(&doc, "[lang$=US]"), "d1");
+    CHECK_EQ(select(&doc, "[lang*=n-U]"), "d1");
+    CHECK_EQ(select(&doc, "[data-x~=bar]"), "d1");
+    CHECK_EQ(select(&doc, "[data-x~=ba]"), "");
+    CHECK_EQ(select(&doc, "[title=hello i]"), "d1");
+    CHECK_EQ(select(&doc, "[title=hello]"), "");
+}
+
+TEST(selector_logical_pseudo_classes) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    CHECK_EQ(select(&doc, "div:not(.a)"), "d2");
+    CHECK_EQ(select(&doc, "p:is(.a, .c)"), "p1,p3");
+    CHECK_EQ(select(&doc, "div:where(#d2) p"), "p3");
+    CHECK_EQ(select(&doc, "div:has(em)"), "d1");
+    CHECK_EQ(select(&doc, "div:has(> em)"), "");
+    CHECK_EQ(select(&doc, "div:has(> p.c)"), "d2");
+    CHECK_EQ(select(&doc, "p:has(+ span)"), "p1");
+    CHECK_EQ(select(&doc, "li:has(~ .sel)"), "l1");
+}
+
+TEST(selector_scoped_to_root) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *d1 = Selector("#d1").select_first(static_cast<Node<char> *>(&doc));
+    CHECK(d1 != nullptr);
+    CHECK_EQ(select(d1, "> p"), "p1,p2");
+    CHECK_EQ(select(d1, "p"), "p1,p2");
+    CHECK_EQ(select(d1, "body p"), "p1,p2");
+    CHECK_EQ(select(d1, "div"), "");
+    CHECK(Selector("div.a").match(d1));
+    CHECK(!Selector("div.c").match(d1));
+}
+
+TEST(selector_memo_scoped_to_root) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *d1 = Selector("#d1").select_first(static_cast<Node<char> *>(&doc));
+    CHECK(d1 != nullptr);
+    // Answers for the ancestors of the root are kept outside its subtree
+    CHECK_EQ(select(d1, "body:has(ul) p"), "p1,p2");
+    CHECK_EQ(select(d1, "body:has(> ul) :has(> em)"), "p2");
+    CHECK_EQ(select(d1, ":not(body > ul) > p:has(em)"), "p2");
+    CHECK_EQ(select(d1, "div:has(~ ul) p:nth-child(3)"), "p2");
+    CHECK_EQ(select(d1, "html:has(.sel) em"), "e1");
+}
+
+TEST(selector_limited_walks) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *root = &doc;
+    // Walks that may stop early keep answers per Node instead of per subtree
+    const char *expressions[] = {"p:first-child", "li:nth-child(2n+1)", "p:nth-of-type(2)",
+                                 "li:last-child", "div:has(> p.c)", "body:has(em) p",
+                                 ":not(div p):is(p, li)", "p:only-of-type", "span:first-of-type"};
+    for (const char *expression : expressions) {
+        Selector selector(expression);
+        std::vector<Node<char> *> all;
+        selector.select_all(root, all);
+        for (size_t limit = 1; limit <= all.size() + 1; ++limit) {
+            std::vector<Node<char> *> some;
+            selector.select_n(root, limit, some);
+            CHECK(some.size() == std::min(limit, all.size()));
+            CHECK(std::equal(some.begin(), some.end(), all.begin()));
+        }
+        CHECK(selector.exists(root) == !all.empty());
+    }
+    CHECK_EQ(select(&doc, "li:nth-child(2n+1)"), "l1,l3");
+    CHECK_EQ(select(&doc, "p:nth-of-type(2)"), "p2");
+}
+
+TEST(selector_errors) {
+    CHECK_THROWS(Selector("a || b"));
+    CHECK_THROWS(Selector("a:hover"));
+    CHECK_THROWS(Selector("div:is(p"));
+    CHECK_THROWS(Selector("["));
+}
@@ -0,0 +1,82 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "document.hpp"
+#include "selector.hpp"
+#include "selector_cache.hpp"
+#include "test.hpp"
+
+using namespace nvparsehtml;
+
+TEST(selector_cache_hits_and_misses) {
+    SelectorCache cache(10, 4);
+    CHECK_EQ(cache.capacity(), 12u);
+    SelectorCache::selector_ptr first = cache.get("div > p");
+    CHECK(cache.get(std::string("div > p")) == first);
+    CHECK(cache.get("div p") != first);
+    CHECK_EQ(cache.hits(), 1u);
+    CHECK_EQ(cache.misses(), 2u);
+    CHECK_EQ(cache.size(), 2u);
+    // Parsing errors are thrown every time
+    CHECK_THROWS(cache.get("a || b"));
+    CHECK_THROWS(cache.get("a || b"));
+    CHECK_EQ(cache.size(), 2u);
+    cache.clear();
+    CHECK_EQ(cache.size(), 0u);
+    CHECK(cache.get("div > p") != first);
+    CHECK_EQ(cache.hits(), 1u);
+}
+
+TEST(selector_cache_clock_eviction) {
+    SelectorCache cache(2, 1);
+    SelectorCache::selector_ptr a = cache.get("a");
+    SelectorCache::selector_ptr b = cache.get("b");
+    cache.get("a");  // referenced, survives the next pass of the hand
+    SelectorCache::selector_ptr c = cache.get("c");
+    CHECK_EQ(cache.size(), 2u);
+    CHECK(cache.get("a") == a);
+    CHECK(cache.get("c") == c);
+    CHECK(cache.get("b") != b);
+    // Evicted selectors stay usable
+    std::string source = "<b id=\"x\"></b>";
+    DocumentNode<char> doc;
+    doc.parse(&source[0]);
+    CHECK(b->select_first(&doc) != nullptr);
+}
+
+TEST(selector_cache_threads) {
+    std::string source = "<div><p></p><p></p></div><ul><li></li><li></li><li></li></ul>";
+    DocumentNode<char> doc;
+    doc.parse(&source[0]);
+    Node<char> *root = &doc;
+    // Each expression finds a different number of Nodes, 0 to 7
+    const char *expressions[] = {"none", "div", "p", "li", "ul, li", "p, li", "*"};
+    const size_t count = sizeof(expressions) / sizeof(expressions[0]);
+    std::vector<size_t> expected;
+    for (const char *expression : expressions) {
+        std::vector<Node<char> *> results;
+        Selector(expression).select_all(root, results);
+        expected.push_back(results.size());
+    }
+    SelectorCache cache(4, 2);
+    std::atomic<size_t> mismatches(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < 500; ++i) {
+                size_t e = (i * 3 + t) % count;
+                std::vector<Node<char> *> results;
+                cache.get(expressions[e])->select_all(root, results);
+                if (results.size() != expected[e])
+                    ++mismatches;
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    CHECK_EQ(mismatches.load(), 0u);
+    CHECK_EQ(cache.hits() + cache.misses(), 2000u);
+    CHECK(cache.size() <= cache.capacity());
+}
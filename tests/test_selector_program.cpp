@@ -0,0 +1,77 @@
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "selector.hpp"
+#include "selector_program.hpp"
+#include "test.hpp"
+#include "traverse.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::selector_expressions;
+using nvparse_test::selector_page;
+
+TEST(selector_program_matches_selector) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *root = &doc;
+    // Names are folded to lower case as they are compiled
+    for (const char *expression : selector_expressions({"P", "DIV > p.a"})) {
+        Selector selector(expression);
+        SelectorProgram<char> program(selector);
+        CHECK(!program.code().empty());
+        std::vector<Node<char> *> expected, results;
+        selector.select_all(root, expected);
+        program.select_all(root, results);
+        CHECK(results == expected);
+        CHECK(program.select_first(root) == (expected.empty() ? nullptr : expected[0]));
+        CHECK(program.exists(root) == !expected.empty());
+        std::vector<Node<char> *> first;
+        program.select_n(root, 1, first);
+        CHECK(first.size() == (expected.empty() ? 0u : 1u));
+        size_t mismatches = 0;
+        for (Node<char> *node : pre_order(root)) {
+            if (program.match(node) != selector.match(node))
+                ++mismatches;
+        }
+        CHECK_EQ(mismatches, 0u);
+    }
+}
+
+TEST(selector_program_relative) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *d1 = Selector("#d1").select_first(static_cast<Node<char> *>(&doc));
+    CHECK(d1 != nullptr);
+    Selector selector("> p");
+    SelectorProgram<char> program(selector);
+    std::vector<Node<char> *> expected, results;
+    selector.select_all(d1, expected);
+    program.select_all(d1, results);
+    CHECK_EQ(results.size(), 2u);
+    CHECK(results == expected);
+    CHECK(program.match(results[0], d1));
+    CHECK(!program.match(results[0], &doc));
+}
+
+TEST(selector_program_copies) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    std::vector<Node<char> *> expected;
+    Selector("p.c, [lang=en]").select_all(&doc, expected);
+    SelectorProgram<char> *original = new SelectorProgram<char>(Selector("p.c, [lang=en]"));
+    SelectorProgram<char> copied(*original);
+    SelectorProgram<char> assigned(Selector("em"));
+    assigned = *original;
+    delete original;  // the copies must not point into its strings
+    std::vector<Node<char> *> results;
+    copied.select_all(&doc, results);
+    CHECK(results == expected);
+    results.clear();
+    assigned.select_all(&doc, results);
+    CHECK(results == expected);
+}
@@ -0,0 +1,48 @@
+#include <string>
+#include <vector>
+
+#include "document.hpp"
+#include "fixtures.hpp"
+#include "selector.hpp"
+#include "selector_set.hpp"
+#include "test.hpp"
+#include "traverse.hpp"
+
+using namespace nvparsehtml;
+using nvparse_test::selector_expressions;
+using nvparse_test::selector_page;
+
+TEST(selector_set_matches_selectors) {
+    std::string copy(selector_page);
+    DocumentNode<char> doc;
+    doc.parse(&copy[0]);
+    Node<char> *root = &doc;
+    SelectorSet<char> set;
+    // Rules filed under ids and classes, with shared ancestors or matched twice
+    std::vector<const char *> expressions = selector_expressions(
+        {"body div > p.a", "body:has(em) p", "p, div p", "ul .missing", "#d1 em, #d2 p"});
+    for (const char *expression : expressions)
+        set.add(expression);
+    CHECK_EQ(set.size(), expressions.size());
+    Node<char> *d1 = Selector("#d1").select_first(root);
+    Node<char> *roots[] = {root, d1};
+    for (Node<char> *from : roots) {
+        std::vector<std::vector<Node<char> *>> results;
+        set.select_all(from, results);
+        CHECK_EQ(results.size(), set.size());
+        for (size_t number = 0; number < set.size(); ++number) {
+            std::vector<Node<char> *> expected;
+            set.selector(number).select_all(from, expected);
+            CHECK(results[number] == expected);
+        }
+    }
+    for (Node<char> *node : pre_order(root)) {
+        std::vector<size_t> numbers, expected;
+        set.match(node, numbers);
+        for (size_t number = 0; number < set.size(); ++number) {
+            if (set.selector(number).match(node))
+                expected.push_back(number);
+        }
+        CHECK(numbers == expected);
+    }
+}
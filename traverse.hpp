@@ -0,0 +1,349 @@
+#ifndef NVPARSE_TRAVERSE_HPP_INCLUDED
+#define NVPARSE_TRAVERSE_HPP_INCLUDED
+
+#include <cstddef>
+#include <iterator>
+
+#include "node.hpp"
+#include "string.hpp"
+
+namespace nvparsehtml {
+//! Walks a subtree depth first without recursion or an explicit stack.
+//! Every \ref Node is visited twice: once when entering it, before its
+//! descendants, and once when leaving it, after its descendants.
+template <typename Ch>
+class TreeWalker {
+   public:
+    //! Starts a walk by entering root.
+    //! \param root \ref Node whose subtree is walked, may be nullptr.
+    TreeWalker(Node<Ch> *root) : m_root(root), m_node(root), m_entering(true), m_skip(false) {
+    }
+    //! Has the walk left the root?
+    //! \return whether there are no more steps.
+    bool done() const {
+        return m_node == nullptr;
+    }
+    //! Gets the current \ref Node.
+    //! \return \ref Node pointer, nullptr when done.
+    Node<Ch> *node() const {
+        return m_node;
+    }
+    //! Is the current step entering the \ref Node?
+    //! \return true when entering, false when leaving.
+    bool entering() const {
+        return m_entering;
+    }
+    //! Leaves the current \ref Node on the next step without visiting its
+    //! descendants. Only meaningful while entering.
+    void skip_children() {
+        m_skip = true;
+    }
+    //! Advances to the next step.
+    void next() {
+        if (m_entering) {
+            Node<Ch> *child = m_skip ? nullptr : m_node->first_child();
+            if (child != nullptr)
+                m_node = child;
+            else
+                m_entering = false;
+            m_skip = false;
+            return;
+        }
+        if (m_node == m_root) {
+            m_node = nullptr;
+            return;
+        }
+        Node<Ch> *sibling = m_node->next_sibling();
+        if (sibling != nullptr) {
+            m_node = sibling;
+            m_entering = true;
+        } else {
+            m_node = m_node->parent();
+        }
+    }
+
+   private:
+    Node<Ch> *m_root;
+    Node<Ch> *m_node;
+    bool m_entering;
+    bool m_skip;
+};
+
+//! Visits every \ref Node of a subtree in pre-order, parents before children
+template <typename Ch>
+class PreOrderIterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Node<Ch> *value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef Node<Ch> *const *pointer;
+    typedef Node<Ch> *const &reference;
+
+    //! Creates the end iterator.
+    PreOrderIterator() : m_root(nullptr), m_node(nullptr) {
+    }
+    //! Creates an iterator positioned at root.
+    //! \param root \ref Node whose subtree is visited.
+    PreOrderIterator(Node<Ch> *root) : m_root(root), m_node(root) {
+    }
+    reference operator*() const {
+        return m_node;
+    }
+    pointer operator->() const {
+        return &m_node;
+    }
+    PreOrderIterator &operator++() {
+        Node<Ch> *child = m_node->first_child();
+        if (child != nullptr) {
+            m_node = child;
+            return *this;
+        }
+        this->skip_children();
+        return *this;
+    }
+    PreOrderIterator operator++(int) {
+        PreOrderIterator it = *this;
+        ++(*this);
+        return it;
+    }
+    //! Advances past the descendants of the current \ref Node.
+    void skip_children() {
+        while (m_node != m_root && m_node->next_sibling() == nullptr)
+            m_node = m_node->parent();
+        m_node = m_node == m_root ? nullptr : m_node->next_sibling();
+    }
+    bool operator==(const PreOrderIterator &rhs) const {
+        return m_node == rhs.m_node;
+    }
+    bool operator!=(const PreOrderIterator &rhs) const {
+        return m_node != rhs.m_node;
+    }
+
+   private:
+    Node<Ch> *m_root;
+    Node<Ch> *m_node;
+};
+
+//! Visits every \ref Node of a subtree in post-order, children before parents
+template <typename Ch>
+class PostOrderIterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Node<Ch> *value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef Node<Ch> *const *pointer;
+    typedef Node<Ch> *const &reference;
+
+    //! Creates the end iterator.
+    PostOrderIterator() : m_root(nullptr), m_node(nullptr) {
+    }
+    //! Creates an iterator positioned at the first leaf of root.
+    //! \param root \ref Node whose subtree is visited.
+    PostOrderIterator(Node<Ch> *root) : m_root(root), m_node(first_leaf(root)) {
+    }
+    reference operator*() const {
+        return m_node;
+    }
+    pointer operator->() const {
+        return &m_node;
+    }
+    PostOrderIterator &operator++() {
+        if (m_node == m_root)
+            m_node = nullptr;
+        else if (m_node->next_sibling() != nullptr)
+            m_node = first_leaf(m_node->next_sibling());
+        else
+            m_node = m_node->parent();
+        return *this;
+    }
+    PostOrderIterator operator++(int) {
+        PostOrderIterator it = *this;
+        ++(*this);
+        return it;
+    }
+    bool operator==(const PostOrderIterator &rhs) const {
+        return m_node == rhs.m_node;
+    }
+    bool operator!=(const PostOrderIterator &rhs) const {
+        return m_node != rhs.m_node;
+    }
+
+   private:
+    Node<Ch> *m_root;
+    Node<Ch> *m_node;
+
+    static Node<Ch> *first_leaf(Node<Ch> *node) {
+        if (node == nullptr)
+            return nullptr;
+        while (node->first_child() != nullptr)
+            node = node->first_child();
+        return node;
+    }
+};
+
+//! Skips the \ref Node s of another traversal iterator that fail a predicate
+template <class Iterator, class Pred>
+class FilteredIterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename Iterator::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename Iterator::pointer pointer;
+    typedef typename Iterator::reference reference;
+
+    FilteredIterator(Iterator it, Pred pred) : m_it(it), m_pred(pred) {
+        this->satisfy();
+    }
+    reference operator*() const {
+        return *m_it;
+    }
+    pointer operator->() const {
+        return m_it.operator->();
+    }
+    FilteredIterator &operator++() {
+        ++m_it;
+        this->satisfy();
+        return *this;
+    }
+    FilteredIterator operator++(int) {
+        FilteredIterator it = *this;
+        ++(*this);
+        return it;
+    }
+    bool operator==(const FilteredIterator &rhs) const {
+        return m_it == rhs.m_it;
+    }
+    bool operator!=(const FilteredIterator &rhs) const {
+        return m_it != rhs.m_it;
+    }
+
+   private:
+    Iterator m_it;
+    Pred m_pred;
+
+    void satisfy() {
+        while (m_it != Iterator() && !m_pred(*m_it))
+            ++m_it;
+    }
+};
+
+//! Pair of traversal iterators usable with range-based for
+template <class Iterator>
+class TraversalRange {
+   public:
+    TraversalRange(Iterator begin, Iterator end) : m_begin(begin), m_end(end) {
+    }
+    Iterator begin() const {
+        return m_begin;
+    }
+    Iterator end() const {
+        return m_end;
+    }
+
+   private:
+    Iterator m_begin;
+    Iterator m_end;
+};
+
+//! Accepts element \ref Node s (void, text only and normal elements)
+template <typename Ch>
+struct element_pred {
+    bool operator()(const Node<Ch> *node) const {
+        return node->type() <= Node<Ch>::NODE_ELEMENT;
+    }
+};
+
+//! Accepts \ref Node s of one \ref Node::NODE_TYPE
+template <typename Ch>
+struct node_type_pred {
+    typename Node<Ch>::NODE_TYPE type;
+    bool operator()(const Node<Ch> *node) const {
+        return node->type() == type;
+    }
+};
+
+//! Accepts element \ref Node s with a given name, aka element type
+template <typename Ch>
+struct element_name_pred {
+    String<Ch> name;
+    bool operator()(const Node<Ch> *node) const {
+        return node->type() <= Node<Ch>::NODE_ELEMENT && node->name() == name;
+    }
+};
+
+//! Visits a subtree in pre-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \return range for use in range-based for.
+template <typename Ch>
+inline TraversalRange<PreOrderIterator<Ch>> pre_order(Node<Ch> *root) {
+    return TraversalRange<PreOrderIterator<Ch>>(PreOrderIterator<Ch>(root),
+                                                PreOrderIterator<Ch>());
+}
+
+//! Visits a subtree in post-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \return range for use in range-based for.
+template <typename Ch>
+inline TraversalRange<PostOrderIterator<Ch>> post_order(Node<Ch> *root) {
+    return TraversalRange<PostOrderIterator<Ch>>(PostOrderIterator<Ch>(root),
+                                                 PostOrderIterator<Ch>());
+}
+
+//! Visits the \ref Node s of a subtree accepted by a predicate, in pre-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \param pred predicate called with each \ref Node pointer.
+//! \return range for use in range-based for.
+template <typename Ch, class Pred>
+inline TraversalRange<FilteredIterator<PreOrderIterator<Ch>, Pred>> pre_order_if(Node<Ch> *root,
+                                                                                  Pred pred) {
+    typedef FilteredIterator<PreOrderIterator<Ch>, Pred> iterator;
+    return TraversalRange<iterator>(iterator(PreOrderIterator<Ch>(root), pred),
+                                    iterator(PreOrderIterator<Ch>(), pred));
+}
+
+//! Visits the \ref Node s of a subtree accepted by a predicate, in post-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \param pred predicate called with each \ref Node pointer.
+//! \return range for use in range-based for.
+template <typename Ch, class Pred>
+inline TraversalRange<FilteredIterator<PostOrderIterator<Ch>, Pred>> post_order_if(Node<Ch> *root,
+                                                                                    Pred pred) {
+    typedef FilteredIterator<PostOrderIterator<Ch>, Pred> iterator;
+    return TraversalRange<iterator>(iterator(PostOrderIterator<Ch>(root), pred),
+                                    iterator(PostOrderIterator<Ch>(), pred));
+}
+
+//! Visits the element \ref Node s of a subtree in pre-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \return range for use in range-based for.
+template <typename Ch>
+inline TraversalRange<FilteredIterator<PreOrderIterator<Ch>, element_pred<Ch>>> elements(
+    Node<Ch> *root) {
+    return pre_order_if(root, element_pred<Ch>());
+}
+
+//! Visits the \ref Node s of one \ref Node::NODE_TYPE in a subtree, in pre-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \param type the \ref Node::NODE_TYPE to visit.
+//! \return range for use in range-based for.
+template <typename Ch>
+inline TraversalRange<FilteredIterator<PreOrderIterator<Ch>, node_type_pred<Ch>>> nodes_of_type(
+    Node<Ch> *root,
+    typename Node<Ch>::NODE_TYPE type) {
+    node_type_pred<Ch> pred = {type};
+    return pre_order_if(root, pred);
+}
+
+//! Visits the elements with a given name in a subtree, in pre-order.
+//! \param root \ref Node whose subtree is visited, including root itself.
+//! \param name \ref String of the element name, aka element type.
+//! \return range for use in range-based for.
+template <typename Ch>
+inline TraversalRange<FilteredIterator<PreOrderIterator<Ch>, element_name_pred<Ch>>>
+elements_named(Node<Ch> *root, const String<Ch> &name) {
+    element_name_pred<Ch> pred = {name};
+    return pre_order_if(root, pred);
+}
+}  // namespace nvparsehtml
+
+#endif